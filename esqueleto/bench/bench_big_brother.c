@@ -0,0 +1,298 @@
+/*
+ * bench_big_brother.c
+ *
+ * Throughput of censored_words_found, in MB/s, for buffers of several sizes,
+ * lists of several numbers of words, and texts with more or less of them
+ * planted in different cases. The mask of every buffer is checked against
+ * has_strcasestr, the scan that censored_words_found used to do word by word,
+ * which is also timed for comparison.
+ *
+ * Prints a line for each combination, and the fraction of buffers where each
+ * word was found. Exits with 1 if any result was wrong.
+ */
+
+#include "bench_util.h"
+#include "big_brother.h"
+#include "epoch.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define MIB (1 << 20)
+// Text that is scanned, cut in buffers of each size
+#define CORPUS_SIZE (2 * MIB)
+// Each combination is scanned again and again for at least this long
+#define MIN_SECONDS 0.1
+// Size of the buffers where the hit rates of the words are counted
+#define HIT_RATE_SIZE 4096
+
+static const size_t buffer_sizes[] = {64, HIT_RATE_SIZE, 128 << 10, MIB};
+static const size_t list_sizes[] = {1, 5, 16, CENSORED_WORDS_MAX};
+// Words planted in each MiB of text
+static const unsigned int densities[] = {0, 64, 4096};
+#define NUM_DENSITIES (sizeof(densities) / sizeof(densities[0]))
+
+enum case_mix { CASE_LOWER, CASE_ORIGINAL, CASE_MIXED, NUM_CASES };
+static const char *case_names[] = {"lower", "original", "mixed"};
+
+// Lists are the first words of these, the default censored_words first
+static char *bench_words[] = {
+    "Oldspeak",   "English",     "revolution",  "Emmanuel",
+    "Goldstein",  "Newspeak",    "doublethink", "thoughtcrime",
+    "Minitrue",   "Miniplenty",  "Minipax",     "Miniluv",
+    "Ingsoc",     "unperson",    "crimestop",   "duckspeak",
+    "facecrime",  "goodthink",   "ownlife",     "sexcrime",
+    "telescreen", "Eurasia",     "Eastasia",    "Oceania",
+    "Airstrip",   "Brotherhood", "prolefeed",   "Julia",
+    "Winston",    "Parsons",     "Syme",        "O'Brien",
+};
+
+_Static_assert(sizeof(bench_words) / sizeof(bench_words[0]) ==
+                   CENSORED_WORDS_MAX,
+               "there must be words for the longest list");
+
+// The text around the planted words
+static const char *filler[] = {
+    "the",     "of",        "and",      "to",    "in",      "was",
+    "that",    "he",        "it",       "his",   "with",    "had",
+    "on",      "at",        "as",       "for",   "not",     "by",
+    "they",    "party",     "war",      "is",    "peace",   "freedom",
+    "slavery", "ignorance", "strength", "big",   "brother", "watching",
+    "you",     "clock",     "thirteen", "april", "cold",    "bright",
+};
+
+#define NUM_FILLER (sizeof(filler) / sizeof(filler[0]))
+
+/* Checks if a needle is a substring of the string haystack
+ * Ignores capitalization
+ */
+static bool has_strcasestr(const char *haystack, const char *needle,
+                           size_t haystack_length) {
+    size_t needle_length = strlen(needle);
+    for (size_t i = 0; i < haystack_length; i++) {
+        if (i + needle_length > haystack_length) {
+            return false;
+        }
+        if (strncasecmp(&haystack[i], needle, needle_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the mask of the first @num_words words found by has_strcasestr */
+static u32 reference_found(const char *buf, size_t size, size_t num_words) {
+    u32 words = 0;
+    for (size_t i = 0; i < num_words; i++) {
+        if (has_strcasestr(buf, bench_words[i], size)) {
+            words |= 1u << i;
+        }
+    }
+    return words;
+}
+
+/* Fills @corpus with filler words, and plants in it @density words per MiB of
+ * the first @num_words, in the case of @mix.
+ */
+static void corpus_fill(char *corpus, size_t num_words, unsigned int density,
+                        enum case_mix mix, u64 *seed) {
+    size_t pos = 0;
+    while (pos < CORPUS_SIZE) {
+        const char *word = filler[bench_random(seed) % NUM_FILLER];
+        size_t len = strlen(word);
+        if (len > CORPUS_SIZE - pos) {
+            len = CORPUS_SIZE - pos;
+        }
+        memcpy(corpus + pos, word, len);
+        pos += len;
+        if (pos < CORPUS_SIZE) {
+            corpus[pos++] = ' ';
+        }
+    }
+    size_t num_planted = (size_t)density * (CORPUS_SIZE / MIB);
+    for (size_t i = 0; i < num_planted; i++) {
+        const char *word = bench_words[bench_random(seed) % num_words];
+        size_t len = strlen(word);
+        char *at = corpus + bench_random(seed) % (CORPUS_SIZE - len + 1);
+        for (size_t j = 0; j < len; j++) {
+            if (mix == CASE_LOWER ||
+                (mix == CASE_MIXED && bench_random(seed) & 1)) {
+                at[j] = tolower((unsigned char)word[j]);
+            } else if (mix == CASE_MIXED) {
+                at[j] = toupper((unsigned char)word[j]);
+            } else {
+                at[j] = word[j];
+            }
+        }
+    }
+}
+
+/* Results of scanning the corpus in buffers of a size */
+struct scan_result_s {
+    double mbps;
+    double reference_mbps;
+    size_t num_buffers;
+    size_t num_found; // Buffers with some word
+    size_t hits[CENSORED_WORDS_MAX]; // Buffers with each word
+    size_t num_wrong;
+};
+
+/* Scans @corpus in buffers of @size with the list of @num_words in use, and
+ * checks the masks found. Leaves the results in @result.
+ */
+static void bench_scan(const char *corpus, size_t size, size_t num_words,
+                       epoch reclaim, u32 *expected,
+                       struct scan_result_s *result) {
+    size_t num_buffers = CORPUS_SIZE / size;
+    size_t bytes = 0;
+    u32 version;
+    double start, elapsed;
+
+    memset(result, 0, sizeof(*result));
+    result->num_buffers = num_buffers;
+    start = bench_now();
+    do {
+        for (size_t b = 0; b < num_buffers; b++) {
+            epoch_enter(reclaim);
+            censored_words_found(corpus + b * size, size, &version);
+            epoch_exit(reclaim);
+        }
+        bytes += CORPUS_SIZE;
+    } while ((elapsed = bench_now() - start) < MIN_SECONDS);
+    result->mbps = bytes / elapsed / 1e6;
+
+    start = bench_now();
+    for (size_t b = 0; b < num_buffers; b++) {
+        expected[b] = reference_found(corpus + b * size, size, num_words);
+    }
+    result->reference_mbps = CORPUS_SIZE / (bench_now() - start) / 1e6;
+
+    for (size_t b = 0; b < num_buffers; b++) {
+        epoch_enter(reclaim);
+        u32 words = censored_words_found(corpus + b * size, size, &version);
+        epoch_exit(reclaim);
+        if (words != expected[b]) {
+            if (result->num_wrong++ == 0) {
+                fprintf(stderr,
+                        "bench-bb: %zu words, buffer of %zu bytes at %zu: "
+                        "found 0x%08x instead of 0x%08x\n",
+                        num_words, size, b * size, words, expected[b]);
+            }
+        }
+        result->num_found += words != 0;
+        for (size_t i = 0; i < num_words; i++) {
+            result->hits[i] += (words >> i) & 1;
+        }
+    }
+}
+
+/* Uses the first @num_words as censored words, writing them in @path */
+static bool words_use(const char *path, size_t num_words, epoch reclaim,
+                      bool loaded) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < num_words; i++) {
+        fprintf(file, "%s\n", bench_words[i]);
+    }
+    if (fclose(file) != 0) {
+        return false;
+    }
+    if (!loaded) {
+        return censored_words_load(path, reclaim);
+    }
+    censored_words_list old = censored_words_reload();
+    if (old == NULL) {
+        return false;
+    }
+    censored_words_release(old);
+    return true;
+}
+
+int main(void) {
+    char path[] = "/tmp/bench_bb_XXXXXX";
+    size_t num_wrong = 0;
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        fprintf(stderr, "bench-bb: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    close(fd);
+    epoch reclaim = epoch_init();
+    char *corpus = malloc(CORPUS_SIZE);
+    u32 *expected = malloc(CORPUS_SIZE / buffer_sizes[0] * sizeof(u32));
+    if (reclaim == NULL || corpus == NULL || expected == NULL) {
+        fprintf(stderr, "bench-bb: %s\n", strerror(ENOMEM));
+        unlink(path);
+        return 1;
+    }
+
+    for (size_t l = 0; l < sizeof(list_sizes) / sizeof(list_sizes[0]); l++) {
+        size_t num_words = list_sizes[l];
+        size_t hits[NUM_DENSITIES][CENSORED_WORDS_MAX] = {{0}};
+        size_t hit_buffers[NUM_DENSITIES] = {0};
+        u64 seed = 0x9e3779b97f4a7c15ULL;
+
+        if (!words_use(path, num_words, reclaim, l > 0)) {
+            fprintf(stderr, "bench-bb: %s: %s\n", path, strerror(errno));
+            num_wrong++;
+            break;
+        }
+        printf("%5s %8s %-8s %8s %10s %10s %6s\n", "words", "per MiB",
+               "case", "buffer", "MB/s", "ref MB/s", "found");
+        for (size_t d = 0; d < NUM_DENSITIES; d++) {
+            for (enum case_mix mix = 0; mix < NUM_CASES; mix++) {
+                corpus_fill(corpus, num_words, densities[d], mix, &seed);
+                for (size_t s = 0;
+                     s < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]);
+                     s++) {
+                    struct scan_result_s result;
+                    bench_scan(corpus, buffer_sizes[s], num_words, reclaim,
+                               expected, &result);
+                    printf("%5zu %8u %-8s %8zu %10.1f %10.1f %5.1f%%\n",
+                           num_words, densities[d], case_names[mix],
+                           buffer_sizes[s], result.mbps,
+                           result.reference_mbps,
+                           100.0 * result.num_found / result.num_buffers);
+                    num_wrong += result.num_wrong;
+                    if (buffer_sizes[s] == HIT_RATE_SIZE) {
+                        hit_buffers[d] += result.num_buffers;
+                        for (size_t i = 0; i < num_words; i++) {
+                            hits[d][i] += result.hits[i];
+                        }
+                    }
+                }
+            }
+        }
+        printf("\nBuffers of %d bytes where each word was found:\n%-14s",
+               HIT_RATE_SIZE, "per MiB");
+        for (size_t d = 0; d < NUM_DENSITIES; d++) {
+            printf(" %7u", densities[d]);
+        }
+        printf("\n");
+        for (size_t i = 0; i < num_words; i++) {
+            printf("%-14s", bench_words[i]);
+            for (size_t d = 0; d < NUM_DENSITIES; d++) {
+                printf(" %6.1f%%", 100.0 * hits[d][i] / hit_buffers[d]);
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+
+    censored_words_free();
+    epoch_destroy(reclaim);
+    free(expected);
+    free(corpus);
+    unlink(path);
+    if (num_wrong > 0) {
+        fprintf(stderr, "bench-bb: %zu wrong results\n", num_wrong);
+        return 1;
+    }
+    return 0;
+}
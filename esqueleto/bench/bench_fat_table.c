@@ -0,0 +1,249 @@
+/*
+ * bench_fat_table.c
+ *
+ * Times the allocation, seek and free of clusters of fat_table, in FATs of
+ * 2^16 to 2^24 clusters built in memory:
+ *  - empty: every cluster is free, but the ones of a file at the start.
+ *  - fragmented: half of the clusters, at random, are used, and the file is
+ *    scattered in the other ones.
+ *  - full: the first 90% of the clusters are used, the file among them.
+ * The entries written go to a temporary file, like they go to the volume.
+ *
+ * Prints a line of JSON for each operation and FAT (see bench_util.h).
+ */
+
+#include "bench_util.h"
+#include "fat_table.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MIN_CLUSTERS_ORDER 16
+#define MAX_CLUSTERS_ORDER 24
+#define CLUSTER_ORDER 12 // 4 KiB clusters
+// Clusters of the file where the seeks are done, 16 MiB
+#define FILE_CLUSTERS 4096
+#define SEEK_OPS 4096
+#define ALLOC_OPS 16384
+// Clusters of each fat_table_alloc_run
+#define RUN_CLUSTERS 16
+#define RUN_OPS 1024
+
+enum fat_map_kind { MAP_EMPTY, MAP_FRAGMENTED, MAP_FULL, NUM_MAPS };
+static const char *map_names[] = {"empty", "fragmented", "full"};
+
+static void set_entry(fat_table table, u32 cluster, u32 next) {
+    ((le32 *)table->fat_map)[cluster] = cpu_to_le32(next);
+}
+
+/* Marks the clusters of @map in the FAT of @table, and chains FILE_CLUSTERS
+ * of them as a file that starts in the returned cluster. Returns
+ * FAT_CLUSTER_END_OF_CHAIN if there is no memory.
+ */
+static u32 fat_map_fill(fat_table table, enum fat_map_kind map, u64 *seed) {
+    u32 end = table->num_data_clusters + 2;
+    u32 *file = malloc(FILE_CLUSTERS * sizeof(u32));
+    if (file == NULL) {
+        return FAT_CLUSTER_END_OF_CHAIN;
+    }
+    for (u32 i = 0; i < FILE_CLUSTERS; i++) {
+        file[i] = 2 + i;
+    }
+    if (map == MAP_FRAGMENTED) {
+        u32 *free_clusters = malloc(table->num_data_clusters * sizeof(u32));
+        if (free_clusters == NULL) {
+            free(file);
+            return FAT_CLUSTER_END_OF_CHAIN;
+        }
+        u32 num_free = 0;
+        for (u32 cluster = 2; cluster < end; cluster++) {
+            if (bench_random(seed) & 1) {
+                set_entry(table, cluster, FAT_CLUSTER_END_OF_CHAIN);
+            } else {
+                free_clusters[num_free++] = cluster;
+            }
+        }
+        bench_shuffle(free_clusters, num_free, seed);
+        memcpy(file, free_clusters, FILE_CLUSTERS * sizeof(u32));
+        free(free_clusters);
+    } else if (map == MAP_FULL) {
+        u32 used_end = 2 + (u32)((u64)table->num_data_clusters * 9 / 10);
+        for (u32 cluster = 2; cluster < used_end; cluster++) {
+            set_entry(table, cluster, FAT_CLUSTER_END_OF_CHAIN);
+        }
+    }
+    for (u32 i = 0; i < FILE_CLUSTERS; i++) {
+        set_entry(table, file[i],
+                  i + 1 < FILE_CLUSTERS ? file[i + 1]
+                                        : FAT_CLUSTER_END_OF_CHAIN);
+    }
+    u32 start = file[0];
+    free(file);
+    return start;
+}
+
+static void bench_seek(fat_table table, u32 file_start, const char *params,
+                       u64 *seed) {
+    struct bench_result_s result = {.name = "fat_table_seek_cluster"};
+    off_t file_size = (off_t)FILE_CLUSTERS << CLUSTER_ORDER;
+    off_t offsets[SEEK_OPS];
+    for (size_t i = 0; i < SEEK_OPS; i++) {
+        offsets[i] = bench_random(seed) % file_size;
+    }
+    do {
+        double start = bench_now();
+        for (size_t i = 0; i < SEEK_OPS; i++) {
+            fat_table_seek_cluster(table, file_start, offsets[i]);
+        }
+        result.seconds += bench_now() - start;
+        result.ops += SEEK_OPS;
+    } while (result.seconds < BENCH_MIN_SECONDS);
+    bench_print(&result, params);
+}
+
+/* Allocates clusters one by one, up to half of the free ones, and frees them,
+ * again and again
+ */
+static bool bench_alloc(fat_table table, const char *params) {
+    struct bench_result_s alloc = {.name = "fat_table_alloc_cluster"};
+    struct bench_result_s release = {.name = "fat_table_free_cluster"};
+    size_t num_free = 0;
+    for (u32 i = 0; i < table->num_groups; i++) {
+        num_free += table->groups[i].free_count;
+    }
+    size_t num_ops = min((size_t)ALLOC_OPS, num_free / 2);
+    u32 *clusters = malloc(ALLOC_OPS * sizeof(u32));
+    if (clusters == NULL) {
+        return false;
+    }
+    do {
+        size_t count = 0;
+        double start = bench_now();
+        for (size_t i = 0; i < num_ops; i++) {
+            u32 cluster = fat_table_alloc_cluster(table);
+            if (fat_table_is_EOC(table, cluster)) {
+                break;
+            }
+            clusters[count++] = cluster;
+        }
+        alloc.seconds += bench_now() - start;
+        alloc.ops += count;
+        alloc.allocs += count;
+
+        start = bench_now();
+        for (size_t i = 0; i < count; i++) {
+            fat_table_set_next_cluster(table, clusters[i], FAT_CLUSTER_FREE);
+        }
+        release.seconds += bench_now() - start;
+        release.ops += count;
+        release.frees += count;
+        if (count == 0) {
+            break;
+        }
+    } while (alloc.seconds < BENCH_MIN_SECONDS);
+    free(clusters);
+    bench_print(&alloc, params);
+    bench_print(&release, params);
+    return true;
+}
+
+/* Allocates runs of clusters after the previous one, like a file that grows,
+ * until one can't be allocated, and frees them
+ */
+static bool bench_alloc_run(fat_table table, const char *params) {
+    struct bench_result_s alloc = {.name = "fat_table_alloc_run"};
+    u32 *runs = malloc(RUN_OPS * sizeof(u32));
+    if (runs == NULL) {
+        return false;
+    }
+    do {
+        size_t count = 0;
+        u32 near = FAT_CLUSTER_END_OF_CHAIN;
+        double start = bench_now();
+        for (size_t i = 0; i < RUN_OPS; i++) {
+            u32 first = fat_table_alloc_run(table, near, RUN_CLUSTERS,
+                                            fat_table_home_group(table));
+            alloc.ops++;
+            if (fat_table_is_EOC(table, first)) {
+                break;
+            }
+            runs[count++] = first;
+            near = first + RUN_CLUSTERS;
+        }
+        alloc.seconds += bench_now() - start;
+        alloc.allocs += count * RUN_CLUSTERS;
+        for (size_t i = 0; i < count; i++) {
+            for (u32 cluster = runs[i]; cluster < runs[i] + RUN_CLUSTERS;
+                 cluster++) {
+                fat_table_set_next_cluster(table, cluster, FAT_CLUSTER_FREE);
+            }
+        }
+        if (count < RUN_OPS) {
+            break; // The next ones would fail the same
+        }
+    } while (alloc.seconds < BENCH_MIN_SECONDS);
+    free(runs);
+    bench_print(&alloc, params);
+    return true;
+}
+
+/* Runs the benchmarks in a FAT of 2^@order clusters of @map. Returns false
+ * on errors.
+ */
+static bool fat_bench(enum fat_map_kind map, unsigned int order, int fd,
+                      u64 *seed) {
+    struct fat_table_s table;
+    char params[128];
+    bool ok = false;
+
+    bench_case_start();
+    memset(&table, 0, sizeof(table));
+    table.num_data_clusters = 1U << order;
+    table.fat_map = calloc(table.num_data_clusters + 2, sizeof(le32));
+    table.fat_offset = 0;
+    table.data_start_offset =
+        (off_t)(table.num_data_clusters + 2) * sizeof(le32);
+    table.fd = fd;
+    table.cluster_order = CLUSTER_ORDER;
+    if (table.fat_map == NULL) {
+        fprintf(stderr, "bench-fat: %s\n", strerror(ENOMEM));
+        return false;
+    }
+    u32 file_start = fat_map_fill(&table, map, seed);
+    if (!fat_table_is_EOC(&table, file_start) &&
+        fat_table_init_groups(&table) == 0) {
+        snprintf(params, sizeof(params), "\"map\":\"%s\",\"clusters\":%u",
+                 map_names[map], table.num_data_clusters);
+        bench_seek(&table, file_start, params, seed);
+        ok = bench_alloc(&table, params) && bench_alloc_run(&table, params);
+        fat_table_destroy_groups(&table);
+    }
+    if (!ok) {
+        fprintf(stderr, "bench-fat: %s\n", strerror(ENOMEM));
+    }
+    free(table.fat_map);
+    return ok;
+}
+
+int main(void) {
+    char path[] = "/tmp/bench_fat_XXXXXX";
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    bool ok = true;
+
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        fprintf(stderr, "bench-fat: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    unlink(path);
+    for (unsigned int order = MIN_CLUSTERS_ORDER;
+         ok && order <= MAX_CLUSTERS_ORDER; order += 4) {
+        for (enum fat_map_kind map = 0; ok && map < NUM_MAPS; map++) {
+            ok = fat_bench(map, order, fd, &seed);
+        }
+    }
+    close(fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+/*
+ * bench_hierarchy_tree.c
+ *
+ * Times h_tree_insert, h_tree_search, h_tree_delete and the flatten functions
+ * with trees of 10^3 to 10^7 paths of a hierarchy of directories, like the
+ * ones fat_fs_tree keeps. The paths are inserted in these orders:
+ *  - sorted: in strcmp order, like a volume whose directories are read in
+ *    order.
+ *  - random: each level of the hierarchy in random order, after the levels
+ *    above it (a directory must be in the tree before its entries).
+ *  - deep-prefix: like random, inside a chain of directories with long names,
+ *    so comparing two paths goes through a long common prefix.
+ * They are searched in random order, and deleted in the reverse order of the
+ * insertion, the entries before their directories.
+ *
+ * Prints a line of JSON for each operation and number of paths (see
+ * bench_util.h).
+ */
+
+#include "bench_util.h"
+#include "hierarchy_tree.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_PATHS 1000
+#define MAX_PATHS 10000000
+// Entries of each directory
+#define FANOUT 16
+// The search tree is not balanced, sorted paths make it a list where every
+// operation goes through all the paths before. Bigger trees take hours.
+#define SORTED_MAX_PATHS 10000
+
+#define NO_PARENT ((u32)-1)
+
+struct order_s {
+    const char *name;
+    bool sorted;
+    // Directories with long names that contain the rest
+    unsigned int prefix_dirs;
+    size_t max_paths;
+};
+
+static const struct order_s orders[] = {
+    {"sorted", true, 0, SORTED_MAX_PATHS},
+    {"random", false, 0, MAX_PATHS},
+    {"deep-prefix", false, 4, MAX_PATHS},
+};
+
+static const char *dir_names[] = {"home",   "src",      "docs",  "music",
+                                  "photos", "projects", "build", "notes"};
+static const char *file_names[] = {"report", "image", "main",
+                                   "readme", "data",  "draft"};
+static const char *file_extensions[] = {"txt", "jpg", "c", "md", "pdf", "h"};
+
+#define NUM_OF(array) (sizeof(array) / sizeof(array[0]))
+
+/* The paths of a hierarchy, numbered in breadth first order: the root is 0,
+ * and the directories come before their entries.
+ */
+struct paths_s {
+    size_t count;
+    char **path;
+    u32 *parent;
+    u8 *depth;
+    bool *is_dir;
+    char *chars; // Of all the paths
+};
+
+/* Writes in @buf, of @size, the name of the entry @i of @paths, and returns
+ * its length.
+ */
+static size_t entry_name(const struct paths_s *paths, unsigned int prefix_dirs,
+                         size_t i, char *buf, size_t size) {
+    if (i <= prefix_dirs) {
+        return snprintf(buf, size, "nested_directory_%zu", i);
+    }
+    size_t j = (i - prefix_dirs - 1) % FANOUT;
+    if (paths->is_dir[i]) {
+        return snprintf(buf, size, "%s%02zu", dir_names[j % NUM_OF(dir_names)],
+                        j);
+    }
+    return snprintf(buf, size, "%s%02zu.%s",
+                    file_names[j % NUM_OF(file_names)], j,
+                    file_extensions[j % NUM_OF(file_extensions)]);
+}
+
+/* Builds in @paths a hierarchy of @count paths, whose first @prefix_dirs
+ * directories are a chain that contains the rest. Returns false if there is
+ * no memory.
+ */
+static bool paths_init(struct paths_s *paths, size_t count,
+                       unsigned int prefix_dirs) {
+    char name[64];
+    size_t total = 2;
+
+    memset(paths, 0, sizeof(*paths));
+    paths->count = count;
+    paths->path = calloc(count, sizeof(char *));
+    paths->parent = calloc(count, sizeof(u32));
+    paths->depth = calloc(count, sizeof(u8));
+    paths->is_dir = calloc(count, sizeof(bool));
+    u32 *len = calloc(count, sizeof(u32));
+    if (paths->path == NULL || paths->parent == NULL ||
+        paths->depth == NULL || paths->is_dir == NULL || len == NULL) {
+        free(len);
+        return false;
+    }
+    paths->parent[0] = NO_PARENT;
+    paths->is_dir[0] = true;
+    len[0] = 1;
+    for (size_t i = 1; i < count; i++) {
+        u32 parent = i <= prefix_dirs
+                         ? i - 1
+                         : prefix_dirs + (i - prefix_dirs - 1) / FANOUT;
+        paths->parent[i] = parent;
+        paths->depth[i] = paths->depth[parent] + 1;
+        paths->is_dir[i] =
+            i < prefix_dirs ||
+            prefix_dirs + (i - prefix_dirs) * FANOUT + 1 < count;
+        len[i] = (parent == 0 ? 0 : len[parent]) + 1 +
+                 entry_name(paths, prefix_dirs, i, name, sizeof(name));
+        total += len[i] + 1;
+    }
+    paths->chars = malloc(total);
+    if (paths->chars == NULL) {
+        free(len);
+        return false;
+    }
+    char *next = paths->chars;
+    strcpy(next, "/");
+    paths->path[0] = next;
+    next += 2;
+    for (size_t i = 1; i < count; i++) {
+        u32 parent = paths->parent[i];
+        entry_name(paths, prefix_dirs, i, name, sizeof(name));
+        sprintf(next, "%s/%s", parent == 0 ? "" : paths->path[parent], name);
+        paths->path[i] = next;
+        next += len[i] + 1;
+    }
+    free(len);
+    return true;
+}
+
+static void paths_destroy(struct paths_s *paths) {
+    free(paths->chars);
+    free(paths->is_dir);
+    free(paths->depth);
+    free(paths->parent);
+    free(paths->path);
+}
+
+static const struct paths_s *sorting_paths = NULL;
+
+static int path_index_cmp(const void *i1, const void *i2) {
+    return strcmp(sorting_paths->path[*(const u32 *)i1],
+                  sorting_paths->path[*(const u32 *)i2]);
+}
+
+/* Fills @order with the indexes of @paths in the order of insertion */
+static void paths_order(const struct paths_s *paths, bool sorted, u32 *order,
+                        u64 *seed) {
+    for (size_t i = 0; i < paths->count; i++) {
+        order[i] = i;
+    }
+    if (sorted) {
+        sorting_paths = paths;
+        qsort(order, paths->count, sizeof(u32), path_index_cmp);
+        return;
+    }
+    // The levels are already one after the other
+    size_t level_start = 0;
+    for (size_t i = 1; i <= paths->count; i++) {
+        if (i == paths->count || paths->depth[i] != paths->depth[i - 1]) {
+            bench_shuffle(order + level_start, i - level_start, seed);
+            level_start = i;
+        }
+    }
+}
+
+static void path_keep(void *path) {}
+
+/* Results of each operation, added up over the repetitions */
+enum {
+    OP_INSERT,
+    OP_SEARCH,
+    OP_FLATTEN_PREORDER,
+    OP_FLATTEN_H_CHILDREN,
+    OP_DELETE,
+    NUM_OPS
+};
+
+static const char *op_names[] = {"h_tree_insert", "h_tree_search",
+                                 "h_tree_flatten_preorder",
+                                 "h_tree_flatten_h_children", "h_tree_delete"};
+
+/* Buffers for the operations of a tree of up to max_paths */
+struct tree_bench_s {
+    u32 *order;
+    u32 *search_order;
+    h_tree *nodes;
+    void **elems;
+};
+
+/* Inserts, searches, flattens and deletes @paths in @order, once. Adds the
+ * results to @results. Returns false if some operation gave a wrong result.
+ */
+static bool tree_run(const struct paths_s *paths,
+                     const struct tree_bench_s *bench,
+                     struct bench_result_s *results) {
+    data_cmp_fn cmp = (data_cmp_fn)strcmp;
+    size_t count = paths->count;
+    slab node_slab = h_tree_node_slab_init();
+    h_tree root = NULL;
+    size_t wrong = 0;
+    double start;
+
+    if (node_slab == NULL) {
+        return false;
+    }
+    start = bench_now();
+    for (size_t k = 0; k < count; k++) {
+        u32 i = bench->order[k], parent = paths->parent[i];
+        h_tree h_parent = parent == NO_PARENT ? NULL : bench->nodes[parent];
+        root = h_tree_insert(root, paths->path[i], h_parent, cmp, node_slab);
+        // New nodes go first in the children of their parent
+        bench->nodes[i] = h_parent == NULL ? root
+                                           : h_tree_get_h_children(h_parent);
+    }
+    results[OP_INSERT].seconds += bench_now() - start;
+    results[OP_INSERT].ops += count;
+    results[OP_INSERT].allocs += slab_count(node_slab);
+    wrong += h_tree_size(root) != (int)count;
+
+    start = bench_now();
+    for (size_t k = 0; k < count; k++) {
+        u32 i = bench->search_order[k];
+        wrong += h_tree_search(root, paths->path[i], cmp) != bench->nodes[i];
+    }
+    results[OP_SEARCH].seconds += bench_now() - start;
+    results[OP_SEARCH].ops += count;
+
+    start = bench_now();
+    h_tree_flatten_preorder(root, bench->elems);
+    results[OP_FLATTEN_PREORDER].seconds += bench_now() - start;
+    results[OP_FLATTEN_PREORDER].ops += count;
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        if (paths->is_dir[i]) {
+            h_tree_flatten_h_children(bench->nodes[i], bench->elems);
+            results[OP_FLATTEN_H_CHILDREN].ops++;
+        }
+    }
+    results[OP_FLATTEN_H_CHILDREN].seconds += bench_now() - start;
+
+    size_t allocated = slab_count(node_slab);
+    start = bench_now();
+    for (size_t k = count; k-- > 0;) {
+        root = h_tree_delete(root, paths->path[bench->order[k]], cmp,
+                             path_keep);
+    }
+    results[OP_DELETE].seconds += bench_now() - start;
+    results[OP_DELETE].ops += count;
+    results[OP_DELETE].frees += allocated - slab_count(node_slab);
+    wrong += root != NULL;
+
+    slab_destroy(node_slab);
+    if (wrong > 0) {
+        fprintf(stderr, "bench-tree: %zu wrong results\n", wrong);
+    }
+    return wrong == 0;
+}
+
+/* Runs the operations with @count paths in @order. Returns false on errors. */
+static bool tree_bench(const struct order_s *order, size_t count,
+                       const struct tree_bench_s *bench, u64 *seed) {
+    struct bench_result_s results[NUM_OPS];
+    struct paths_s paths;
+    char params[128];
+    bool ok = true;
+
+    snprintf(params, sizeof(params), "\"order\":\"%s\",\"paths\":%zu",
+             order->name, count);
+    if (count > order->max_paths) {
+        for (int op = 0; op < NUM_OPS; op++) {
+            bench_print_skipped(op_names[op], params,
+                                "the unbalanced tree would take too long");
+        }
+        return true;
+    }
+    bench_case_start();
+    if (!paths_init(&paths, count, order->prefix_dirs)) {
+        paths_destroy(&paths);
+        fprintf(stderr, "bench-tree: %s\n", strerror(ENOMEM));
+        return false;
+    }
+    paths_order(&paths, order->sorted, bench->order, seed);
+    for (size_t i = 0; i < count; i++) {
+        bench->search_order[i] = i;
+    }
+    bench_shuffle(bench->search_order, count, seed);
+
+    memset(results, 0, sizeof(results));
+    for (int op = 0; op < NUM_OPS; op++) {
+        results[op].name = op_names[op];
+    }
+    // Small trees are built many times, to time more than a few microseconds
+    do {
+        ok = tree_run(&paths, bench, results);
+    } while (ok && results[OP_INSERT].seconds < BENCH_MIN_SECONDS);
+    for (int op = 0; ok && op < NUM_OPS; op++) {
+        bench_print(&results[op], params);
+    }
+    paths_destroy(&paths);
+    return ok;
+}
+
+static void usage(FILE *stream) {
+    fputs("Usage: bench_ht_runner [-n MAX]\n"
+          "Times the operations of hierarchy_tree with 1000 paths, and 10 "
+          "times more\nup to MAX (10000000 by default).\n",
+          stream);
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_paths = MAX_PATHS;
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    struct tree_bench_s bench;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:h")) != -1) {
+        switch (c) {
+        case 'n':
+            max_paths = strtoul(optarg, NULL, 10);
+            if (max_paths < MIN_PATHS || max_paths > MAX_PATHS) {
+                fprintf(stderr, "bench-tree: MAX must be from %d to %d\n",
+                        MIN_PATHS, MAX_PATHS);
+                return 1;
+            }
+            break;
+        case 'h':
+            usage(stdout);
+            return 0;
+        default:
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    bench.order = malloc(max_paths * sizeof(u32));
+    bench.search_order = malloc(max_paths * sizeof(u32));
+    bench.nodes = malloc(max_paths * sizeof(h_tree));
+    bench.elems = malloc(max_paths * sizeof(void *));
+    if (bench.order == NULL || bench.search_order == NULL ||
+        bench.nodes == NULL || bench.elems == NULL) {
+        fprintf(stderr, "bench-tree: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    bool ok = true;
+    for (size_t o = 0; ok && o < NUM_OF(orders); o++) {
+        for (size_t count = MIN_PATHS; ok && count <= max_paths; count *= 10) {
+            ok = tree_bench(&orders[o], count, &bench, &seed);
+        }
+    }
+    free(bench.elems);
+    free(bench.nodes);
+    free(bench.search_order);
+    free(bench.order);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include "bench_util.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// RSS when the case started, in KiB
+static long case_rss_kib = 0;
+// Whether the peak RSS was reset when the case started. Otherwise, the
+// current RSS is printed instead of the peak.
+static bool case_peak_reset = false;
+
+/* Returns the value in KiB of the @field ("VmRSS:"...) of the status of the
+ * process, or 0 if it's not known.
+ */
+static long status_kib(const char *field) {
+    char line[128];
+    long kib = 0;
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            sscanf(line + strlen(field), "%ld", &kib);
+            break;
+        }
+    }
+    fclose(status);
+    return kib;
+}
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+u64 bench_random(u64 *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+void bench_shuffle(u32 *array, size_t count, u64 *seed) {
+    for (size_t i = count; i > 1; i--) {
+        size_t j = bench_random(seed) % i;
+        u32 tmp = array[i - 1];
+        array[i - 1] = array[j];
+        array[j] = tmp;
+    }
+}
+
+void bench_case_start(void) {
+    // Writing 5 to clear_refs makes the peak RSS (VmHWM) the current one,
+    // since Linux 4.0
+    FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+    case_peak_reset = clear_refs != NULL && fputs("5", clear_refs) >= 0;
+    if (clear_refs != NULL && fclose(clear_refs) != 0) {
+        case_peak_reset = false;
+    }
+    case_rss_kib = status_kib("VmRSS:");
+}
+
+void bench_print(const struct bench_result_s *result, const char *params) {
+    long rss_kib = status_kib(case_peak_reset ? "VmHWM:" : "VmRSS:");
+    printf("{\"bench\":\"%s\",%s,\"ops\":%zu,\"ns_per_op\":%.1f,"
+           "\"allocs\":%zu,\"frees\":%zu,\"peak_rss_growth_kib\":%ld}\n",
+           result->name, params, result->ops,
+           result->ops > 0 ? result->seconds * 1e9 / result->ops : 0.0,
+           result->allocs, result->frees,
+           rss_kib > case_rss_kib ? rss_kib - case_rss_kib : 0);
+    fflush(stdout);
+}
+
+void bench_print_skipped(const char *name, const char *params,
+                         const char *reason) {
+    printf("{\"bench\":\"%s\",%s,\"skipped\":\"%s\"}\n", name, params,
+           reason);
+    fflush(stdout);
+}
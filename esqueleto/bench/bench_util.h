@@ -0,0 +1,57 @@
+/*
+ * bench_util.h
+ *
+ * Helpers shared by the benchmarks: clock, random numbers and the results in
+ * JSON, one object per line, so the output of several runs can be compared
+ * with a script.
+ */
+
+#ifndef _BENCH_UTIL_H
+#define _BENCH_UTIL_H
+
+#include "fat_types.h"
+#include <stddef.h>
+
+// Operations of a benchmark are repeated for at least this long
+#define BENCH_MIN_SECONDS 0.2
+
+/* Returns the time of a monotonic clock, in seconds */
+double bench_now(void);
+
+/* Returns the next number of the sequence in @seed (xorshift64), the same in
+ * every run for the same starting @seed, that can't be 0.
+ */
+u64 bench_random(u64 *seed);
+
+/* Puts the @count numbers of @array in random order */
+void bench_shuffle(u32 *array, size_t count, u64 *seed);
+
+/* Result of running @ops operations of the benchmark @name in @seconds, that
+ * allocated and freed @allocs and @frees objects (nodes, clusters...).
+ */
+struct bench_result_s {
+    const char *name;
+    size_t ops;
+    double seconds;
+    size_t allocs;
+    size_t frees;
+};
+
+/* Starts a case of a benchmark, whose memory is measured from now on: the
+ * results printed until the next case have the peak RSS over the RSS of now.
+ */
+void bench_case_start(void);
+
+/* Prints @result as a line of JSON, with @params, the members that say what
+ * was measured ("\"paths\":1000"...), and how much the peak RSS grew since
+ * bench_case_start, in KiB.
+ */
+void bench_print(const struct bench_result_s *result, const char *params);
+
+/* Prints a line of JSON saying that @name was not run with @params, and
+ * why (@reason).
+ */
+void bench_print_skipped(const char *name, const char *params,
+                         const char *reason);
+
+#endif /* _BENCH_UTIL_H */
@@ -1,8 +1,12 @@
 #include "big_brother.h"
 
+#include <assert.h>
+#include <errno.h>
 #include <gmodule.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 char *censored_words[] = {
     "Oldspeak", "English", "revolution", "Emmanuel", "Goldstein", NULL,
@@ -17,30 +21,382 @@ int is_log_filepath(char *filepath) {
     return strncmp(LOG_FILE, filepath, 8) == 0;
 }
 
-/* Checks if a needle is a substring of the string haystack
- * Ignores capitalization
+char *log_filepath(unsigned int generation, const char *extension, char *buf) {
+    if (generation == 0) {
+        snprintf(buf, LOG_FILEPATH_LEN, PATH_SEPARATOR LOG_FILE_BASENAME ".%s",
+                 extension);
+    } else {
+        snprintf(buf, LOG_FILEPATH_LEN,
+                 PATH_SEPARATOR LOG_FILE_BASENAME "%u.%s", generation,
+                 extension);
+    }
+    return buf;
+}
+
+bool is_log_filename(const char *name) {
+    size_t base_len = strlen(LOG_FILE_BASENAME);
+    if (strncmp(name, LOG_FILE_BASENAME, base_len) != 0) {
+        return false;
+    }
+    name += base_len;
+    if (*name >= '1' && *name < '0' + LOG_GENERATIONS) {
+        name++;
+    }
+    return strcmp(name, "." LOG_FILE_EXTENSION) == 0 ||
+           strcmp(name, "." LOG_INDEX_EXTENSION) == 0;
+}
+
+bool is_hidden_log_dentry(const u8 *base_name, const u8 *extension) {
+    char name[MAX_FILENAME];
+    size_t len = 0;
+    if (base_name[0] != FAT_FILENAME_DELETED_CHAR) {
+        return false;
+    }
+    // Hiding replaced the first letter of the name, that is always the same
+    name[len++] = LOG_FILE_BASENAME[0];
+    for (unsigned i = 1; i < 8 && base_name[i] != '\0' && base_name[i] != ' ';
+         i++) {
+        name[len++] = base_name[i];
+    }
+    name[len++] = '.';
+    for (unsigned i = 0; i < 3 && extension[i] != '\0' && extension[i] != ' ';
+         i++) {
+        name[len++] = extension[i];
+    }
+    name[len] = '\0';
+    return is_log_filename(name);
+}
+
+struct censored_words_list_s {
+    u32 version;
+    // Ended by NULL, allocated if they were read from a file
+    char **words;
+    size_t num_words;
+    bool allocated;
+    // All the words, looked for at once
+    word_matcher matcher;
+};
+
+// File of the words, or NULL to use censored_words
+static char *words_path = NULL;
+// Domain of the read sections of the scans
+static epoch words_reclaim = NULL;
+// Words of the scans from now on, and the ones they replaced until they are
+// released
+static censored_words_list current_words = NULL;
+static censored_words_list previous_words = NULL;
+static u32 last_version = 0;
+
+/* Words found in a whole cluster when it had @generation, of the words of
+ * @version. Like a seqlock: @seq is odd while it's being changed, and readers
+ * that see it change ignore what they read.
  */
-static bool has_strcasestr(const char *haystack, const char *needle,
-                           size_t haystack_length) {
-    size_t needle_length = strlen(needle);
-    for (size_t i = 0; i < haystack_length; i++) {
-        if (i + needle_length > haystack_length) {
-            return false;
+struct cluster_words_s {
+    u32 seq;
+    u32 cluster; // 0 if it's empty, data clusters start at 2
+    u32 generation;
+    u32 version;
+    u32 words;
+};
+
+static struct cluster_words_s *cluster_cache = NULL;
+
+static void words_free(char **words) {
+    for (size_t i = 0; words[i] != NULL; i++) {
+        free(words[i]);
+    }
+    free(words);
+}
+
+/* Reads the words of the file @path, one per line, skipping the empty ones.
+ * Returns them ended by NULL, or NULL and sets errno.
+ */
+static char **words_read(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+    char **words = calloc(CENSORED_WORDS_MAX + 1, sizeof(char *));
+    char *line = NULL;
+    size_t line_size = 0, num_words = 0;
+    ssize_t len;
+    int err = words == NULL ? ENOMEM : 0;
+    while (err == 0 && (len = getline(&line, &line_size, file)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        } else if (len > CENSORED_WORD_MAX_LEN) {
+            err = ENAMETOOLONG;
+        } else if (num_words == CENSORED_WORDS_MAX) {
+            err = E2BIG;
+        } else if ((words[num_words++] = strdup(line)) == NULL) {
+            err = ENOMEM;
+        }
+    }
+    if (err == 0 && ferror(file)) {
+        err = EIO;
+    }
+    free(line);
+    fclose(file);
+    if (err != 0) {
+        if (words != NULL) {
+            words_free(words);
         }
-        if (strncasecmp(&haystack[i], needle, needle_length) == 0) {
-            return true;
+        errno = err;
+        return NULL;
+    }
+    return words;
+}
+
+static void list_destroy(censored_words_list list) {
+    if (list->matcher != NULL) {
+        word_matcher_destroy(list->matcher);
+    }
+    if (list->allocated) {
+        words_free(list->words);
+    }
+    free(list);
+}
+
+/* Reads and compiles the words of the next version. Returns NULL and sets
+ * errno on failure.
+ */
+static censored_words_list list_new(void) {
+    censored_words_list list = calloc(1, sizeof(struct censored_words_list_s));
+    if (list == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    list->words = censored_words;
+    if (words_path != NULL) {
+        list->words = words_read(words_path);
+        if (list->words == NULL) {
+            free(list);
+            return NULL;
         }
+        list->allocated = true;
+    }
+    while (list->words[list->num_words] != NULL) {
+        list->num_words++;
+    }
+    list->matcher = word_matcher_init(list->words);
+    if (list->matcher == NULL) {
+        int err = errno;
+        list_destroy(list);
+        errno = err;
+        return NULL;
+    }
+    list->version = ++last_version;
+    return list;
+}
+
+bool censored_words_load(const char *path, epoch reclaim) {
+    if (path != NULL && (words_path = strdup(path)) == NULL) {
+        errno = ENOMEM;
+        return false;
     }
-    return false;
+    cluster_cache =
+        calloc(CENSORED_WORDS_CACHE_SIZE, sizeof(struct cluster_words_s));
+    if (cluster_cache == NULL) {
+        free(words_path);
+        words_path = NULL;
+        errno = ENOMEM;
+        return false;
+    }
+    words_reclaim = reclaim;
+    current_words = list_new();
+    if (current_words == NULL) {
+        free(cluster_cache);
+        cluster_cache = NULL;
+        free(words_path);
+        words_path = NULL;
+        return false;
+    }
+    return true;
+}
+
+censored_words_list censored_words_reload(void) {
+    censored_words_list list = list_new();
+    if (list == NULL) {
+        return NULL;
+    }
+    censored_words_list old = current_words;
+    // Records of the old words may still be waiting to be logged
+    __atomic_store_n(&previous_words, old, __ATOMIC_RELEASE);
+    __atomic_store_n(&current_words, list, __ATOMIC_RELEASE);
+    unsigned long retired = epoch_current(words_reclaim);
+    while (!epoch_is_safe(words_reclaim, retired)) {
+        usleep(1000);
+    }
+    return old;
 }
 
-GSList *censored_words_found(const char *buf, size_t size) {
-    GSList *words_found = NULL;
-    for (unsigned int i = 0; censored_words[i] != NULL; i++) {
-        bool result = has_strcasestr(buf, censored_words[i], size);
-        if (result) {
-            words_found = g_slist_prepend(words_found, censored_words[i]);
+void censored_words_release(censored_words_list list) {
+    __atomic_store_n(&previous_words, NULL, __ATOMIC_RELEASE);
+    list_destroy(list);
+}
+
+void censored_words_free(void) {
+    if (current_words != NULL) {
+        list_destroy(current_words);
+        current_words = NULL;
+    }
+    if (previous_words != NULL) {
+        list_destroy(previous_words);
+        previous_words = NULL;
+    }
+    free(cluster_cache);
+    cluster_cache = NULL;
+    free(words_path);
+    words_path = NULL;
+}
+
+u32 censored_words_found(const char *buf, size_t size, u32 *version) {
+    censored_words_list list =
+        __atomic_load_n(&current_words, __ATOMIC_ACQUIRE);
+    assert(list != NULL);
+    *version = list->version;
+    return word_matcher_scan(list->matcher, buf, size);
+}
+
+u32 censored_words_found_stream(struct censored_words_stream_s *stream,
+                                const char *buf, size_t size) {
+    censored_words_list list =
+        __atomic_load_n(&current_words, __ATOMIC_ACQUIRE);
+    assert(list != NULL);
+    if (stream->version != list->version) {
+        // The state is of other automaton
+        stream->version = list->version;
+        stream->state = WORD_MATCHER_START;
+    }
+    return word_matcher_scan_stream(list->matcher, &stream->state, buf, size);
+}
+
+/* Sets @words to the words of @version remembered for @cluster with
+ * @generation. Returns false if they are not known.
+ */
+static bool cluster_cache_get(u32 cluster, u32 generation, u32 version,
+                              u32 *words) {
+    struct cluster_words_s *entry =
+        &cluster_cache[cluster & (CENSORED_WORDS_CACHE_SIZE - 1)];
+    u32 seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return false;
+    }
+    bool hit = __atomic_load_n(&entry->cluster, __ATOMIC_RELAXED) == cluster &&
+               __atomic_load_n(&entry->generation, __ATOMIC_RELAXED) ==
+                   generation &&
+               __atomic_load_n(&entry->version, __ATOMIC_RELAXED) == version;
+    u32 found = __atomic_load_n(&entry->words, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!hit || __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq) {
+        return false;
+    }
+    *words = found;
+    return true;
+}
+
+/* Remembers the @words of @version found in @cluster with @generation. It's
+ * skipped if other thread is changing the same place.
+ */
+static void cluster_cache_put(u32 cluster, u32 generation, u32 version,
+                              u32 words) {
+    struct cluster_words_s *entry =
+        &cluster_cache[cluster & (CENSORED_WORDS_CACHE_SIZE - 1)];
+    u32 seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) ||
+        !__atomic_compare_exchange_n(&entry->seq, &seq, seq + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __atomic_store_n(&entry->cluster, cluster, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->generation, generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->version, version, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->words, words, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Returns the words of @matcher in the bytes of @buf, of @size, that are
+ * closer than @overlap to @pos: the ones that straddle @pos.
+ */
+static u32 words_around(const word_matcher matcher, const char *buf,
+                        size_t size, size_t pos, size_t overlap) {
+    size_t from = pos - min(pos, overlap);
+    size_t to = min(size, pos + overlap);
+    return word_matcher_scan(matcher, buf + from, to - from);
+}
+
+u32 censored_words_found_clusters(struct censored_words_stream_s *stream,
+                                  const char *buf, size_t size,
+                                  const struct fat_cluster_read_s *reads,
+                                  size_t num_reads, size_t cluster_size) {
+    censored_words_list list =
+        __atomic_load_n(&current_words, __ATOMIC_ACQUIRE);
+    assert(list != NULL);
+    if (num_reads == 0 || size == 0) {
+        return censored_words_found_stream(stream, buf, size);
+    }
+    if (stream->version != list->version) {
+        stream->version = list->version;
+        stream->state = WORD_MATCHER_START;
+    }
+    word_matcher matcher = list->matcher;
+    size_t max_len = word_matcher_max_len(matcher);
+    // A word that straddles a position is in the bytes this close to it
+    size_t overlap = max_len > 0 ? max_len - 1 : 0;
+    u32 words = 0;
+
+    if (stream->state != WORD_MATCHER_START) {
+        // Words that started in the previous request end in these bytes
+        word_matcher_state state = stream->state;
+        words |= word_matcher_scan_stream(matcher, &state, buf,
+                                          min(size, overlap));
+    }
+    size_t pos = 0; // Scanned up to here, but the words across it
+    for (size_t i = 0; i < num_reads; i++) {
+        const struct fat_cluster_read_s *read = &reads[i];
+        if (read->start > pos) {
+            words |= word_matcher_scan(matcher, buf + pos, read->start - pos);
+        }
+        if (read->start > 0) {
+            words |= words_around(matcher, buf, size, read->start, overlap);
+        }
+        u32 cluster_words;
+        if (!cluster_cache_get(read->cluster, read->generation, list->version,
+                               &cluster_words)) {
+            cluster_words =
+                word_matcher_scan(matcher, buf + read->start, cluster_size);
+            cluster_cache_put(read->cluster, read->generation, list->version,
+                              cluster_words);
+        }
+        words |= cluster_words;
+        pos = read->start + cluster_size;
+        if (pos < size &&
+            (i + 1 == num_reads || reads[i + 1].start != pos)) {
+            words |= words_around(matcher, buf, size, pos, overlap);
         }
     }
-    return words_found;
+    if (pos < size) {
+        words |= word_matcher_scan(matcher, buf + pos, size - pos);
+    }
+    // Where the next request goes on only depends on the last bytes
+    size_t tail = min(size, overlap);
+    stream->state = WORD_MATCHER_START;
+    word_matcher_scan_stream(matcher, &stream->state, buf + size - tail, tail);
+    return words;
+}
+
+const char *censored_word(u32 version, unsigned int index) {
+    censored_words_list list =
+        __atomic_load_n(&current_words, __ATOMIC_ACQUIRE);
+    if (list == NULL || list->version != version) {
+        list = __atomic_load_n(&previous_words, __ATOMIC_ACQUIRE);
+    }
+    if (list == NULL || list->version != version ||
+        index >= list->num_words) {
+        return NULL;
+    }
+    return list->words[index];
 }
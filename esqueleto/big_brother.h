@@ -1,23 +1,117 @@
 #ifndef _BIG_BROTHER_H
 #define _BIG_BROTHER_H
 
+#include "epoch.h"
 #include "fat_filename_util.h"
+#include "fat_table.h"
+#include "word_matcher.h"
 #include <gmodule.h>
 
 #define LOG_FILEPATH PATH_SEPARATOR LOG_FILE
 #define LOG_FILE LOG_FILE_BASENAME "." LOG_FILE_EXTENSION
 #define LOG_FILE_BASENAME "fs"
 #define LOG_FILE_EXTENSION "log"
+// Index of each log file, fs.idx for fs.log (see fat_log_format.h)
+#define LOG_INDEX_EXTENSION "idx"
 
+// Number of log files, when the log is rotated. The newest is fs.log, and
+// the older ones fs1.log, fs2.log... up to LOG_GENERATIONS - 1.
+#define LOG_GENERATIONS 4
+// Size of the buffers for the paths of the log files
+#define LOG_FILEPATH_LEN 16
+
+// Words to look for when there is no list of them, ended by NULL
 extern char *censored_words[];
+#define CENSORED_WORDS_MAX WORD_MATCHER_MAX_WORDS
+// Longest word in a list
+#define CENSORED_WORD_MAX_LEN 64
+
+// Clusters whose censored words are remembered (see
+// censored_words_found_clusters), a power of 2. Each cluster has one place.
+#define CENSORED_WORDS_CACHE_SIZE (1 << 16)
+
+/* The censored words in use can be replaced while files are read and written.
+ * Each list of them has a version, and the masks of words found are of the
+ * list of a given version (see censored_word).
+ */
+typedef struct censored_words_list_s *censored_words_list;
+
+/* Scan of a stream of bytes, see censored_words_found_stream */
+struct censored_words_stream_s {
+    u32 version; // Of the words of state, 0 before the first scan
+    word_matcher_state state;
+};
+
+/* Compiles the censored words for censored_words_found: the ones in the file
+ * @path, one per line, or censored_words if @path is NULL. Scans must be
+ * done in read sections of @reclaim, since the words can be replaced (see
+ * censored_words_reload).
+ * Returns false and sets errno if the file can't be read, or it has too many
+ * words (E2BIG) or too long ones (ENAMETOOLONG).
+ */
+bool censored_words_load(const char *path, epoch reclaim);
+
+/* Reads again the file of censored_words_load, and uses its words from now
+ * on. Scans in progress finish with the old ones, this waits for them.
+ * Returns the old list, to be freed with censored_words_release once nothing
+ * uses its version. On failure returns NULL, sets errno and keeps the old
+ * words.
+ */
+censored_words_list censored_words_reload(void);
 
-/* Returns a list with the censored words found in @buf
- * The returned list is owned by the caller but not the references.
+/* Frees @list, that was replaced by censored_words_reload */
+void censored_words_release(censored_words_list list);
+
+/* Frees what censored_words_load allocated */
+void censored_words_free(void);
+
+/* Returns the censored words found in @buf, as a mask with the bit i set if
+ * word i was found, and sets @version to the version of the words.
+ * PRE: censored_words_load() was called
  */
-GSList *censored_words_found(const char *buf, size_t size);
+u32 censored_words_found(const char *buf, size_t size, u32 *version);
+
+/* Like censored_words_found, for the next @size bytes of a stream whose scan
+ * is in @stream (see word_matcher_scan_stream). The version of the words is
+ * left in @stream. If they were replaced since its last scan, the stream
+ * starts again.
+ */
+u32 censored_words_found_stream(struct censored_words_stream_s *stream,
+                                const char *buf, size_t size);
+
+/* Like censored_words_found_stream, for @size bytes of @buf that have the
+ * @num_reads whole clusters of @cluster_size bytes in @reads, read in order.
+ * The words found in each cluster are remembered with its generation and the
+ * version of the words, so reading it again unchanged only needs the bytes
+ * around its ends, where words that straddle two clusters are.
+ */
+u32 censored_words_found_clusters(struct censored_words_stream_s *stream,
+                                  const char *buf, size_t size,
+                                  const struct fat_cluster_read_s *reads,
+                                  size_t num_reads, size_t cluster_size);
+
+/* Returns the word @index of the list of @version, or NULL if it has no such
+ * word. Lists are only kept until censored_words_release.
+ */
+const char *censored_word(u32 version, unsigned int index);
 
 int is_log_file_dentry(unsigned char *base_name, unsigned char *extension);
 
 int is_log_filepath(char *filepath);
 
+/* Writes in @buf the path of the log file of @generation, 0 for fs.log, with
+ * @extension (LOG_FILE_EXTENSION or LOG_INDEX_EXTENSION).
+ */
+char *log_filepath(unsigned int generation, const char *extension, char *buf);
+
+/* Returns true if @name is the name of fs.log or of one of its older
+ * generations, or of their indexes.
+ */
+bool is_log_filename(const char *name);
+
+/* Returns true if @base_name and @extension are the name of a log file hidden
+ * in its directory entry (see fat_file_hide).
+ */
+bool is_hidden_log_dentry(const u8 *base_name, const u8 *extension);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,168 @@
+/*
+ * epoch.c
+ *
+ * Epoch based reclamation of memory that lock-free readers may still be
+ * using.
+ *
+ * Every thread that reads has a record in the domain, with the epoch it saw
+ * when it entered. The global epoch only advances when all the active
+ * records have seen the current one, so after advancing twice from the epoch
+ * an object was retired on, no reader can still hold a reference to it.
+ */
+
+#include "epoch.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+// The lowest bit of a record state is set while its thread is reading, the
+// rest is the epoch it entered on.
+#define EPOCH_ACTIVE 1UL
+
+struct epoch_record_s {
+    unsigned long state;
+    // Nesting level of epoch_enter, only used by the owner thread
+    unsigned int depth;
+    // True while a thread owns this record
+    bool in_use;
+    struct epoch_record_s *next;
+};
+
+struct epoch_s {
+    unsigned long global_epoch;
+    // Records are never removed, so they can be walked without locks. The
+    // ones of the threads that exited are reused.
+    struct epoch_record_s *records;
+    // Record of each thread in this domain, released when the thread exits
+    pthread_key_t record_key;
+};
+
+/* Called when a thread exits, so other threads can reuse its record. */
+static void release_record(void *record) {
+    struct epoch_record_s *rec = record;
+    __atomic_store_n(&rec->in_use, false, __ATOMIC_RELEASE);
+}
+
+epoch epoch_init(void) {
+    epoch e = calloc(1, sizeof(struct epoch_s));
+    if (e == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    e->global_epoch = 0;
+    e->records = NULL;
+    errno = pthread_key_create(&e->record_key, release_record);
+    if (errno != 0) {
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+void epoch_destroy(epoch e) {
+    if (e == NULL) {
+        return;
+    }
+    // The records are freed here, not when their threads exit
+    pthread_key_delete(e->record_key);
+    struct epoch_record_s *rec = e->records, *next = NULL;
+    while (rec != NULL) {
+        next = rec->next;
+        free(rec);
+        rec = next;
+    }
+    free(e);
+}
+
+/* Returns a record of @e for the calling thread, reusing a released one if
+ * possible. Returns NULL if there is no memory.
+ */
+static struct epoch_record_s *acquire_record(epoch e) {
+    struct epoch_record_s *rec = NULL;
+    for (rec = __atomic_load_n(&e->records, __ATOMIC_ACQUIRE); rec != NULL;
+         rec = rec->next) {
+        bool free_record = false;
+        if (__atomic_compare_exchange_n(&rec->in_use, &free_record, true,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            return rec;
+        }
+    }
+    rec = calloc(1, sizeof(struct epoch_record_s));
+    if (rec == NULL) {
+        return NULL;
+    }
+    rec->in_use = true;
+    rec->next = __atomic_load_n(&e->records, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&e->records, &rec->next, rec, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    return rec;
+}
+
+/* Returns the record of the calling thread in @e. */
+static struct epoch_record_s *get_record(epoch e) {
+    struct epoch_record_s *rec = pthread_getspecific(e->record_key);
+    if (rec != NULL) {
+        return rec;
+    }
+    rec = acquire_record(e);
+    if (rec != NULL && pthread_setspecific(e->record_key, rec) != 0) {
+        release_record(rec);
+        rec = NULL;
+    }
+    return rec;
+}
+
+void epoch_enter(epoch e) {
+    struct epoch_record_s *rec = get_record(e);
+    if (rec == NULL) {
+        abort(); // Readers can't run unprotected
+    }
+    if (rec->depth++ > 0) {
+        return;
+    }
+    unsigned long global = __atomic_load_n(&e->global_epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->state, (global << 1) | EPOCH_ACTIVE,
+                     __ATOMIC_RELAXED);
+    // The state must be visible before reading anything of the structure
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(epoch e) {
+    struct epoch_record_s *rec = pthread_getspecific(e->record_key);
+    assert(rec != NULL && rec->depth > 0); // Not inside a section of @e
+    if (--rec->depth > 0) {
+        return;
+    }
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+unsigned long epoch_current(const epoch e) {
+    return __atomic_load_n(&e->global_epoch, __ATOMIC_ACQUIRE);
+}
+
+/* Advances the global epoch of @e if every active reader has seen it. */
+static void try_advance(epoch e) {
+    unsigned long global = __atomic_load_n(&e->global_epoch, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (struct epoch_record_s *rec =
+             __atomic_load_n(&e->records, __ATOMIC_ACQUIRE);
+         rec != NULL; rec = rec->next) {
+        unsigned long state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+        if ((state & EPOCH_ACTIVE) && (state >> 1) != global) {
+            return; // Still reading on an older epoch
+        }
+    }
+    __atomic_compare_exchange_n(&e->global_epoch, &global, global + 1, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+bool epoch_is_safe(epoch e, unsigned long retired) {
+    if (epoch_current(e) >= retired + 2) {
+        return true;
+    }
+    try_advance(e);
+    return epoch_current(e) >= retired + 2;
+}
@@ -0,0 +1,49 @@
+/*
+ * epoch.h
+ *
+ * Epoch based reclamation of memory that lock-free readers may still be
+ * using.
+ *
+ * Readers wrap their accesses to a shared structure between epoch_enter and
+ * epoch_exit. Writers that remove an object from the structure tag it with
+ * the current epoch instead of freeing it, and it's only reused when
+ * epoch_is_safe says so: every reader that could have seen it has exited.
+ */
+
+#ifndef _EPOCH_H
+#define _EPOCH_H
+
+#include <stdbool.h>
+
+typedef struct epoch_s *epoch;
+
+/* Initializes a new epoch domain.
+ * Returns NULL and sets errno to ENOMEM if there is no memory, or to EAGAIN
+ * if there are no more thread keys for the records of the domain.
+ */
+epoch epoch_init(void);
+
+/* Frees @e. No thread can be inside a read section of @e. */
+void epoch_destroy(epoch e);
+
+/* Starts a read section of the calling thread in @e. Sections can be nested,
+ * also with the ones of other domains.
+ * Objects reached inside the section are not reused until it ends.
+ * Aborts if there is no memory for the record of the thread.
+ */
+void epoch_enter(epoch e);
+
+/* Ends the read section of the calling thread started by the last
+ * epoch_enter on @e.
+ */
+void epoch_exit(epoch e);
+
+/* Returns the epoch to tag an object that has just been removed. */
+unsigned long epoch_current(const epoch e);
+
+/* Returns true iff no reader can still be using an object tagged with
+ * @retired. Tries to advance the epoch of @e if it's not the case yet.
+ */
+bool epoch_is_safe(epoch e, unsigned long retired);
+
+#endif /* _EPOCH_H */
@@ -89,121 +89,110 @@ static u32 file_start_cluster(fat_dir_entry disk_dentry) {
 
 /********************* INITIALIZERS *********************/
 
-/* Returns an new directory entry with default values.
+/* Fills @entry with default values.
  * Values to fill depending on fat_file: start_cluster
  */
-fat_dir_entry fat_file_init_direntry(bool is_dir, const char *filepath,
-                                     u32 start_cluster) {
-    fat_dir_entry new_entry = calloc(1, sizeof(struct fat_dir_entry_s));
-    if (new_entry == NULL) {
-        errno = ENOSPC;
-        return NULL;
-    }
+void fat_file_init_direntry(fat_dir_entry entry, bool is_dir,
+                            const char *filepath, u32 start_cluster) {
+    memset(entry, 0, sizeof(struct fat_dir_entry_s));
     char *filepath_copy = strdup(filepath);
     // Calculate filename and extension. Save into disk entry structure
-    filename_from_path(basename(filepath_copy), new_entry->base_name,
-                       new_entry->extension);
+    filename_from_path(basename(filepath_copy), entry->base_name,
+                       entry->extension);
     free(filepath_copy);
     filepath_copy = NULL;
     if (is_dir) {
-        new_entry->attribs = FILE_ATTRIBUTE_DIRECTORY;
+        entry->attribs = FILE_ATTRIBUTE_DIRECTORY;
     } else {
-        new_entry->attribs = FILE_ATTRIBUTE_ARCHIVE;
+        entry->attribs = FILE_ATTRIBUTE_ARCHIVE;
     }
-    new_entry->reserved = 0;
-    new_entry->create_time_fine_res = 0;
-    fill_dentry_time_now(new_entry, true, true); // ignore error
-    set_first_cluster(new_entry, start_cluster);
-    new_entry->file_size = 0;
-    return new_entry;
+    entry->reserved = 0;
+    entry->create_time_fine_res = 0;
+    fill_dentry_time_now(entry, true, true); // ignore error
+    set_first_cluster(entry, start_cluster);
+    entry->file_size = 0;
 }
 
-/* Returns an new directory entry with default values.
- * Values to fill depending on fat_file: start_cluster, pos_in_dir
- */
-static fat_dir_entry init_direntry_from_buff(fat_dir_entry buff) {
-    fat_dir_entry new_entry = calloc(1, sizeof(struct fat_dir_entry_s));
-    if (new_entry == NULL) {
-        errno = ENOSPC;
-        return NULL;
-    }
-    memcpy(new_entry, buff, sizeof(struct fat_dir_entry_s));
-
-    return new_entry;
+/* Returns a generation that no directory has had before. */
+static u32 new_generation(void) {
+    static u32 last_generation = 0;
+    return __atomic_add_fetch(&last_generation, 1, __ATOMIC_RELAXED);
 }
 
-/* Creates a fat_file from the information contained in @dentry.
+/* Creates a fat_file from the information contained in @dentry, that is
+ * copied into the new file.
  * @parent can't be None, since root directory does not have a dentry.*/
-static fat_file init_file_from_dentry(fat_dir_entry dentry, fat_file parent) {
+static fat_file init_file_from_dentry(const fat_dir_entry dentry,
+                                      fat_file parent) {
     fat_file new_file = NULL;
     bool is_dir = (dentry->attribs & FILE_ATTRIBUTE_DIRECTORY) != 0;
 
-    new_file = calloc(1, sizeof(struct fat_file_s));
+    new_file = slab_alloc(parent->table->file_slab);
     if (new_file == NULL) {
         errno = ENOSPC;
         return NULL;
     }
+    memcpy(&new_file->dentry, dentry, sizeof(struct fat_dir_entry_s));
     new_file->start_cluster = file_start_cluster(dentry);
-    new_file->dentry = dentry;
     new_file->table = parent->table;
+    new_file->parent = parent;
     build_filename(dentry->base_name, dentry->extension,
                    (char *)&(new_file->name));
-    new_file->filepath = filepath_from_name(parent->filepath, new_file->name);
     if (is_dir) {
         new_file->dir.nentries = 0;
+        new_file->dir.generation = new_generation();
     } else {
         new_file->file.num_clusters = 0;
     }
     new_file->pos_in_parent = parent->dir.nentries;
     new_file->num_times_opened = 0;
+    new_file->nlookup = 0;
     new_file->children_read = 0;
     return new_file;
 }
 
-fat_file fat_file_init_empty(bool is_dir, char *filepath) {
+fat_file fat_file_init_empty(fat_table table, bool is_dir) {
     fat_file new_file = NULL;
-    new_file = calloc(1, sizeof(struct fat_file_s));
+    new_file = slab_alloc(table->file_slab);
     if (new_file == NULL) {
         errno = ENOSPC;
         return NULL;
     }
-    new_file->filepath = filepath;
+    new_file->parent = NULL;
+    new_file->table = table;
     if (is_dir) {
         new_file->dir.nentries = 0;
+        new_file->dir.generation = new_generation();
     } else {
         new_file->file.num_clusters = 0;
     }
     new_file->pos_in_parent = 0;
     new_file->num_times_opened = 0;
+    new_file->nlookup = 0;
     new_file->children_read = 0;
-    new_file->dentry = NULL;
     return new_file;
 }
 
-fat_file fat_file_init(fat_table table, bool is_dir, char *filepath) {
-    fat_file new_file = fat_file_init_empty(is_dir, filepath);
-    fat_dir_entry new_entry = NULL;
-    if (errno < 0) {
-        free(new_file);
-        free(new_entry);
+fat_file fat_file_init(fat_table table, fat_file parent, bool is_dir,
+                       const char *filepath) {
+    fat_file new_file = fat_file_init_empty(table, is_dir);
+    if (new_file == NULL) {
         return NULL;
     }
-    new_file->table = table;
+    new_file->parent = parent;
 
-    u32 start_cluster = fat_table_get_next_free_cluster(table);
-    if (fat_table_is_cluster_used(table, start_cluster)) {
-        DEBUG("Assigned cluster in use!");
+    u32 start_cluster = fat_table_alloc_cluster(table);
+    if (fat_table_is_EOC(table, start_cluster)) {
+        DEBUG("No free cluster for the new file");
         errno = ENOSPC;
         fat_file_destroy(new_file);
         return NULL;
     }
-    new_file->dentry = fat_file_init_direntry(is_dir, filepath, start_cluster);
+    fat_file_init_direntry(&new_file->dentry, is_dir, filepath, start_cluster);
 
-    build_filename(new_file->dentry->base_name, new_file->dentry->extension,
+    build_filename(new_file->dentry.base_name, new_file->dentry.extension,
                    (char *)&(new_file->name));
-    new_file->start_cluster = file_start_cluster(new_file->dentry);
-
-    fat_table_set_next_cluster(table, start_cluster, FAT_CLUSTER_END_OF_CHAIN);
+    new_file->start_cluster = file_start_cluster(&new_file->dentry);
     if (errno != 0) {
         fat_file_destroy(new_file);
         return NULL;
@@ -211,64 +200,183 @@ fat_file fat_file_init(fat_table table, bool is_dir, char *filepath) {
     return new_file;
 }
 
-/* Frees memory allocated for the fat_file_s structure. */
-void fat_file_destroy(fat_file file) {
-    free(file->filepath);
-    free(file->dentry);
-    free(file);
+/* Returns the fat_file_s structure to the slab it was allocated from. */
+void fat_file_destroy(fat_file file) { slab_free(file); }
+
+/* Returns true if @file is the root directory or one of it's children, whose
+ * paths are just a separator followed by their name. */
+static inline bool in_root(const fat_file file) {
+    return file->parent == NULL || file->parent->parent == NULL;
+}
+
+/* Writes the path of @file starting at @buf, without going over @buf_end.
+ * Returns a pointer to the end of the written path. */
+static char *write_path(const fat_file file, char *buf, const char *buf_end) {
+    if (!in_root(file)) {
+        buf = write_path(file->parent, buf, buf_end);
+    }
+    // The root path itself, or the separator between the parent and the name
+    if (buf < buf_end) {
+        *buf++ = PATH_SEPARATOR[0];
+    }
+    if (file->parent == NULL) {
+        return buf;
+    }
+    for (const char *c = file->name; *c != '\0' && buf < buf_end; c++) {
+        *buf++ = *c;
+    }
+    return buf;
+}
+
+char *fat_file_path(const fat_file file, char *buf) {
+    char *end = write_path(file, buf, buf + MAX_PATH_LEN - 1);
+    *end = '\0';
+    return buf;
+}
+
+/* Compares the path of @file with the start of the string in @key, like strcmp
+ * would do, and moves @key after the part of the string that matched.
+ * Returns 0 if the whole path of @file is a prefix of @key.
+ */
+static int cmp_path_prefix(const fat_file file, const char **key) {
+    int cmp = 0;
+    if (!in_root(file)) {
+        cmp = cmp_path_prefix(file->parent, key);
+        if (cmp != 0) {
+            return cmp;
+        }
+    }
+    // The root path itself, or the separator between the parent and the name
+    cmp = (unsigned char)PATH_SEPARATOR[0] - (unsigned char)**key;
+    if (cmp != 0) {
+        return cmp;
+    }
+    (*key)++;
+    if (file->parent == NULL) {
+        return 0;
+    }
+    for (const char *c = file->name; *c != '\0'; c++) {
+        cmp = (unsigned char)*c - (unsigned char)**key;
+        if (cmp != 0) {
+            return cmp;
+        }
+        (*key)++;
+    }
+    return 0;
+}
+
+/* Returns the number of directories above @file, 0 for the root directory */
+static unsigned int file_depth(const fat_file file) {
+    unsigned int depth = 0;
+    for (fat_file dir = file->parent; dir != NULL; dir = dir->parent) {
+        depth++;
+    }
+    return depth;
+}
+
+/* Returns the byte of the path of @file that follows the name of its
+ * ancestor @dir, at @c: the next one of the name, or the separator before the
+ * name of the child of @dir, or the end of the path.
+ */
+static unsigned char path_byte(const fat_file file, const fat_file dir,
+                               const char *c) {
+    if (*c != '\0') {
+        return *c;
+    }
+    return file != dir ? PATH_SEPARATOR[0] : '\0';
 }
 
 int fat_file_cmp(fat_file file1, fat_file file2) {
-    return strcmp(file1->filepath, file2->filepath);
+    unsigned int depth1 = file_depth(file1), depth2 = file_depth(file2);
+    fat_file dir1 = file1, dir2 = file2;
+    // Ancestors at the same depth
+    for (; depth1 > depth2; depth1--) {
+        dir1 = dir1->parent;
+    }
+    for (; depth2 > depth1; depth2--) {
+        dir2 = dir2->parent;
+    }
+    if (dir1 == dir2) {
+        // One path is the start of the other, or they are the same
+        return file1 == dir1 ? (file2 == dir2 ? 0 : -1) : 1;
+    }
+    // The paths differ first in the names of two children of a directory
+    while (dir1->parent != dir2->parent) {
+        dir1 = dir1->parent;
+        dir2 = dir2->parent;
+    }
+    const char *c1 = dir1->name, *c2 = dir2->name;
+    while (*c1 != '\0' && *c1 == *c2) {
+        c1++;
+        c2++;
+    }
+    return path_byte(file1, dir1, c1) - path_byte(file2, dir2, c2);
 }
 
 int fat_file_cmp_path(fat_file file1, char *filepath) {
-    return strcmp(file1->filepath, filepath);
+    const char *key = filepath;
+    int cmp = cmp_path_prefix(file1, &key);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return -(unsigned char)*key; // Equal only if the key ended too
 }
 
 /********************* FILE METADATA *********************/
 
 inline bool fat_file_is_directory(const fat_file file) {
-    if (file->dentry == NULL) {
-        return true; // root file
+    return (file->dentry.attribs & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+u64 fat_file_inode(const fat_file file) {
+    if (file->parent == NULL) {
+        return FAT_ROOT_INODE;
     }
-    return (file->dentry->attribs & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    // Start clusters are 32 bits, the shifted one is never 0 or 1
+    return ((u64)file->parent->start_cluster + 1) << 32 | file->pos_in_parent;
+}
+
+void fat_file_dir_changed(fat_file dir) {
+    __atomic_store_n(&dir->dir.generation, new_generation(), __ATOMIC_RELEASE);
 }
 
 void fat_file_inc_num_times_opened(fat_file file) {
     if (file != NULL) {
-        file->num_times_opened++;
+        __atomic_add_fetch(&file->num_times_opened, 1, __ATOMIC_SEQ_CST);
     }
 }
 
 void fat_file_dec_num_times_opened(fat_file file) {
     if (file != NULL) {
-        file->num_times_opened--;
+        __atomic_sub_fetch(&file->num_times_opened, 1, __ATOMIC_SEQ_CST);
     }
 }
 
 void fat_file_to_stbuf(fat_file file, struct stat *stbuf) {
     memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_ino = fat_file_inode(file);
     stbuf->st_nlink = 1;
     if (fat_file_is_directory(file)) {
         stbuf->st_mode |= S_IFDIR;
     } else {
         stbuf->st_mode |= S_IFREG;
     }
-    if (file->dentry->attribs & FILE_ATTRIBUTE_READONLY) {
+    if (file->dentry.attribs & FILE_ATTRIBUTE_READONLY) {
         stbuf->st_mode |= 0555;
     } else {
         stbuf->st_mode |= 0777;
     }
-    stbuf->st_size = file->dentry->file_size;
-    stbuf->st_blocks =
-        fat_table_get_clusters_for_size(file->table, stbuf->st_size);
+    stbuf->st_size = file->dentry.file_size;
     stbuf->st_blksize = fat_table_bytes_per_cluster(file->table);
-    stbuf->st_ctime = time_to_unix_time(file->dentry->create_date, // 0);
-                                        file->dentry->create_time);
-    stbuf->st_atime = time_to_unix_time(file->dentry->last_access_date, 0);
-    stbuf->st_mtime = time_to_unix_time(file->dentry->last_modified_date, // 0);
-                                        file->dentry->last_modified_time);
+    // Blocks of 512 bytes, whatever the size of the clusters
+    stbuf->st_blocks =
+        (blkcnt_t)fat_table_get_clusters_for_size(file->table, stbuf->st_size) *
+        stbuf->st_blksize / 512;
+    stbuf->st_ctime = time_to_unix_time(file->dentry.create_date, // 0);
+                                        file->dentry.create_time);
+    stbuf->st_atime = time_to_unix_time(file->dentry.last_access_date, 0);
+    stbuf->st_mtime = time_to_unix_time(file->dentry.last_modified_date, // 0);
+                                        file->dentry.last_modified_time);
 }
 
 /********************* DIRECTORY ENTRY METADATA *********************/
@@ -311,22 +419,22 @@ void fat_utime(fat_file file, fat_file parent, const struct utimbuf *buf) {
     // All in little endians!
     fill_time(&accdate, &acctime, buf->actime);
     fill_time(&moddate, &modtime, buf->modtime);
-    file->dentry->last_access_date = accdate;
-    file->dentry->last_modified_date = moddate;
-    file->dentry->last_modified_time = modtime;
-    write_dir_entry(parent, file->dentry, file->pos_in_parent);
+    file->dentry.last_access_date = accdate;
+    file->dentry.last_modified_date = moddate;
+    file->dentry.last_modified_time = modtime;
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
 }
 
 /********************* DIRECTORY FUNCTIONS *********************/
 
 void fat_file_dentry_add_child(fat_file parent, fat_file child) {
     u32 nentries = parent->dir.nentries;
-    write_dir_entry(parent, child->dentry, nentries);
+    write_dir_entry(parent, &child->dentry, nentries);
     if (errno != 0) {
         return;
     }
     DEBUG("Adding child \"%s\" to \"%s\" in position %u", child->name,
-          parent->filepath, parent->dir.nentries);
+          parent->name, parent->dir.nentries);
     child->pos_in_parent = nentries;
     parent->dir.nentries++;
 }
@@ -340,12 +448,9 @@ static bool is_end_of_directory(const fat_dir_entry disk_dentry) {
 /* Returns %true iff the filesystem driver should ignore the given directory
  * entry due to having invalid attributes or an invalid name. */
 static bool ignore_dentry(const fat_dir_entry disk_dentry) {
-    // check if disk_dentry is fs.log's dentry
-    char log_name[] = LOG_FILE_BASENAME;
-    log_name[0] = (char)FAT_FILENAME_DELETED_CHAR;
+    // check if disk_dentry is the dentry of fs.log or an older generation
     bool is_log =
-        strncmp((char *)disk_dentry->base_name, log_name, 8) == 0 &&
-        strncmp((char *)disk_dentry->extension, LOG_FILE_EXTENSION, 3) == 0;
+        is_hidden_log_dentry(disk_dentry->base_name, disk_dentry->extension);
 
     // Note: VFAT entries have FILE_ATTRIBUTE_VOLUME set, so they will be
     // correctly ignored by this long-name unaware code.
@@ -357,28 +462,28 @@ static bool ignore_dentry(const fat_dir_entry disk_dentry) {
 
 /* Fills @elems with the fat_dir_entry that's read form @buffer, and
  * updates @dir to mark the children have been read. @end_ptr is used
- * to mark the end of the @buffer.
+ * to mark the end of the @buffer. Entries are numbered from @dir's nentries,
+ * so the positions keep counting across the clusters of the directory.
+ * Returns true iff the end of the directory was found in @buffer.
  * @dir can't be NULL, since root directory does not have a dentry.
  */
-static void read_cluster_dir_entries(u8 *buffer, fat_dir_entry end_ptr,
+static bool read_cluster_dir_entries(u8 *buffer, fat_dir_entry end_ptr,
                                      fat_file dir, GList **elems) {
     fat_dir_entry disk_dentry_ptr = NULL;
-    u32 dir_entries_processed = 0;
     for (disk_dentry_ptr = (fat_dir_entry)buffer; disk_dentry_ptr <= end_ptr;
-         disk_dentry_ptr++, dir_entries_processed++) {
-        dir->dir.nentries = dir_entries_processed;
+         disk_dentry_ptr++, dir->dir.nentries++) {
         if (is_end_of_directory(disk_dentry_ptr)) {
             dir->children_read = 1;
-            break;
+            return true;
         }
         if (ignore_dentry(disk_dentry_ptr)) {
             continue;
         }
         // Create and fill new child structure
-        fat_dir_entry new_entry = init_direntry_from_buff(disk_dentry_ptr);
-        fat_file child = init_file_from_dentry(new_entry, dir);
+        fat_file child = init_file_from_dentry(disk_dentry_ptr, dir);
         (*elems) = g_list_append((*elems), child);
     }
+    return false;
 }
 
 GList *fat_file_read_children(fat_file dir) {
@@ -387,7 +492,7 @@ GList *fat_file_read_children(fat_file dir) {
     u8 *buf = NULL;
     GList *entry_list = NULL;
 
-    DEBUG("Reading children of \"%s\"", dir->filepath);
+    DEBUG("Reading children of \"%s\"", dir->name);
     bytes_per_cluster = fat_table_bytes_per_cluster(dir->table);
     cur_cluster = dir->start_cluster;
     if (!fat_table_is_valid_cluster_number(dir->table, cur_cluster)) {
@@ -396,6 +501,7 @@ GList *fat_file_read_children(fat_file dir) {
         return NULL;
     }
     cur_offset = fat_table_cluster_offset(dir->table, cur_cluster);
+    dir->dir.nentries = 0;
 
     buf = alloca(bytes_per_cluster);
     while (!fat_table_is_EOC(dir->table, cur_cluster)) {
@@ -406,7 +512,9 @@ GList *fat_file_read_children(fat_file dir) {
             errno = EIO;
             return NULL;
         }
-        read_cluster_dir_entries(buf, end_ptr, dir, &entry_list);
+        if (read_cluster_dir_entries(buf, end_ptr, dir, &entry_list)) {
+            break;
+        }
         cur_cluster = fat_table_get_next_cluster(dir->table, cur_cluster);
         cur_offset = fat_table_cluster_offset(dir->table, cur_cluster);
     }
@@ -414,15 +522,136 @@ GList *fat_file_read_children(fat_file dir) {
     return entry_list;
 }
 
+void fat_file_extend(fat_file file, off_t size, fat_file parent) {
+    fat_table table = file->table;
+    off_t offset = file->dentry.file_size;
+    if (offset >= size) {
+        return;
+    }
+    size_t bytes_per_cluster = fat_table_bytes_per_cluster(table);
+    u8 *zeros = calloc(1, bytes_per_cluster);
+    if (zeros == NULL) {
+        errno = ENOMEM;
+        return;
+    }
+    // All the clusters at once, in runs of consecutive ones
+    errno = 0;
+    fat_file_reserve(file, size, fat_table_home_group(table));
+    // The cluster with the last byte of the file, the zeros start after it
+    u32 cluster = fat_table_seek_cluster(table, file->start_cluster,
+                                         offset > 0 ? offset - 1 : 0);
+    while (offset < size && !fat_table_is_EOC(table, cluster)) {
+        if (offset > 0 && fat_table_mask_offset(offset, table) == 0) {
+            cluster = fat_table_get_next_cluster(table, cluster);
+            if (fat_table_is_EOC(table, cluster)) {
+                break; // fat_file_reserve set errno
+            }
+        }
+        size_t count =
+            fat_table_get_cluster_remaining_bytes(table, size - offset, offset);
+        off_t cluster_off = fat_table_cluster_offset(table, cluster) +
+                            fat_table_mask_offset(offset, table);
+        size_t written = full_pwrite(table->fd, zeros, count, cluster_off);
+        fat_table_cluster_written(table, cluster);
+        offset += written;
+        if (written != count) {
+            break; // errno was set
+        }
+    }
+    free(zeros);
+
+    file->dentry.file_size = offset;
+    fill_dentry_time_now(&file->dentry, false, true);
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
+}
+
+void fat_file_reserve(fat_file file, off_t size, u32 group) {
+    fat_table table = file->table;
+    u32 last_cluster = file->start_cluster, num_clusters = 1;
+    u32 next_cluster = fat_table_get_next_cluster(table, last_cluster);
+    while (!fat_table_is_EOC(table, next_cluster)) {
+        last_cluster = next_cluster;
+        num_clusters++;
+        next_cluster = fat_table_get_next_cluster(table, last_cluster);
+    }
+
+    u32 needed_clusters = fat_table_get_clusters_for_size(table, size);
+    while (num_clusters < needed_clusters) {
+        u32 count = min(needed_clusters - num_clusters,
+                        (u32)FAT_TABLE_GROUP_CLUSTERS);
+        u32 first = fat_table_alloc_run(table, last_cluster + 1, count, group);
+        if (fat_table_is_EOC(table, first)) {
+            if (errno != ENOSPC) {
+                return;
+            }
+            break;
+        }
+        errno = 0;
+        fat_table_set_next_cluster(table, last_cluster, first);
+        if (errno != 0) {
+            return;
+        }
+        last_cluster = first + count - 1;
+        num_clusters += count;
+    }
+    // The free space is fragmented, the rest is taken a cluster at a time
+    // instead of searching the whole volume again for smaller runs
+    while (num_clusters < needed_clusters) {
+        errno = 0;
+        last_cluster = fat_table_add_new_cluster_to_chain(table, last_cluster);
+        if (fat_table_is_EOC(table, last_cluster)) {
+            if (errno == 0) {
+                errno = ENOSPC;
+            }
+            return;
+        }
+        num_clusters++;
+    }
+}
+
+void fat_file_swap_data(fat_file file1, fat_file file2, fat_file parent) {
+    u32 start_cluster = file1->start_cluster;
+    u32 file_size = file1->dentry.file_size;
+
+    file1->start_cluster = file2->start_cluster;
+    set_first_cluster(&file1->dentry, file2->start_cluster);
+    file1->dentry.file_size = file2->dentry.file_size;
+    file2->start_cluster = start_cluster;
+    set_first_cluster(&file2->dentry, start_cluster);
+    file2->dentry.file_size = file_size;
+
+    write_dir_entry(parent, &file1->dentry, file1->pos_in_parent);
+    write_dir_entry(parent, &file2->dentry, file2->pos_in_parent);
+}
+
+void fat_file_empty(fat_file file, fat_file parent) {
+    file->dentry.file_size = 0;
+    fill_dentry_time_now(&file->dentry, false, true);
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
+}
+
 /********************* READ/WRITE OPERATIONS *********************/
 
 ssize_t fat_file_pread(fat_file file, void *buf, size_t size, off_t offset,
                        fat_file parent) {
-    if (offset > file->dentry->file_size) {
+    return fat_file_pread_clusters(file, buf, size, offset, parent, NULL, NULL);
+}
+
+ssize_t fat_file_pread_clusters(fat_file file, void *buf, size_t size,
+                                off_t offset, fat_file parent,
+                                struct fat_cluster_read_s *reads,
+                                size_t *num_reads) {
+    void *buf_start = buf;
+    size_t bytes_per_cluster = fat_table_bytes_per_cluster(file->table);
+
+    if (num_reads != NULL) {
+        *num_reads = 0;
+    }
+    if (offset > file->dentry.file_size) {
         errno = EOVERFLOW;
         return 0;
     }
-    size = min(size, file->dentry->file_size - offset);
+    size = min(size, file->dentry.file_size - offset);
     if (size == 0) {
         return 0;
     }
@@ -443,18 +672,26 @@ ssize_t fat_file_pread(fat_file file, void *buf, size_t size, off_t offset,
             file->table, bytes_remaining, offset);
         cluster_off = fat_table_cluster_offset(file->table, cluster) +
                       fat_table_mask_offset(offset, file->table);
+        // Taken before reading, a write meanwhile makes it old
+        u32 generation = fat_table_cluster_generation(file->table, cluster);
         bytes_read = full_pread(file->table->fd, buf, bytes_to_read_cluster,
                                 cluster_off);
         if (bytes_read != bytes_to_read_cluster) {
             break;
         }
+        if (reads != NULL && (size_t)bytes_read == bytes_per_cluster) {
+            struct fat_cluster_read_s *read = &reads[(*num_reads)++];
+            read->start = buf - buf_start;
+            read->cluster = cluster;
+            read->generation = generation;
+        }
         buf += bytes_read; // Move pointer
         offset += bytes_read;
         bytes_remaining -= bytes_read;
         cluster = fat_table_get_next_cluster(file->table, cluster);
     }
-    fill_dentry_time_now(file->dentry, false, false);
-    write_dir_entry(parent, file->dentry, file->pos_in_parent);
+    fill_dentry_time_now(&file->dentry, false, false);
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
     return size - bytes_remaining;
 }
 
@@ -463,12 +700,12 @@ void fat_file_truncate(fat_file file, off_t offset, fat_file parent) {
     u32 last_cluster = 0, next_cluster = 0;
 
     current_num_clusters = max(1, fat_table_get_clusters_for_size(
-                                      file->table, file->dentry->file_size));
+                                      file->table, file->dentry.file_size));
     new_num_clusters =
         max(1, fat_table_get_clusters_for_size(file->table, offset));
 
     // Calculate how many clusters to remove
-    if (offset > file->dentry->file_size ||
+    if (offset > file->dentry.file_size ||
         new_num_clusters >= current_num_clusters) {
         return; // Nothing to truncate
     }
@@ -498,15 +735,15 @@ void fat_file_truncate(fat_file file, off_t offset, fat_file parent) {
     }
 
     // Update entrance in directory
-    file->dentry->file_size = offset; // Overwrite with new size
-    fill_dentry_time_now(file->dentry, false, true);
-    write_dir_entry(parent, file->dentry, file->pos_in_parent);
+    file->dentry.file_size = offset; // Overwrite with new size
+    fill_dentry_time_now(&file->dentry, false, true);
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
 }
 
 void fat_file_unlink(fat_file file, fat_file parent) {
     // Mark as deleted in parent's dentry
-    file->dentry->base_name[0] = FAT_FILENAME_DELETED_CHAR;
-    write_dir_entry(parent, file->dentry, file->pos_in_parent);
+    file->dentry.base_name[0] = FAT_FILENAME_DELETED_CHAR;
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
 
     // Free clusters
     u32 last_cluster = file->start_cluster;
@@ -526,7 +763,7 @@ ssize_t fat_file_pwrite(fat_file file, const void *buf, size_t size,
     ssize_t bytes_to_write_cluster = 0;
     off_t original_offset = offset, cluster_off = 0;
 
-    if (offset > file->dentry->file_size) {
+    if (offset > file->dentry.file_size) {
         errno = EOVERFLOW;
         return 0;
     }
@@ -556,6 +793,7 @@ ssize_t fat_file_pwrite(fat_file file, const void *buf, size_t size,
                       fat_table_mask_offset(offset, file->table);
         bytes_written_cluster = full_pwrite(
             file->table->fd, buf, bytes_to_write_cluster, cluster_off);
+        fat_table_cluster_written(file->table, cluster);
         bytes_remaining -= bytes_written_cluster;
         if (bytes_written_cluster != bytes_to_write_cluster) {
             break;
@@ -579,24 +817,24 @@ ssize_t fat_file_pwrite(fat_file file, const void *buf, size_t size,
     }
 
     // Update new file size
-    if (original_offset + size - bytes_remaining > file->dentry->file_size) {
-        file->dentry->file_size = original_offset + size - bytes_remaining;
+    if (original_offset + size - bytes_remaining > file->dentry.file_size) {
+        file->dentry.file_size = original_offset + size - bytes_remaining;
     }
     // TODO if this operation fails, then the FAT table and the file's parent
     // entry are left on an incosistent state. FIXME
     // Update modified time
-    fill_dentry_time_now(file->dentry, false, true);
-    write_dir_entry(parent, file->dentry, file->pos_in_parent);
+    fill_dentry_time_now(&file->dentry, false, true);
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
 
     return size - bytes_remaining;
 }
 
 void fat_file_hide(fat_file file, fat_file parent) {
     assert(file != NULL && parent != NULL);
-    DEBUG("Hiding file %s", file->filepath);
+    DEBUG("Hiding file %s", file->name);
 
-    file->dentry->base_name[0] = FAT_FILENAME_DELETED_CHAR;
-    file->dentry->attribs = FILE_ATTRIBUTE_SYSTEM;
+    file->dentry.base_name[0] = FAT_FILENAME_DELETED_CHAR;
+    file->dentry.attribs = FILE_ATTRIBUTE_SYSTEM;
 
-    write_dir_entry(parent, file->dentry, file->pos_in_parent);
+    write_dir_entry(parent, &file->dentry, file->pos_in_parent);
 }
\ No newline at end of file
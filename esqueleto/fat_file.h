@@ -19,6 +19,7 @@
 #include <utime.h>
 
 struct stat;
+struct fat_cluster_read_s;
 
 /* Flags that go in the @attribs field of FAT directory entries. */
 #define FILE_ATTRIBUTE_READONLY 0x00000001
@@ -34,6 +35,9 @@ struct stat;
 #define MAX_FILENAME (8 + 1 + 3 + 1)
 #define MAX_PATH_LEN 4096 /* Copied from libfat */
 
+/* Inode number of the root directory, the same that FUSE uses for it */
+#define FAT_ROOT_INODE 1
+
 /********************* DATA STRUCTURES *********************/
 
 /* Format of a FAT directory entry on disk (32 bytes) */
@@ -57,14 +61,16 @@ struct fat_dir_entry_s {
 } __attribute__((packed));
 
 /* Wrapper around a FAT directory entry that contains members used to put it in
- * data structures, and to use it as a file handle */
+ * data structures, and to use it as a file handle.
+ * They are allocated from the file_slab of the volume's fat_table. */
 struct fat_file_s {
     // The data from the actual FAT directory entry
-    fat_dir_entry dentry;
+    struct fat_dir_entry_s dentry;
     // Full name of the file (with extension)
     char name[MAX_FILENAME];
-    // Full path to file.
-    char *filepath;
+    // Directory that contains this file, NULL for the root directory. The full
+    // path is not stored, it's rebuilt from the chain of parents when needed
+    fat_file parent;
     // Full start cluster
     u32 start_cluster;
 
@@ -75,6 +81,16 @@ struct fat_file_s {
             // ones). It also marks the position of the first free space for a
             // dir_entry.
             u32 nentries;
+            // Link in the volume's list of directories with their children
+            // in memory, ordered by last use. The data is the tree node.
+            GList lru_link;
+            // Set (atomically) when the directory is used, the eviction
+            // clears it and gives the directory a second chance.
+            bool lru_referenced;
+            // Changes every time a child is created. It's unique among all
+            // directories, even the ones that reuse the memory of a freed
+            // one, so it identifies the current set of children.
+            u32 generation;
         } dir;
         // Valid only for non-directory files
         struct {
@@ -87,46 +103,69 @@ struct fat_file_s {
     u32 pos_in_parent;
     // Pointer to the FAT table containing this file
     fat_table table;
-    // Current number of open file descriptors to this file
-    u32 num_times_opened : 31;
+    // Current number of open file descriptors to this file, or to files
+    // inside this directory. Changed atomically, since files are opened
+    // without locking the tree.
+    u32 num_times_opened;
+    // Number of references to this file that the kernel holds (its lookup
+    // count). While it's not zero, the file is in the volume's inode table.
+    // Protected by the inode lock of the volume.
+    u64 nlookup;
     // True iff the subdirectories of this file have been read into memory.
     // Always 0 for non-directories.
     u32 children_read : 1;
 };
 
-/* Returns an new directory entry with default values.
+/* Fills the directory entry @entry with default values.
  * Caller is still owner of @filepath reference.
  */
-fat_dir_entry fat_file_init_direntry(bool is_dir, const char *filepath,
-                                     u32 start_cluster);
+void fat_file_init_direntry(fat_dir_entry entry, bool is_dir,
+                            const char *filepath, u32 start_cluster);
 
-/* Inits a file without direntry. Can be used to create root file.
- * TAD is owner of @filepath and will apply free at destroy.
+/* Inits a file without direntry nor parent. Can be used to create root file.
  */
-fat_file fat_file_init_empty(bool is_dir, char *filepath);
+fat_file fat_file_init_empty(fat_table table, bool is_dir);
 
 /* Allocate memory and do common initializations on a `fat_file'.
  * Set's the file in the next free entry of @table, and updates
  * If fat_table_get_next_free_cluster(vol) fails or is inconsistent, sets errno
  * to ENOSPC. If set_next_cluster fails, sets errno to EIO.
+ * @parent is the directory where the file will be added, @filepath must be a
+ * path inside it. Caller is still owner of @filepath reference.
  */
-fat_file fat_file_init(fat_table table, bool is_dir, char *filepath);
+fat_file fat_file_init(fat_table table, fat_file parent, bool is_dir,
+                       const char *filepath);
 
-/* Frees filepath and dentry fields of @file, and finally the fat_file_s itself.
- */
+/* Returns @file to the slab of it's volume. */
 void fat_file_destroy(fat_file file);
 
-/* Returns strcmp between the filepath of @file1 and @file2. */
+/* Writes the full path of @file in @buf, that must have space for
+ * MAX_PATH_LEN bytes. Longer paths are truncated. Returns @buf.
+ */
+char *fat_file_path(const fat_file file, char *buf);
+
+/* Returns strcmp between the filepath of @file1 and @file2, without building
+ * them: the paths are compared from the directory where they part. */
 int fat_file_cmp(fat_file file1, fat_file file2);
 
-/* Returns strcmp between the filepath of @file1 and filepath. */
+/* Returns strcmp between the filepath of @file1 and filepath, without building
+ * the filepath of @file1. */
 int fat_file_cmp_path(fat_file file1, char *filepath);
 
 /********************* FILE METADATA *********************/
 
+/* Returns the inode number of @file. It's built from the location of its
+ * directory entry (start cluster of the parent and position in it), so it
+ * doesn't change if the file is evicted from memory and read again.
+ */
+u64 fat_file_inode(const fat_file file);
+
 /* Returns true if @file is a directory. */
 bool fat_file_is_directory(const fat_file file);
 
+/* Gives the directory @dir a new generation, after adding a child to it. */
+void fat_file_dir_changed(fat_file dir);
+
 /* Increment the number of times that a FAT file or directory has been opened */
 void fat_file_inc_num_times_opened(fat_file file);
 
@@ -174,6 +213,16 @@ GList *fat_file_read_children(fat_file dir);
 ssize_t fat_file_pread(fat_file file, void *buf, size_t size, off_t offset,
                        fat_file parent);
 
+/* Like fat_file_pread, and leaves in @reads the clusters read whole, with
+ * their positions in @buf and their generations before reading them (see
+ * fat_table_cluster_generation), and their number in @num_reads. @reads must
+ * have room for @size / fat_table_bytes_per_cluster() of them.
+ */
+ssize_t fat_file_pread_clusters(fat_file file, void *buf, size_t size,
+                                off_t offset, fat_file parent,
+                                struct fat_cluster_read_s *reads,
+                                size_t *num_reads);
+
 /* Truncates @file to @offset bytes. Frees unused clusters and sets new file
  * size. If offset is greater than file size, no operation is performed.
  * If there is an error in the read or write operations, sets errno to EIO
@@ -197,6 +246,31 @@ void fat_file_unlink(fat_file file, fat_file parent);
 ssize_t fat_file_pwrite(fat_file file, const void *buf, size_t size,
                         off_t offset, fat_file parent);
 
+/* Makes @file @size bytes long, filling the space after its current end with
+ * zeros. If it's already that long, nothing is done. The clusters are
+ * reserved at once (see fat_file_reserve) and each one is written once.
+ * Sets errno to ENOSPC if there are not enough free clusters, or to EIO, and
+ * then the file only grows up to the zeros written.
+ */
+void fat_file_extend(fat_file file, off_t size, fat_file parent);
+
+/* Makes the chain of clusters of @file long enough for @size bytes, without
+ * changing its size. Clusters are added in big runs of consecutive ones,
+ * searched from the allocation @group on (see fat_table_alloc_run), and one
+ * by one when there are no such runs. The following writes use them before
+ * allocating new ones (see fat_file_pwrite). Sets errno to ENOSPC if there
+ * are not enough free clusters, or to EIO.
+ */
+void fat_file_reserve(fat_file file, off_t size, u32 group);
+
+/* Exchanges the data (clusters and size) of @file1 and @file2, both children
+ * of @parent.
+ */
+void fat_file_swap_data(fat_file file1, fat_file file2, fat_file parent);
+
+/* Makes @file empty, keeping its clusters for the next writes */
+void fat_file_empty(fat_file file, fat_file parent);
+
 /* Hides a file marking it as pending to be removed and with attribute system
  * in his dentry.
  * PRE: file != NULL && parent != NULL
@@ -83,15 +83,11 @@ void build_filename(const u8 *src_name_p, const u8 *src_extension_p,
     unsigned name_len;
     unsigned extension_len;
     int max_length = 8;
-    // Check if src_name_p is 0xe5 ++ s an extension is log
-    char log_name[] = LOG_FILE_BASENAME;
-    log_name[0] = (char)FAT_FILENAME_DELETED_CHAR;
-    char log_extension[] = LOG_FILE_EXTENSION;
-    if (strncmp(log_name, (char *)src_name_p, 8) == 0 &&
-        strncmp(log_extension, (char *)src_extension_p, 3) == 0) {
-        // This is the log file
-        *dst_name_p = 'f';
-        name_len = 1;
+    // Check if src_name_p is 0xe5 ++ s (or s1, s2...) and extension is log
+    if (is_hidden_log_dentry(src_name_p, src_extension_p)) {
+        // This is a log file
+        *dst_name_p = LOG_FILE_BASENAME[0];
+        name_len = filename_len((char *)src_name_p, max_length) - 1;
         dst_name_p++;
         src_name_p++;
     } else {
@@ -147,15 +143,3 @@ void filename_from_path(const char *src_name_p, u8 *base, u8 *extension) {
         extension[j + 1] = '\0';
     }
 }
-
-char *filepath_from_name(const char *parent_filepath, const char *file_name) {
-    unsigned filepath_len = strlen(parent_filepath);
-    unsigned name_len = strlen(file_name);
-    char *filepath = calloc(filepath_len + name_len + 1, sizeof(char));
-    strcpy(filepath, parent_filepath);
-    if (parent_filepath[filepath_len - 1] != PATH_SEPARATOR[0]) {
-        strcat(filepath, PATH_SEPARATOR);
-    }
-    strcat(filepath, file_name);
-    return filepath;
-}
@@ -17,6 +17,13 @@
 
 struct fat_tree_s {
     h_tree file_tree;
+    // Where the nodes of file_tree are allocated
+    slab node_slab;
+    // Incremented at the start and the end of every modification, so it's
+    // odd while the tree is being modified
+    unsigned int version;
+    // Nesting level of fat_tree_write_begin
+    unsigned int write_depth;
     data_cmp_fn file_cmp;
     data_modify_fn file_destroy;
     data_cmp_fn file_cmp_key;
@@ -25,6 +32,9 @@ struct fat_tree_s {
 fat_tree fat_tree_init() {
     fat_tree new_tree = malloc(sizeof(struct fat_tree_s));
     new_tree->file_tree = NULL; // empty tree
+    new_tree->node_slab = h_tree_node_slab_init();
+    new_tree->version = 0;
+    new_tree->write_depth = 0;
     new_tree->file_cmp = (data_cmp_fn)fat_file_cmp;
     new_tree->file_destroy = (data_modify_fn)fat_file_destroy;
     new_tree->file_cmp_key = (data_cmp_fn)fat_file_cmp_path;
@@ -36,11 +46,42 @@ void fat_tree_destroy(fat_tree tree) {
         if (tree->file_tree != NULL) {
             h_tree_destroy(tree->file_tree, tree->file_destroy);
         }
+        slab_destroy(tree->node_slab);
         free(tree);
     }
     tree = NULL;
 }
 
+void fat_tree_discard(fat_tree tree) {
+    if (tree != NULL) {
+        slab_destroy(tree->node_slab);
+        free(tree);
+    }
+}
+
+void fat_tree_set_epoch(fat_tree tree, epoch e) {
+    slab_set_epoch(tree->node_slab, e);
+}
+
+void fat_tree_write_begin(fat_tree tree) {
+    if (tree->write_depth++ == 0) {
+        __atomic_store_n(&tree->version, tree->version + 1, __ATOMIC_RELAXED);
+        // Readers that see any of the following changes see the odd version
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+void fat_tree_write_end(fat_tree tree) {
+    if (--tree->write_depth == 0) {
+        __atomic_store_n(&tree->version, tree->version + 1, __ATOMIC_RELEASE);
+    }
+}
+
+unsigned int fat_tree_version(const fat_tree tree) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&tree->version, __ATOMIC_ACQUIRE);
+}
+
 int fat_tree_size(const fat_tree tree) {
     if (tree == NULL) {
         return -1;
@@ -54,8 +95,12 @@ fat_tree fat_tree_insert(fat_tree tree, fat_tree_node parent,
         errno = EINVAL;
         return NULL;
     }
-    tree->file_tree = h_tree_insert(tree->file_tree, (void *)new_file,
-                                    (h_tree)parent, tree->file_cmp);
+    fat_tree_write_begin(tree);
+    h_tree new_root = h_tree_insert(tree->file_tree, (void *)new_file,
+                                    (h_tree)parent, tree->file_cmp,
+                                    tree->node_slab);
+    __atomic_store_n(&tree->file_tree, new_root, __ATOMIC_RELEASE);
+    fat_tree_write_end(tree);
     return tree;
 }
 
@@ -70,6 +115,26 @@ fat_tree_node fat_tree_node_search(const fat_tree tree, const char *key) {
     return h_tree_search(tree->file_tree, (void *)key, tree->file_cmp_key);
 }
 
+fat_tree_node fat_tree_node_search_lockless(const fat_tree tree,
+                                            const char *key,
+                                            unsigned int *version) {
+    unsigned int start_version =
+        __atomic_load_n(&tree->version, __ATOMIC_ACQUIRE);
+    if (start_version % 2 != 0) {
+        return NULL; // Being modified right now
+    }
+    h_tree root = __atomic_load_n(&tree->file_tree, __ATOMIC_ACQUIRE);
+    h_tree node =
+        h_tree_search_concurrent(root, (void *)key, tree->file_cmp_key);
+    // The search must be over before checking the version again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&tree->version, __ATOMIC_RELAXED) != start_version) {
+        return NULL;
+    }
+    *version = start_version;
+    return node;
+}
+
 fat_file fat_tree_get_file(const fat_tree_node node) {
     return h_tree_get_data(node);
 }
@@ -78,6 +143,18 @@ fat_file fat_tree_get_parent(const fat_tree_node node) {
     return (fat_file)h_tree_get_data(h_tree_get_h_parent(node));
 }
 
+fat_tree_node fat_tree_get_parent_node(const fat_tree_node node) {
+    return h_tree_get_h_parent(node);
+}
+
+fat_tree_node fat_tree_first_child(const fat_tree_node dir_node) {
+    return h_tree_get_h_children(dir_node);
+}
+
+fat_tree_node fat_tree_next_sibling(const fat_tree_node node) {
+    return h_tree_get_h_next_sibling(node);
+}
+
 void fat_tree_inc_num_times_opened(fat_tree_node node) {
     h_tree_iterate_h_ancestors(node,
                                (data_modify_fn)fat_file_inc_num_times_opened);
@@ -96,8 +173,24 @@ fat_tree fat_tree_delete(fat_tree tree, const char *key) {
     if (key == NULL || tree->file_tree == NULL) {
         return tree;
     }
-    tree->file_tree = h_tree_delete(tree->file_tree, key, tree->file_cmp_key,
+    fat_tree_write_begin(tree);
+    h_tree new_root = h_tree_delete(tree->file_tree, key, tree->file_cmp_key,
                                     tree->file_destroy);
+    __atomic_store_n(&tree->file_tree, new_root, __ATOMIC_RELEASE);
+    fat_tree_write_end(tree);
+    return tree;
+}
+
+fat_tree fat_tree_delete_children(fat_tree tree, fat_tree_node dir_node) {
+    if (tree == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    fat_tree_write_begin(tree);
+    h_tree new_root = h_tree_delete_h_children(
+        tree->file_tree, (h_tree)dir_node, tree->file_cmp, tree->file_destroy);
+    __atomic_store_n(&tree->file_tree, new_root, __ATOMIC_RELEASE);
+    fat_tree_write_end(tree);
     return tree;
 }
 
@@ -110,7 +203,8 @@ void fat_tree_iterate_preorder(fat_tree tree, data_modify_fn mod_fn) {
 // DEBUGGING FUNCTIONS
 static void print_node(void *file_data) {
     fat_file file = (fat_file)file_data;
-    printf("%s ", file->filepath);
+    char filepath[MAX_PATH_LEN];
+    printf("%s ", fat_file_path(file, filepath));
 }
 
 void fat_tree_print_preorder(fat_tree tree) {
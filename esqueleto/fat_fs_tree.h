@@ -19,6 +19,7 @@
 #include "mock_fat_file.h"
 #endif
 
+#include "epoch.h"
 #include "hierarchy_tree.h"
 #include <stdlib.h>
 
@@ -31,6 +32,18 @@ fat_tree fat_tree_init();
 /* Destroys every node in @tree, frees the memory of all it's fat_files */
 void fat_tree_destroy(fat_tree tree);
 
+/* Frees @tree and all it's nodes at once, without visiting them. The fat_files
+ * are NOT destroyed, so this should be used only when their memory is
+ * released in bulk by their owner (see fat_volume_unmount).
+ */
+void fat_tree_discard(fat_tree tree);
+
+/* Delays the reuse of the nodes and files removed from @tree until no reader
+ * of @e can be using them, so @tree can be searched with
+ * fat_tree_node_search_lockless.
+ */
+void fat_tree_set_epoch(fat_tree tree, epoch e);
+
 /* Returns the number of files in the tree */
 int fat_tree_size(const fat_tree tree);
 
@@ -38,6 +51,8 @@ int fat_tree_size(const fat_tree tree);
  * directory, and must be a node of @tree. It may be NULL.
  * The TAD is the owner of the reference to @new_file and will destroy it when
  * destroying the whole tree.
+ * If a file with the same path is already in @tree, @new_file is not inserted
+ * and errno is set to EEXIST.
  */
 fat_tree fat_tree_insert(fat_tree tree, fat_tree_node parent,
                          const fat_file new_file);
@@ -61,6 +76,32 @@ fat_file fat_tree_search(const fat_tree tree, const char *key);
  * is NULL, sets errno to EINVAL*/
 fat_tree_node fat_tree_node_search(const fat_tree tree, const char *key);
 
+/* Same as fat_tree_node_search, but it may run while other thread modifies
+ * @tree. The caller must be in a read section of the epoch of @tree, and the
+ * node is valid until the section ends.
+ * Returns NULL if @key is not found or @tree was modified during the search,
+ * then the search must be repeated excluding writers. Otherwise, *@version is
+ * the version of @tree when it was found.
+ */
+fat_tree_node fat_tree_node_search_lockless(const fat_tree tree,
+                                            const char *key,
+                                            unsigned int *version);
+
+/* Returns the version of @tree, it changes every time the tree is modified.
+ * Readers without locks can compare it with the one from
+ * fat_tree_node_search_lockless to know if a writer ran in the meantime.
+ */
+unsigned int fat_tree_version(const fat_tree tree);
+
+/* Marks the start and the end of a modification of @tree, they can be nested.
+ * Inserting or deleting already do it, but callers that check something
+ * before modifying it (like the number of times a file is opened) must do it
+ * before checking, so readers without locks notice the change.
+ * Modifications must be serialized by the caller.
+ */
+void fat_tree_write_begin(fat_tree tree);
+void fat_tree_write_end(fat_tree tree);
+
 /* Extract the file pointer from a fat_tree_node @node structure.
  * If @node is NULL, returns NULL and sets errno to EINVAL.
  */
@@ -71,6 +112,23 @@ fat_file fat_tree_get_file(const fat_tree_node node);
  */
 fat_file fat_tree_get_parent(const fat_tree_node node);
 
+/* Returns the node of the directory that contains the fat_file in @node, or
+ * NULL if @node is NULL or has no parent.
+ */
+fat_tree_node fat_tree_get_parent_node(const fat_tree_node node);
+
+/* Returns the node of the first child of the directory in @dir_node, or NULL
+ * if it has none in the tree. Children are ordered from the last inserted to
+ * the first one, so the ones read from disk are sorted by decreasing
+ * pos_in_parent.
+ */
+fat_tree_node fat_tree_first_child(const fat_tree_node dir_node);
+
+/* Returns the node of the child of the same directory that follows @node, or
+ * NULL if @node is the last one.
+ */
+fat_tree_node fat_tree_next_sibling(const fat_tree_node node);
+
 /* Applies function fat_file_inc_num_times_opened to the fat_file in @node
  * and all it's ancestor directories.
  */
@@ -87,6 +145,12 @@ void fat_tree_dec_num_times_opened(fat_tree_node node);
  */
 fat_tree fat_tree_delete(fat_tree tree, const char *key);
 
+/* Deletes from @tree all the files contained in the directory of @dir_node,
+ * recursively. The fat_files will be destroyed by this action, but the
+ * directory itself is kept. If tree is NULL, errno is set to EINVAL.
+ */
+fat_tree fat_tree_delete_children(fat_tree tree, fat_tree_node dir_node);
+
 /* Applies the function @mod_fn to all elements in @tree, in pre-order. */
 void fat_tree_iterate_preorder(fat_tree tree, data_modify_fn mod_fn);
 
@@ -5,31 +5,140 @@
  */
 
 #include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "big_brother.h"
 #include "fat_fuse_ops.h"
 #include "fat_volume.h"
+#include "scan_pool.h"
 
 static void usage() {
     const char *usage_str =
-        "Usage: fat-fuse [-f] [-d] [-r] [-l] VOLUME MOUNTPOINT\n";
+        "Usage: fat-fuse [-f] [-d] [-r] [-l] [-s] [-c] [-b] [-m MAXFILES] "
+        "[-a SECONDS] [-L MEGABYTES] [-w WORDFILE] [-S THREADS] VOLUME "
+        "MOUNTPOINT\n";
     fputs(usage_str, stdout);
 }
 
 static void usage_short() {
     const char *usage_str =
-        "Usage: fat-fuse [-f] [-d] [-r] [-l] VOLUME MOUNTPOINT\n";
+        "Usage: fat-fuse [-f] [-d] [-r] [-l] [-s] [-c] [-b] [-m MAXFILES] "
+        "[-a SECONDS] [-L MEGABYTES] [-w WORDFILE] [-S THREADS] VOLUME "
+        "MOUNTPOINT\n";
     fputs(usage_str, stderr);
 }
 
-static const char *shortopts = "dfhrl";
+// Thread that reloads the censored words on SIGHUP, see words_reloader_start
+static pthread_t words_reloader;
+static bool words_reloader_stop = false;
+
+static void *words_reloader_main(void *arg) {
+    fat_volume vol = arg;
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    while (sigwait(&set, &sig) == 0 &&
+           !__atomic_load_n(&words_reloader_stop, __ATOMIC_ACQUIRE)) {
+        fat_fuse_reload_words(vol);
+    }
+    return NULL;
+}
+
+/* Blocks SIGHUP, that would end the session, in the threads started from now
+ * on, and starts a thread that reloads the censored words of @vol each time
+ * it's received. Returns false if it can't be started.
+ */
+static bool words_reloader_start(fat_volume vol) {
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    return pthread_sigmask(SIG_BLOCK, &set, NULL) == 0 &&
+           pthread_create(&words_reloader, NULL, words_reloader_main, vol) ==
+               0;
+}
+
+/* Stops the thread of words_reloader_start */
+static void words_reloader_join(void) {
+    __atomic_store_n(&words_reloader_stop, true, __ATOMIC_RELEASE);
+    pthread_kill(words_reloader, SIGHUP);
+    pthread_join(words_reloader, NULL);
+}
+
+/* Mounts the filesystem with the options in @args, and serves the requests
+ * for @vol until it is unmounted. With @reload_words, SIGHUP reloads the
+ * censored words instead. Returns 0 on success.
+ */
+static int fuse_serve(struct fuse_args *args, fat_volume vol,
+                      bool reload_words) {
+    struct fuse_cmdline_opts opts;
+    struct fuse_loop_config config;
+    struct fuse_session *se = NULL;
+    int err = -1;
+
+    if (fuse_parse_cmdline(args, &opts) != 0) {
+        return 1;
+    }
+    se = fuse_session_new(args, &fat_fuse_operations,
+                          sizeof(fat_fuse_operations), vol);
+    if (se != NULL && fuse_set_signal_handlers(se) == 0) {
+        if (fuse_session_mount(se, opts.mountpoint) == 0) {
+            fat_fuse_session = se;
+            // This detaches the process from the terminal
+            if (fuse_daemonize(opts.foreground) != 0) {
+                err = -1;
+            } else if (reload_words && !words_reloader_start(vol)) {
+                fat_error("Failed to start reloading the censored words");
+                err = -1;
+            } else {
+                if (opts.singlethread) {
+                    err = fuse_session_loop(se);
+                } else {
+                    config.clone_fd = opts.clone_fd;
+                    config.max_idle_threads = opts.max_idle_threads;
+                    err = fuse_session_loop_mt(se, &config);
+                }
+                if (reload_words) {
+                    words_reloader_join();
+                }
+            }
+            fat_fuse_session = NULL;
+            fuse_session_unmount(se);
+        }
+        fuse_remove_signal_handlers(se);
+    }
+    if (se != NULL) {
+        fuse_session_destroy(se);
+    }
+    free(opts.mountpoint);
+    return err ? 1 : 0;
+}
+
+// Bigger requests for reads and writes when the kernel caches the files
+#define KERNEL_CACHE_FUSE_OPTIONS "max_read=131072"
+
+static const char *shortopts = "dfhrlscbm:a:L:w:S:";
 static const struct option longopts[] = {
     {"debug", no_argument, NULL, 'd'},
     {"foreground", no_argument, NULL, 'f'},
     {"help", no_argument, NULL, 'h'},
     {"readonly", no_argument, NULL, 'r'},
     {"logshow", no_argument, NULL, 'l'},
+    {"single-thread", no_argument, NULL, 's'},
+    {"kernel-cache", no_argument, NULL, 'c'},
+    {"binary-log", no_argument, NULL, 'b'},
+    {"max-files", required_argument, NULL, 'm'},
+    {"aggregate", required_argument, NULL, 'a'},
+    {"log-size", required_argument, NULL, 'L'},
+    {"words", required_argument, NULL, 'w'},
+    {"scan-threads", required_argument, NULL, 'S'},
     {NULL, 0, NULL, 0},
 };
 
@@ -40,10 +149,14 @@ int main(int argc, char **argv) {
     fat_volume vol;
     char *fuse_argv[50];
     int fuse_argc;
+    struct fuse_args fuse_args;
     int fuse_status;
     int ret;
     int mount_flags = FAT_MOUNT_FLAG_READWRITE;
-    int debug = 0, foreground = 0;
+    int debug = 0, foreground = 0, single_thread = 0;
+    size_t max_files = FAT_DEFAULT_MAX_ALLOCATED_FILES;
+    char *endptr = NULL;
+    char *words_file = NULL;
 
     while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
         switch (c) {
@@ -62,6 +175,53 @@ int main(int argc, char **argv) {
         case 'l': // Don't hide log file
             log_hide = false;
             break;
+        case 's':
+            single_thread = 1;
+            break;
+        case 'c': // Only valid if nothing else changes the volume meanwhile
+            fat_fuse_kernel_cache = true;
+            break;
+        case 'b': // Read it with fat-logcat
+            fat_fuse_log_binary = true;
+            break;
+        case 'm': // Files to keep in memory before evicting directories
+            max_files = strtoul(optarg, &endptr, 10);
+            if (*optarg == '\0' || *endptr != '\0') {
+                usage_short();
+                return 2;
+            }
+            break;
+        case 'a': // Sum up the activity logged in windows of this many seconds
+            fat_fuse_log_window = strtoul(optarg, &endptr, 10);
+            if (*optarg == '\0' || *endptr != '\0') {
+                usage_short();
+                return 2;
+            }
+            break;
+        case 'L': // Rotate the log when it reaches this many MiB
+            fat_fuse_log_max_size = (off_t)strtoul(optarg, &endptr, 10) << 20;
+            if (*optarg == '\0' || *endptr != '\0') {
+                usage_short();
+                return 2;
+            }
+            break;
+        case 'S': // Scan for the censored words after replying
+            fat_fuse_scan_threads = strtoul(optarg, &endptr, 10);
+            if (*optarg == '\0' || *endptr != '\0' ||
+                fat_fuse_scan_threads > SCAN_POOL_MAX_THREADS) {
+                usage_short();
+                return 2;
+            }
+            break;
+        case 'w': // Censored words, one per line, reloaded on SIGHUP
+            // The daemon runs in /
+            free(words_file);
+            words_file = realpath(optarg, NULL);
+            if (words_file == NULL) {
+                fat_error("%s: %m", optarg);
+                return 1;
+            }
+            break;
         default:
             usage_short();
             return 2;
@@ -81,8 +241,17 @@ int main(int argc, char **argv) {
     fuse_argv[fuse_argc] = "fat-fuse";
     fuse_argc++;
 
-    fuse_argv[fuse_argc] = "-s"; // Single-threaded
-    fuse_argc++;
+    if (single_thread) {
+        fuse_argv[fuse_argc] = "-s"; // Single-threaded
+        fuse_argc++;
+    }
+
+    if (fat_fuse_kernel_cache) {
+        fuse_argv[fuse_argc] = "-o";
+        fuse_argc++;
+        fuse_argv[fuse_argc] = KERNEL_CACHE_FUSE_OPTIONS;
+        fuse_argc++;
+    }
 
     if (mount_flags & FAT_MOUNT_FLAG_READONLY) {
         DEBUG("Read only mode");
@@ -108,15 +277,28 @@ int main(int argc, char **argv) {
     vol = fat_volume_mount(volume, mount_flags);
     if (!vol) {
         fat_error("Failed to mount FAT volume \"%s\": %m", volume);
+        free(words_file);
+        return 1;
+    }
+    // Scans of the words are read sections of the volume
+    if (!censored_words_load(words_file, vol->reclaim)) {
+        fat_error("Failed to load the censored words: %m");
+        fat_volume_unmount(vol);
+        free(words_file);
         return 1;
     }
+    vol->max_allocated_files = max_files;
 
-    // Call fuse_main() to pass control to FUSE.  This will daemonize the
-    // process, causing it to detach from the terminal.
+    // Pass control to FUSE. This will daemonize the process, causing it to
+    // detach from the terminal.
     // fat_volume_unmount() will not be called until the filesystem is
-    // unmounted and fuse_main() returns in the daemon process.
-    fuse_status = fuse_main(fuse_argc, fuse_argv, &fat_fuse_operations, vol);
+    // unmounted and fuse_serve() returns in the daemon process.
+    fuse_args = (struct fuse_args)FUSE_ARGS_INIT(fuse_argc, fuse_argv);
+    fuse_status = fuse_serve(&fuse_args, vol, words_file != NULL);
+    fuse_opt_free_args(&fuse_args);
     ret = fat_volume_unmount(vol);
+    censored_words_free();
+    free(words_file);
     if (ret)
         fat_error("failed to unmount FAT volume \"%s\": %m", volume);
     else
@@ -10,8 +10,10 @@
 #include "fat_file.h"
 #include "fat_filename_util.h"
 #include "fat_fs_tree.h"
+#include "fat_logger.h"
 #include "fat_util.h"
 #include "fat_volume.h"
+#include "scan_pool.h"
 #include <assert.h>
 #include <errno.h>
 #include <gmodule.h>
@@ -29,40 +31,283 @@
 // dentro del volumen
 bool log_hide = true;
 
-/* Retrieve the currently mounted FAT volume from the FUSE context. */
-static inline fat_volume get_fat_volume() {
-    return fuse_get_context()->private_data;
+bool fat_fuse_kernel_cache = false;
+
+unsigned int fat_fuse_log_window = 0;
+
+bool fat_fuse_log_binary = false;
+
+off_t fat_fuse_log_max_size = 0;
+
+unsigned int fat_fuse_scan_threads = 0;
+
+// Mounted session, used to notify the kernel of changes it didn't request
+struct fuse_session *fat_fuse_session = NULL;
+
+// Size of the biggest write requests with fat_fuse_kernel_cache
+#define FAT_FUSE_CACHE_MAX_WRITE 131072
+
+// Bytes of reads and writes waiting to be scanned with fat_fuse_scan_threads.
+// When there are more, the requests wait for the scanners.
+#define FAT_FUSE_SCAN_QUEUE_BYTES (64 << 20)
+
+/* Seconds that the kernel can keep names and attributes without asking again.
+ * This daemon is the only writer of the volume, changes it does on its own
+ * are notified (see fat_fuse_notify_attr), so with fat_fuse_kernel_cache they
+ * only expire to bound the memory of the kernel.
+ */
+#define FAT_FUSE_TIMEOUT 1.0
+#define FAT_FUSE_CACHE_TIMEOUT 86400.0
+
+static inline double fat_fuse_timeout(void) {
+    return fat_fuse_kernel_cache ? FAT_FUSE_CACHE_TIMEOUT : FAT_FUSE_TIMEOUT;
+}
+
+/* Scan of the data read or written through a handle, that goes on in the
+ * next request if it starts where the previous one ended, so words split
+ * between them are found (see censored_words_found_stream).
+ */
+struct fat_fuse_stream_s {
+    off_t end;
+    struct censored_words_stream_s scan;
+};
+
+/* Open file, in fi->fh. Directories only have their node. */
+struct fat_fuse_handle_s {
+    fat_tree_node node;
+    // User that opened the file. With the writeback cache the writes come
+    // from the kernel when it flushes, not from the user, so they are logged
+    // with this one. Only the requests of direct_io handles are the user's.
+    uid_t uid;
+    bool direct_io;
+    // Serializes the requests of the streams
+    pthread_mutex_t lock;
+    struct fat_fuse_stream_s streams[2]; // By fat_log_op
+};
+
+typedef struct fat_fuse_handle_s *fat_fuse_handle;
+
+/* Read or write of the user uid through handle, to look for the censored
+ * words in
+ */
+struct fat_fuse_scan_s {
+    fat_fuse_handle handle;
+    uid_t uid;
+    fat_log_op op;
+    off_t offset;
+    const char *buf;
+    size_t size;
+    // Whole clusters in buf, for reads (see censored_words_found_clusters)
+    struct fat_cluster_read_s *reads;
+    size_t num_reads;
+};
+
+/* Scan waiting in vol->scanner, or the release of its handle after the ones
+ * before it
+ */
+struct fat_fuse_scan_job_s {
+    struct scan_pool_job_s job;
+    fat_volume vol;
+    struct fat_fuse_scan_s scan;
+    // The buffer and the clusters of the read are freed with the job,
+    // otherwise the buffer is a copy in data
+    bool owned;
+    char data[];
+};
+
+static int fat_fuse_create(fat_volume vol, const char *path, bool is_dir);
+static void fat_fuse_read_children(fat_volume vol, fat_tree_node dir_node);
+
+/* Search the node of @path in the tree. If it's not there but its parent
+ * directory has not been read (or its children were evicted), the parent is
+ * read and the search is repeated.
+ * Returns NULL and sets errno to ENOENT if the file does not exist.
+ * The tree lock must be held for writing.
+ */
+static fat_tree_node fat_fuse_node_search(fat_volume vol, const char *path) {
+    fat_tree_node node = fat_tree_node_search(vol->file_tree, path);
+    if (node != NULL || strcmp(path, "/") == 0) {
+        return node;
+    }
+    char *copy_path = strdup(path);
+    fat_tree_node parent_node = fat_fuse_node_search(vol, dirname(copy_path));
+    free(copy_path);
+    copy_path = NULL;
+    if (parent_node == NULL) {
+        return NULL;
+    }
+    fat_file parent = fat_tree_get_file(parent_node);
+    if (!fat_file_is_directory(parent)) {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (!parent->children_read) {
+        errno = 0;
+        fat_fuse_read_children(vol, parent_node);
+        if (errno != 0) {
+            return NULL;
+        }
+        node = fat_tree_node_search(vol->file_tree, path);
+    }
+    if (node == NULL) {
+        fat_negative_cache_add(vol->negative_cache, parent,
+                               strrchr(path, '/') + 1);
+        errno = ENOENT;
+    }
+    return node;
+}
+
+/* Takes the tree lock for reading and searches @path. If the file is not in
+ * the tree the lock is taken again for writing, so fat_fuse_node_search can
+ * read its parent. Either way, the lock is held when this returns.
+ */
+static fat_tree_node fat_fuse_rdlock_search(fat_volume vol, const char *path) {
+    pthread_rwlock_rdlock(&vol->tree_lock);
+    fat_tree_node node = fat_tree_node_search(vol->file_tree, path);
+    if (node == NULL) {
+        pthread_rwlock_unlock(&vol->tree_lock);
+        pthread_rwlock_wrlock(&vol->tree_lock);
+        errno = 0;
+        node = fat_fuse_node_search(vol, path);
+    }
+    return node;
+}
+
+/* Writes in @buf the path of the file called @name in directory @dir. Returns
+ * false and sets errno to ENAMETOOLONG if it doesn't fit in MAX_PATH_LEN bytes.
+ * The caller must keep the ancestors of @dir in the tree.
+ */
+static bool fat_fuse_child_path(fat_file dir, const char *name, char *buf) {
+    fat_file_path(dir, buf);
+    size_t len = strlen(buf);
+    const char *separator = dir->parent == NULL ? "" : "/";
+    if (len + strlen(separator) + strlen(name) >= MAX_PATH_LEN) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcat(strcat(buf, separator), name);
+    return true;
+}
+
+/* Searches the file @path inside the directory in @dir_node without locking
+ * the tree, and pins it for a new reference of the kernel. Returns NULL if
+ * the file was not found this way, or the tree changed before it was pinned;
+ * then the caller must search it with the tree lock.
+ * The caller must be in a read section of the epoch.
+ */
+static fat_tree_node fat_fuse_lockless_lookup(fat_volume vol,
+                                              fat_tree_node dir_node,
+                                              const char *path) {
+    unsigned int version = 0;
+    fat_tree_node file_node =
+        fat_tree_node_search_lockless(vol->file_tree, path, &version);
+    if (file_node != NULL) {
+        fat_tree_inc_num_times_opened(dir_node);
+        if (fat_tree_version(vol->file_tree) != version) {
+            // A writer may have evicted it without seeing it pinned
+            fat_tree_dec_num_times_opened(dir_node);
+            file_node = NULL;
+        }
+    }
+    return file_node;
 }
 
-#define DATE_MESSAGE_SIZE 30
+/* Removes @nlookup references of the kernel to the file with inode @ino.
+ * Takes the tree lock for reading.
+ */
+static void fat_fuse_unref(fat_volume vol, fuse_ino_t ino, u64 nlookup) {
+    pthread_rwlock_rdlock(&vol->tree_lock);
+    fat_tree_node node = fat_volume_inode_unref(vol, ino, &nlookup);
+    fat_tree_node parent_node = fat_tree_get_parent_node(node);
+    for (u64 i = 0; i < nlookup; i++) {
+        fat_tree_dec_num_times_opened(parent_node);
+    }
+    pthread_rwlock_unlock(&vol->tree_lock);
+}
+
+/* Removes all the references of the kernel to the file in @node, that is
+ * about to be deleted from the tree. The tree lock must be held for writing.
+ */
+static void fat_fuse_drop(fat_volume vol, fat_tree_node node) {
+    u64 nlookup = fat_volume_inode_drop(vol, node);
+    fat_tree_node parent_node = fat_tree_get_parent_node(node);
+    for (u64 i = 0; i < nlookup; i++) {
+        fat_tree_dec_num_times_opened(parent_node);
+    }
+}
+
+/* Replies to @req with the entry of the file in @node, that becomes a new
+ * reference of the kernel. Its ancestors must be pinned for it already (the
+ * kernel references keep the directories that contain them in memory, but
+ * not their own children).
+ */
+static void fat_fuse_reply_entry(fuse_req_t req, fat_volume vol,
+                                 fat_tree_node node) {
+    struct fuse_entry_param entry;
+    fat_file file = fat_tree_get_file(node);
+    pthread_rwlock_t *file_lock = fat_volume_file_lock(vol, file);
+
+    memset(&entry, 0, sizeof(entry));
+    entry.ino = fat_file_inode(file);
+    entry.generation = fat_volume_inode_generation(vol, entry.ino);
+    entry.attr_timeout = fat_fuse_timeout();
+    entry.entry_timeout = fat_fuse_timeout();
+    pthread_rwlock_rdlock(file_lock);
+    fat_file_to_stbuf(file, &entry.attr);
+    pthread_rwlock_unlock(file_lock);
+    fat_volume_inode_ref(vol, node);
+    if (fuse_reply_entry(req, &entry) != 0) {
+        // The request was interrupted, the kernel won't forget it
+        fat_fuse_unref(vol, entry.ino, 1);
+    }
+}
 
-static int fat_fuse_mknod(const char *path, mode_t mode, dev_t dev);
+/* Tells the kernel that the attributes of @file changed, when it's not the
+ * kernel who asked for the change. Page cache is kept, as it may be locked
+ * by the request that is running.
+ */
+static void fat_fuse_notify_attr(fat_file file) {
+    if (fat_fuse_session != NULL) {
+        fuse_lowlevel_notify_inval_inode(fat_fuse_session,
+                                         fat_file_inode(file), -1, 0);
+    }
+}
 
-/* Create log file if it does not exist
+/* Create the log file in @log_path if it does not exist, and keep it in the
+ * tree for the logger. Returns its node, or NULL if it can't be created.
  */
-static void fat_fuse_log_init(void) {
+static fat_tree_node fat_fuse_log_init(fat_volume vol, const char *log_path) {
     int starting_errno = errno;
-    errno = 0; // We want to create fs.log, without taking into account previous
-               // errors
-    fat_volume vol = get_fat_volume();
-    fat_tree_node log_node = fat_tree_node_search(vol->file_tree, LOG_FILEPATH);
+    errno = 0; // We want to create the log, without taking into account
+               // previous errors
+    pthread_rwlock_rdlock(&vol->tree_lock);
+    fat_tree_node log_node = fat_tree_node_search(vol->file_tree, log_path);
+    if (log_node == NULL) {
+        // Search again with the lock that allows to create it
+        pthread_rwlock_unlock(&vol->tree_lock);
+        pthread_rwlock_wrlock(&vol->tree_lock);
+        log_node = fat_tree_node_search(vol->file_tree, log_path);
+    }
     if (log_node != NULL) {
         // log_file exists
         DEBUG("log already exist");
+        fat_tree_inc_num_times_opened(log_node);
+        pthread_rwlock_unlock(&vol->tree_lock);
         errno = starting_errno;
-        return;
+        return log_node;
     }
-    DEBUG("log doesn't exist, creating " LOG_FILEPATH);
+    DEBUG("log doesn't exist, creating %s", log_path);
 
-    int mknod_exit = fat_fuse_mknod(LOG_FILEPATH, 0, 0); // 0, 0 are ignored
+    int mknod_exit = fat_fuse_create(vol, log_path, false);
     if (mknod_exit != 0) {
         // (milagro) "Unable"
-        DEBUG("Aneble to creat " LOG_FILEPATH);
+        DEBUG("Aneble to creat %s", log_path);
+        pthread_rwlock_unlock(&vol->tree_lock);
         errno = starting_errno;
-        return;
+        return NULL;
     }
 
-    log_node = fat_tree_node_search(vol->file_tree, LOG_FILEPATH);
+    log_node = fat_tree_node_search(vol->file_tree, log_path);
     assert(log_node != NULL); // We just created it
 
     fat_file log_file = fat_tree_get_file(log_node);
@@ -72,362 +317,781 @@ static void fat_fuse_log_init(void) {
     fat_file log_parent = fat_tree_get_parent(log_node);
     if (log_parent == NULL) {
         DEBUG("log parent is NULL, can't hide");
-        errno = starting_errno;
-        return;
+    } else {
+        fat_file_hide(log_file, log_parent);
     }
-
-    fat_file_hide(log_file, log_parent);
+    fat_tree_inc_num_times_opened(log_node);
+    pthread_rwlock_unlock(&vol->tree_lock);
 
     errno = starting_errno;
+    return log_node;
 }
 
-/* Writes @text to the log file if it exists
- *
- * PRE: text != NULL
- */
-static void fat_fuse_log_write(const char *text) {
-    assert(text != NULL);
-
-    fat_volume vol = get_fat_volume();
-    fat_tree_node log_node = fat_tree_node_search(vol->file_tree, LOG_FILEPATH);
-    if (log_node == NULL) {
-        DEBUG(LOG_FILEPATH "doesn't exist, can't log");
-        return;
+/* Called by the logger each time it changes a log file */
+static void fat_fuse_log_written(fat_file log_file) {
+    if (!log_hide || fat_fuse_kernel_cache) {
+        // Its size changed, and the kernel may have cached it
+        fat_fuse_notify_attr(log_file);
     }
-    fat_file log_file = fat_tree_get_file(log_node);
-    fat_file parent = fat_tree_get_parent(log_node);
-    fat_file_pwrite(log_file, text, strlen(text), log_file->dentry->file_size,
-                    parent);
 }
 
-/* Checks if a given file is fs.log
+/* Checks if a given file is fs.log, one of its older generations, or one of
+ * their indexes
  * PRE: @file != NULL
  */
-static bool is_fs_log(fat_file file) {
+static bool is_log_file(fat_file file) {
     assert(file != NULL);
-    return (fat_file_cmp_path(file, LOG_FILEPATH) == 0);
+    return file->parent != NULL && file->parent->parent == NULL &&
+           is_log_filename(file->name);
 }
 
-/* Creates a string with the current date and time.
- * The string is allocated, and must be freed by the caller.
- * In case of memory allocation error NULL is returned
+/* Writes in @path the path of the file called @name in the directory with
+ * inode @parent_ino, and returns the node of the directory. Returns NULL and
+ * sets errno if the directory is not known or the path is too long.
+ * The caller must hold the tree lock or be in a read section of the epoch.
  */
-static char *now_to_str(void) {
-    char *text = malloc(DATE_MESSAGE_SIZE);
-    if (text == NULL) {
-        return text;
+static fat_tree_node fat_fuse_resolve_child(fat_volume vol,
+                                            fuse_ino_t parent_ino,
+                                            const char *name, char *path) {
+    fat_tree_node parent_node = fat_volume_inode_get(vol, parent_ino);
+    if (parent_node == NULL) {
+        errno = ENOENT;
+        return NULL;
     }
-
-    time_t now = time(NULL);
-    struct tm *timeinfo;
-    timeinfo = localtime(&now);
-
-    strftime(text, DATE_MESSAGE_SIZE, "%d-%m-%Y %H:%M", timeinfo);
-    return (text);
+    fat_file parent = fat_tree_get_file(parent_node);
+    if (!fat_file_is_directory(parent)) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+    if (!fat_fuse_child_path(parent, name, path)) {
+        return NULL;
+    }
+    return parent_node;
 }
 
-// (milagro) Esta funcion deberia estar en otro archivo. Ademas, podian usar
-// la que viene en string.h
-
-/* Concatenates 2 strings re-allocating the first one to add the necessary
- * space. s1 has to be a dinamic string (declared with malloc), but s2 can
- * be static.
- *
- * s2 must not be NULL, but s1 can be NULL, in that case nothing is done
- * and NULL is returned. This allows us to use str_concat several times and
- * only check if there's an error at the end of everything, saving us a lot
- * of `if`.
- *
- * In case of memory allocation error NULL is returned and s1 is freed
- * (but not s2).
- *
- * USAGE:
- *     s1 = str_concat(s1, s2);
- *     s1 = str_concat(s1, "string");
- *
- * REQUIRES:
- *     s2 != NULL
+/* Choose the features of the connection, and create the log file once the
+ * filesystem is mounted.
  */
-static char *str_concat(char *s1, const char *s2) {
-    assert(s2 != NULL);
-
-    if (s1 != NULL) {
-        size_t s1_len = strlen(s1);
-        size_t s2_len = strlen(s2);
-        s1 = reallocarray(s1, s1_len + s2_len + 1, sizeof(char));
-        // The + 1 is for the '\0'
-        if (s1 != NULL) {
-            // Case that reallocarray doesn't fail
-            s1 = strcat(s1, s2);
-        } else {
-            // Case that reallocarray fails
-            free(s1);
-            s1 = NULL;
+static void fat_fuse_init(void *userdata, struct fuse_conn_info *conn) {
+    // The kernel gathers small writes in its cache, and keeps the size and
+    // modification time of the files meanwhile. Writes may arrive out of
+    // order, so they can start after the end of the file (see fat_fuse_write)
+    if (conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+    }
+    // Listings come with the attributes of the files (see fat_fuse_list_dir)
+    // every time, so ls -l or find don't ask for them one by one
+    if (conn->capable & FUSE_CAP_READDIRPLUS) {
+        conn->want |= FUSE_CAP_READDIRPLUS;
+        conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+    }
+    if (fat_fuse_kernel_cache) {
+        conn->max_write = FAT_FUSE_CACHE_MAX_WRITE;
+    }
+    fat_volume vol = userdata;
+    fat_tree_node log_nodes[LOG_GENERATIONS];
+    fat_tree_node index_nodes[LOG_GENERATIONS];
+    bool has_index = true;
+    char log_path[LOG_FILEPATH_LEN];
+    size_t generations = 0;
+    size_t max_generations = fat_fuse_log_max_size != 0 ? LOG_GENERATIONS : 1;
+    while (generations < max_generations) {
+        log_nodes[generations] = fat_fuse_log_init(
+            vol, log_filepath(generations, LOG_FILE_EXTENSION, log_path));
+        if (log_nodes[generations] == NULL) {
+            break; // Rotate through the ones that could be created
+        }
+        if (has_index) {
+            index_nodes[generations] = fat_fuse_log_init(
+                vol, log_filepath(generations, LOG_INDEX_EXTENSION, log_path));
+            // The log is still useful without it
+            has_index = index_nodes[generations] != NULL;
+        }
+        generations++;
+    }
+    if (generations != 0) {
+        int flags = fat_fuse_log_binary ? FAT_LOGGER_BINARY : 0;
+        vol->logger = fat_logger_init(vol, log_nodes,
+                                      has_index ? index_nodes : NULL,
+                                      generations,
+                                      fat_fuse_log_max_size,
+                                      fat_fuse_log_window, flags,
+                                      fat_fuse_log_written);
+        if (vol->logger == NULL) {
+            DEBUG("Unable to start the logger: %s", strerror(errno));
+        }
+    }
+    // Scans only feed the log
+    if (vol->logger != NULL && fat_fuse_scan_threads != 0) {
+        vol->scanner = scan_pool_init(fat_fuse_scan_threads,
+                                      FAT_FUSE_SCAN_QUEUE_BYTES);
+        if (vol->scanner == NULL) {
+            DEBUG("Unable to start the scanners: %s", strerror(errno));
         }
     }
-    return (s1);
 }
 
-/* Creates the string with the message that will be logged into fs.log
- * The returned pointer is owned by the caller, and must be freed.
- *
- * In case of memory allocation error NULL is returned.
+/* Write the pending records of the log before the volume is unmounted */
+static void fat_fuse_destroy(void *userdata) {
+    fat_volume vol = userdata;
+    if (vol->scanner != NULL) {
+        // Log the scans still queued, and free their handles
+        scan_pool_destroy(vol->scanner);
+        vol->scanner = NULL;
+    }
+    if (vol->logger != NULL) {
+        fat_logger_destroy(vol->logger);
+        vol->logger = NULL;
+    }
+}
+
+/* Logs that the user @uid did @op on @bytes bytes of @file, finding @words
+ * of the censored words of @words_version in them
  */
-static char *fat_fuse_log_create_string(const char *log_text,
-                                        fat_file target_file, GSList *words) {
-    char *text = now_to_str();
-    text = str_concat(text, "\t");
-
-    char *user_name = getlogin();
-    if (user_name != NULL) {
-        text = str_concat(text, user_name);
+static void fat_fuse_log_activity(fat_volume vol, uid_t uid, fat_log_op op,
+                                  fat_file file, size_t bytes, u32 words,
+                                  u32 words_version) {
+    if (vol->logger == NULL) {
+        return;
+    }
+    if (is_log_file(file)) {
+        words = 0;
+    }
+    fat_logger_log(vol->logger, uid, op, file, bytes, words, words_version);
+}
+
+/* Look up the file @name in the directory with inode @parent_ino */
+static void fat_fuse_lookup(fuse_req_t req, fuse_ino_t parent_ino,
+                            const char *name) {
+    fat_volume vol = fuse_req_userdata(req);
+    char path[MAX_PATH_LEN];
+    fat_tree_node parent_node = NULL, file_node = NULL;
+    bool missing = false;
+
+    epoch_enter(vol->reclaim);
+    parent_node = fat_fuse_resolve_child(vol, parent_ino, name, path);
+    if (parent_node == NULL) {
+        missing = true;
+    } else if (fat_negative_cache_lookup(vol->negative_cache,
+                                         fat_tree_get_file(parent_node),
+                                         name)) {
+        errno = ENOENT;
+        missing = true;
     } else {
-        DEBUG("Unable to get user name\n");
-        text = str_concat(text, "\t");
+        file_node = fat_fuse_lockless_lookup(vol, parent_node, path);
+    }
+    epoch_exit(vol->reclaim);
+
+    if (file_node == NULL && !missing) {
+        // Not found, or the tree was being modified. The kernel doesn't
+        // remove a name while it's being looked up, so only evictions can
+        // race with this.
+        file_node = fat_fuse_rdlock_search(vol, path);
+        fat_tree_inc_num_times_opened(fat_tree_get_parent_node(file_node));
+        pthread_rwlock_unlock(&vol->tree_lock);
+    }
+    if (file_node == NULL) {
+        fuse_reply_err(req, errno);
+        return;
     }
-    text = str_concat(text, "\t");
+    fat_fuse_reply_entry(req, vol, file_node);
+}
 
-    text = str_concat(text, log_text);
-    text = str_concat(text, "\t");
+/* The kernel dropped @nlookup references to the file with inode @ino */
+static void fat_fuse_forget(fuse_req_t req, fuse_ino_t ino,
+                            uint64_t nlookup) {
+    fat_fuse_unref(fuse_req_userdata(req), ino, nlookup);
+    fuse_reply_none(req);
+}
 
-    text = str_concat(text, target_file->filepath);
-    text = str_concat(text, "\t");
+/* Get file attributes */
+static void fat_fuse_getattr(fuse_req_t req, fuse_ino_t ino,
+                             struct fuse_file_info *fi) {
+    fat_volume vol = fuse_req_userdata(req);
+    struct stat stbuf;
 
-    if (words != NULL && !is_fs_log(target_file)) {
-        DEBUG("Censored words found in %s", target_file->filepath);
-        text = str_concat(text, "[");
-        while (words != NULL) {
-            text = str_concat(text, words->data);
-            words = words->next;
-            if (words != NULL) {
-                text = str_concat(text, ", ");
+    epoch_enter(vol->reclaim);
+    fat_tree_node file_node = fat_volume_inode_get(vol, ino);
+    if (file_node == NULL) {
+        epoch_exit(vol->reclaim);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    fat_file file = fat_tree_get_file(file_node);
+    pthread_rwlock_t *file_lock = fat_volume_file_lock(vol, file);
+    pthread_rwlock_rdlock(file_lock);
+    fat_file_to_stbuf(file, &stbuf);
+    pthread_rwlock_unlock(file_lock);
+    epoch_exit(vol->reclaim);
+    fuse_reply_attr(req, &stbuf, fat_fuse_timeout());
+}
+
+/* Changes the size of a file, or its access and modification times. The
+ * other attributes can't be changed.
+ */
+static void fat_fuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                             int to_set, struct fuse_file_info *fi) {
+    fat_volume vol = fuse_req_userdata(req);
+    int set_times = to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME);
+    struct stat stbuf;
+    struct utimbuf times;
+
+    if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+    errno = 0;
+    pthread_rwlock_rdlock(&vol->tree_lock);
+    fat_tree_node file_node = fat_volume_inode_get(vol, ino);
+    if (file_node == NULL) {
+        pthread_rwlock_unlock(&vol->tree_lock);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    fat_file file = fat_tree_get_file(file_node);
+    fat_file parent = fat_tree_get_parent(file_node);
+    if ((to_set & FUSE_SET_ATTR_SIZE) && fat_file_is_directory(file)) {
+        errno = EISDIR;
+    } else if ((to_set & FUSE_SET_ATTR_SIZE) && is_log_file(file)) {
+        errno = ENOENT;
+    }
+    if (errno == 0) {
+        pthread_rwlock_t *file_lock = fat_volume_file_lock(vol, file);
+        pthread_rwlock_wrlock(file_lock);
+        if ((to_set & FUSE_SET_ATTR_SIZE) &&
+            attr->st_size > file->dentry.file_size) {
+            fat_file_extend(file, attr->st_size, parent);
+        } else if (to_set & FUSE_SET_ATTR_SIZE) {
+            fat_file_truncate(file, attr->st_size, parent);
+        }
+        if (set_times && parent == NULL) {
+            DEBUG("WARNING: Setting time for parent ignored");
+        } else if (set_times && errno == 0) {
+            fat_file_to_stbuf(file, &stbuf);
+            times.actime = (to_set & FUSE_SET_ATTR_ATIME) ? attr->st_atime
+                                                          : stbuf.st_atime;
+            times.modtime = (to_set & FUSE_SET_ATTR_MTIME) ? attr->st_mtime
+                                                           : stbuf.st_mtime;
+            if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+                times.actime = time(NULL);
             }
+            if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+                times.modtime = time(NULL);
+            }
+            fat_utime(file, parent, &times);
         }
-        text = str_concat(text, "]");
+        fat_file_to_stbuf(file, &stbuf);
+        pthread_rwlock_unlock(file_lock);
     }
-
-    text = str_concat(text, "\n");
-
-    return (text);
+    pthread_rwlock_unlock(&vol->tree_lock);
+    if (errno != 0) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    fuse_reply_attr(req, &stbuf, fat_fuse_timeout());
 }
 
-/* Makes a call to fat_fuse_log_create_string to receive
- * the message to be logged into fs.log and logs it using
- * fat_fuse_log_write.
+/* Finds the file with inode @ino and marks it and its ancestors as opened,
+ * so they can't be evicted. Returns NULL and sets errno if it's not known, or
+ * it's not a directory when @is_dir is true (or the other way round).
  */
-static void fat_fuse_log_activity(const char *log_text, fat_file target_file,
-                                  GSList *words) {
-    int starting_errno = errno;
-    errno = 0; // We want to log, without taking into account previous errors
-    char *text = fat_fuse_log_create_string(log_text, target_file, words);
-
-    if (text != NULL) {
-        errno = 0;
-        /* fat_fuse_log_create_string may have changed errno but we want to log
-           the message anyway */
-
-        fat_fuse_log_write(text);
-        free(text);
+static fat_tree_node fat_fuse_open_inode(fat_volume vol, fuse_ino_t ino,
+                                         bool is_dir) {
+    // Writers can't remove it while the lock is held
+    pthread_rwlock_rdlock(&vol->tree_lock);
+    fat_tree_node file_node = fat_volume_inode_get(vol, ino);
+    if (file_node == NULL) {
+        errno = ENOENT;
+    } else if (fat_file_is_directory(fat_tree_get_file(file_node)) != is_dir) {
+        errno = is_dir ? ENOTDIR : EISDIR;
+        file_node = NULL;
+    } else {
+        fat_tree_inc_num_times_opened(file_node);
     }
-
-    errno = starting_errno;
+    pthread_rwlock_unlock(&vol->tree_lock);
+    return file_node;
 }
 
-/* Get file attributes (file descriptor version) */
-static int fat_fuse_fgetattr(const char *path, struct stat *stbuf,
-                             struct fuse_file_info *fi) {
-    fat_file file = (fat_file)fat_tree_get_file((fat_tree_node)fi->fh);
-    fat_file_to_stbuf(file, stbuf);
-    return 0;
+/* Open a file */
+static void fat_fuse_open(fuse_req_t req, fuse_ino_t ino,
+                          struct fuse_file_info *fi) {
+    fat_tree_node file_node =
+        fat_fuse_open_inode(fuse_req_userdata(req), ino, false);
+    if (file_node == NULL) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    fat_fuse_handle handle = calloc(1, sizeof(struct fat_fuse_handle_s));
+    if (handle == NULL) {
+        fat_tree_dec_num_times_opened(file_node);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    handle->node = file_node;
+    handle->uid = fuse_req_ctx(req)->uid;
+    pthread_mutex_init(&handle->lock, NULL);
+    fi->fh = (uintptr_t)handle;
+    if (is_log_file(fat_tree_get_file(file_node))) {
+        // This daemon appends to it, the kernel can't cache its data
+        fi->direct_io = 1;
+        handle->direct_io = true;
+        // Show what was done before opening it
+        fat_volume vol = fuse_req_userdata(req);
+        if (vol->scanner != NULL) {
+            scan_pool_sync(vol->scanner);
+        }
+        if (vol->logger != NULL) {
+            fat_logger_sync(vol->logger);
+        }
+    } else {
+        // Keep the cached data from previous opens
+        fi->keep_cache = fat_fuse_kernel_cache;
+    }
+    if (fuse_reply_open(req, fi) != 0) {
+        // Interrupted, there will be no release
+        pthread_mutex_destroy(&handle->lock);
+        free(handle);
+        fat_tree_dec_num_times_opened(file_node);
+    }
 }
 
-/* Get file attributes (path version) */
-static int fat_fuse_getattr(const char *path, struct stat *stbuf) {
-    fat_volume vol;
-    fat_file file;
+/* Looks for the censored words in the data of @scan, and logs the request
+ * with them. The scan goes on from the end of the previous request of the
+ * same kind through the handle if this one starts there, so a word split
+ * between them is found in this one.
+ */
+static void fat_fuse_scan(fat_volume vol, const struct fat_fuse_scan_s *scan) {
+    fat_fuse_handle handle = scan->handle;
+    struct fat_fuse_stream_s *stream = &handle->streams[scan->op];
+    // The words can't be released until the record that names them is logged
+    epoch_enter(vol->reclaim);
+    pthread_mutex_lock(&handle->lock);
+    if (scan->offset != stream->end) {
+        stream->scan.state = WORD_MATCHER_START; // Starts a new stream
+    }
+    u32 words = censored_words_found_clusters(
+        &stream->scan, scan->buf, scan->size, scan->reads, scan->num_reads,
+        fat_table_bytes_per_cluster(vol->table));
+    u32 words_version = stream->scan.version;
+    stream->end = scan->offset + scan->size;
+    pthread_mutex_unlock(&handle->lock);
+    fat_fuse_log_activity(vol, scan->uid, scan->op,
+                          fat_tree_get_file(handle->node), scan->size, words,
+                          words_version);
+    epoch_exit(vol->reclaim);
+}
 
-    vol = get_fat_volume();
-    file = fat_tree_search(vol->file_tree, path);
-    if (file == NULL) {
-        errno = ENOENT;
-        return -errno;
+static void fat_fuse_scan_job_run(struct scan_pool_job_s *job) {
+    struct fat_fuse_scan_job_s *scan_job =
+        container_of(job, struct fat_fuse_scan_job_s, job);
+    fat_fuse_scan(scan_job->vol, &scan_job->scan);
+    if (scan_job->owned) {
+        free((char *)scan_job->scan.buf);
+        free(scan_job->scan.reads);
     }
-    fat_file_to_stbuf(file, stbuf);
-    return 0;
+    free(scan_job);
 }
 
-/* Open a file */
-static int fat_fuse_open(const char *path, struct fuse_file_info *fi) {
-    fat_volume vol;
-    fat_tree_node file_node;
-    fat_file file;
+/* Queues @scan in vol->scanner, to run after the ones queued before through
+ * its handle, in the same thread. If @owned, its buffer and clusters are
+ * freed once it's done, otherwise the buffer is copied.
+ * Returns true if they were taken.
+ */
+static bool fat_fuse_scan_async(fat_volume vol,
+                                const struct fat_fuse_scan_s *scan,
+                                bool owned) {
+    struct fat_fuse_scan_job_s *scan_job = malloc(
+        sizeof(struct fat_fuse_scan_job_s) + (owned ? 0 : scan->size));
+    if (scan_job == NULL) {
+        // Here, after the scans queued before
+        scan_pool_sync(vol->scanner);
+        fat_fuse_scan(vol, scan);
+        return false;
+    }
+    scan_job->job.fn = fat_fuse_scan_job_run;
+    scan_job->job.bytes = scan->size;
+    scan_job->vol = vol;
+    scan_job->scan = *scan;
+    scan_job->owned = owned;
+    if (!owned) {
+        scan_job->scan.buf = memcpy(scan_job->data, scan->buf, scan->size);
+        scan_job->scan.reads = NULL;
+        scan_job->scan.num_reads = 0;
+    }
+    scan_pool_submit(vol->scanner, (uintptr_t)scan->handle, &scan_job->job);
+    return owned;
+}
 
-    vol = get_fat_volume();
-    file_node = fat_tree_node_search(vol->file_tree, path);
-    if (!file_node)
-        return -errno;
-    file = fat_tree_get_file(file_node);
-    if (fat_file_is_directory(file))
-        return -EISDIR;
-    fat_tree_inc_num_times_opened(file_node);
-    fi->fh = (uintptr_t)file_node;
-    return 0;
+void fat_fuse_reload_words(fat_volume vol) {
+    censored_words_list old = censored_words_reload();
+    if (old == NULL) {
+        fat_error("Unable to reload the censored words: %m");
+        return;
+    }
+    // The records of the old words name them when they are written
+    if (vol->logger != NULL) {
+        fat_logger_sync(vol->logger);
+    }
+    censored_words_release(old);
 }
 
 /* Open a directory */
-static int fat_fuse_opendir(const char *path, struct fuse_file_info *fi) {
-    fat_volume vol = NULL;
-    fat_tree_node file_node = NULL;
-    fat_file file = NULL;
-
-    vol = get_fat_volume();
-    file_node = fat_tree_node_search(vol->file_tree, path);
+static void fat_fuse_opendir(fuse_req_t req, fuse_ino_t ino,
+                             struct fuse_file_info *fi) {
+    fat_volume vol = fuse_req_userdata(req);
+    fat_tree_node file_node = fat_fuse_open_inode(vol, ino, true);
     if (file_node == NULL) {
-        return -errno;
-    }
-    file = fat_tree_get_file(file_node);
-    if (!fat_file_is_directory(file)) {
-        return -ENOTDIR;
+        fuse_reply_err(req, errno);
+        return;
     }
-    fat_tree_inc_num_times_opened(file_node);
+    fat_volume_touch_dir(vol, file_node);
     fi->fh = (uintptr_t)file_node;
-    return 0;
+    if (fuse_reply_open(req, fi) != 0) {
+        // Interrupted, there will be no releasedir
+        fat_tree_dec_num_times_opened(file_node);
+    }
 }
 
-/* Read directory children */
-static void fat_fuse_read_children(fat_tree_node dir_node) {
-    fat_volume vol = get_fat_volume();
+/* Read directory children, and evict the ones of other directories if there
+ * are too many files in the tree. The tree lock must be held for writing.
+ */
+static void fat_fuse_read_children(fat_volume vol, fat_tree_node dir_node) {
     fat_file dir = fat_tree_get_file(dir_node);
     GList *children_list = fat_file_read_children(dir);
-    // Add child to tree. TODO handle duplicates
     for (GList *l = children_list; l != NULL; l = l->next) {
+        errno = 0;
         vol->file_tree =
             fat_tree_insert(vol->file_tree, dir_node, (fat_file)l->data);
+        if (errno == EEXIST) {
+            // Created or looked up before the directory was read, the file
+            // in the tree may be open and is kept
+            fat_file_destroy((fat_file)l->data);
+        }
     }
     g_list_free(children_list);
+    fat_volume_add_dir(vol, dir_node);
+    // The caller is about to use the children just read, and the directories
+    // above them. Pinned like an open directory, they can't be evicted.
+    fat_tree_inc_num_times_opened(dir_node);
+    fat_volume_evict(vol);
+    fat_tree_dec_num_times_opened(dir_node);
 }
 
-/* Add entries of a directory in @fi to @buf using @filler function. */
-static int fat_fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                            off_t offset, struct fuse_file_info *fi) {
+/* Offsets of the entries in readdir, they are the offset of the entry that
+ * follows. The offset after a child is READDIR_CHILD_OFF of its
+ * pos_in_parent, and as children are sorted by decreasing position, the
+ * listing resumes with the first child that has a smaller one. Positions
+ * don't change while a file exists, so the offset is still valid if other
+ * children are created or deleted between calls.
+ */
+#define READDIR_DOTDOT_OFF 1
+#define READDIR_CHILDREN_OFF 2
+#define READDIR_CHILD_OFF(pos) ((off_t)(pos) + READDIR_CHILDREN_OFF + 1)
+
+/* Adds the entry @name of @file to @buf, that has @size bytes of which *@len
+ * are used, and updates *@len. With @plus, the entry has all the attributes
+ * of the file. Returns false if the entry doesn't fit.
+ */
+static bool fat_fuse_add_direntry(fuse_req_t req, char *buf, size_t size,
+                                  size_t *len, const char *name,
+                                  fat_file file, off_t next_offset,
+                                  bool plus) {
+    fat_volume vol = fuse_req_userdata(req);
+    struct fuse_entry_param entry;
+    size_t entry_len = 0;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.ino = fat_file_inode(file);
+    entry.generation = fat_volume_inode_generation(vol, entry.ino);
+    if (plus) {
+        pthread_rwlock_t *file_lock = fat_volume_file_lock(vol, file);
+        pthread_rwlock_rdlock(file_lock);
+        fat_file_to_stbuf(file, &entry.attr);
+        pthread_rwlock_unlock(file_lock);
+        entry.attr_timeout = fat_fuse_timeout();
+        entry.entry_timeout = fat_fuse_timeout();
+        entry_len = fuse_add_direntry_plus(req, buf + *len, size - *len, name,
+                                           &entry, next_offset);
+    } else {
+        // Only the inode and the type are used
+        entry.attr.st_ino = entry.ino;
+        entry.attr.st_mode = fat_file_is_directory(file) ? S_IFDIR : S_IFREG;
+        entry_len = fuse_add_direntry(req, buf + *len, size - *len, name,
+                                      &entry.attr, next_offset);
+    }
+    if (entry_len > size - *len) {
+        return false;
+    }
+    *len += entry_len;
+    return true;
+}
+
+/* Reply with the entries of the directory in @fi that fit in @size bytes,
+ * starting from @offset. With @plus, they have the attributes of the files,
+ * and each one but . and .. is a new reference of the kernel.
+ */
+static void fat_fuse_list_dir(fuse_req_t req, size_t size, off_t offset,
+                              struct fuse_file_info *fi, bool plus) {
     errno = 0;
+    fat_volume vol = fuse_req_userdata(req);
     fat_tree_node dir_node = (fat_tree_node)fi->fh;
+    fat_tree_node child_node = NULL;
     fat_file dir = fat_tree_get_file(dir_node);
-    fat_file *children = NULL, *child = NULL;
-    int error = 0;
+    fat_file dir_parent = fat_tree_get_parent(dir_node);
+    fat_file child = NULL;
+    size_t len = 0;
 
+    if (!fat_file_is_directory(dir)) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
     // Insert first two filenames (. and ..)
-    if ((*filler)(buf, ".", NULL, 0) || (*filler)(buf, "..", NULL, 0)) {
-        return -errno;
+    if (offset < READDIR_DOTDOT_OFF &&
+        !fat_fuse_add_direntry(req, buf, size, &len, ".", dir,
+                               READDIR_DOTDOT_OFF, plus)) {
+        goto reply;
     }
-    if (!fat_file_is_directory(dir)) {
-        errno = ENOTDIR;
-        return -errno;
+    if (offset < READDIR_CHILDREN_OFF &&
+        !fat_fuse_add_direntry(req, buf, size, &len, "..",
+                               dir_parent != NULL ? dir_parent : dir,
+                               READDIR_CHILDREN_OFF, plus)) {
+        goto reply;
     }
+    pthread_rwlock_rdlock(&vol->tree_lock);
     if (dir->children_read != 1) {
-        fat_fuse_read_children(dir_node);
-        if (errno < 0) {
-            return -errno;
+        pthread_rwlock_unlock(&vol->tree_lock);
+        pthread_rwlock_wrlock(&vol->tree_lock);
+        // Other thread may have read them while the lock was released
+        if (dir->children_read != 1) {
+            fat_fuse_read_children(vol, dir_node);
+            if (errno != 0) {
+                pthread_rwlock_unlock(&vol->tree_lock);
+                free(buf);
+                fuse_reply_err(req, errno);
+                return;
+            }
         }
     }
 
-    children = fat_tree_flatten_h_children(dir_node);
-    child = children;
-    while (*child != NULL) {
+    child_node = fat_tree_first_child(dir_node);
+    if (offset > READDIR_CHILDREN_OFF) {
+        // Skip the children listed in previous calls
+        u32 resume_pos = offset - READDIR_CHILD_OFF(0);
+        while (child_node != NULL &&
+               fat_tree_get_file(child_node)->pos_in_parent >= resume_pos) {
+            child_node = fat_tree_next_sibling(child_node);
+        }
+    }
+    for (; child_node != NULL; child_node = fat_tree_next_sibling(child_node)) {
+        child = fat_tree_get_file(child_node);
         // Hide fs.log from ls
-        if (!log_hide || !is_fs_log(*child)) {
-            error = (*filler)(buf, (*child)->name, NULL, 0);
-            if (error != 0) {
-                free(children);
-                children = NULL;
-                return -errno;
-            }
+        if (log_hide && is_log_file(child)) {
+            continue;
+        }
+        if (!fat_fuse_add_direntry(req, buf, size, &len, child->name, child,
+                                   READDIR_CHILD_OFF(child->pos_in_parent),
+                                   plus)) {
+            break;
+        }
+        if (plus) {
+            fat_tree_inc_num_times_opened(dir_node);
+            fat_volume_inode_ref(vol, child_node);
         }
-        child++;
     }
-    free(children);
-    children = NULL;
+    pthread_rwlock_unlock(&vol->tree_lock);
+
+reply:
+    fuse_reply_buf(req, buf, len);
+    free(buf);
+}
 
-    /* FUSE guarantees that fat_fuse_readdir will be called after mounting
-       so we init the log file */
-    fat_fuse_log_init();
-    return 0;
+static void fat_fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                             off_t offset, struct fuse_file_info *fi) {
+    fat_fuse_list_dir(req, size, offset, fi, false);
+}
+
+static void fat_fuse_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+                                 off_t offset, struct fuse_file_info *fi) {
+    fat_fuse_list_dir(req, size, offset, fi, true);
 }
 
 /* Read data from a file */
-static int fat_fuse_read(const char *path, char *buf, size_t size, off_t offset,
-                         struct fuse_file_info *fi) {
+static void fat_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+                          off_t offset, struct fuse_file_info *fi) {
     errno = 0;
-    int bytes_read;
-    fat_tree_node file_node = (fat_tree_node)fi->fh;
+    fat_volume vol = fuse_req_userdata(req);
+    ssize_t bytes_read;
+    fat_fuse_handle handle = (fat_fuse_handle)fi->fh;
+    fat_tree_node file_node = handle->node;
     fat_file file = fat_tree_get_file(file_node);
     fat_file parent = fat_tree_get_parent(file_node);
 
-    if (is_fs_log(file) && log_hide) {
-        errno = ENOENT;
-        return -errno;
+    if (is_log_file(file) && log_hide) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
     }
 
-    bytes_read = fat_file_pread(file, buf, size, offset, parent);
+    // Clusters read whole, whose censored words can be remembered. Without
+    // them the read is scanned whole.
+    size_t max_reads = size / fat_table_bytes_per_cluster(vol->table);
+    struct fat_cluster_read_s *reads =
+        max_reads != 0 ? malloc(max_reads * sizeof(*reads)) : NULL;
+    size_t num_reads = 0;
+
+    // Reading also updates the access date in the entry of the file
+    pthread_rwlock_t *file_lock = fat_volume_file_lock(vol, file);
+    pthread_rwlock_wrlock(file_lock);
+    bytes_read = fat_file_pread_clusters(file, buf, size, offset, parent,
+                                         reads, &num_reads);
+    pthread_rwlock_unlock(file_lock);
     if (errno != 0) {
-        return -errno;
+        free(reads);
+        free(buf);
+        fuse_reply_err(req, errno);
+        return;
     }
 
-    GSList *censored_words = censored_words_found(buf, size);
-    fat_fuse_log_activity("read", file, censored_words);
-    g_slist_free(censored_words);
-
-    return bytes_read;
+    struct fat_fuse_scan_s scan = {
+        .handle = handle,
+        .uid = fuse_req_ctx(req)->uid,
+        .op = FAT_LOG_READ,
+        .offset = offset,
+        .buf = buf,
+        .size = bytes_read,
+        .reads = reads,
+        .num_reads = num_reads,
+    };
+    if (vol->scanner == NULL) {
+        fat_fuse_scan(vol, &scan);
+    }
+    fuse_reply_buf(req, buf, bytes_read);
+    // The scanners take the buffer once it's replied
+    if (vol->scanner == NULL || !fat_fuse_scan_async(vol, &scan, true)) {
+        free(reads);
+        free(buf);
+    }
 }
 
 /* Write data from a file */
-static int fat_fuse_write(const char *path, const char *buf, size_t size,
-                          off_t offset, struct fuse_file_info *fi) {
-    fat_tree_node file_node = (fat_tree_node)fi->fh;
+static void fat_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+                           size_t size, off_t offset,
+                           struct fuse_file_info *fi) {
+    errno = 0;
+    fat_volume vol = fuse_req_userdata(req);
+    fat_fuse_handle handle = (fat_fuse_handle)fi->fh;
+    fat_tree_node file_node = handle->node;
     fat_file file = fat_tree_get_file(file_node);
     fat_file parent = fat_tree_get_parent(file_node);
 
-    if (is_fs_log(file) && log_hide) {
-        errno = ENOENT;
-        return -errno;
+    if (is_log_file(file) && log_hide) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    if (size == 0) {
+        fuse_reply_write(req, 0); // Nothing to write
+        return;
     }
 
-    if (size == 0)
-        return 0; // Nothing to write
-    if (offset > file->dentry->file_size)
-        return -EOVERFLOW;
+    struct fat_fuse_scan_s scan = {
+        .handle = handle,
+        .uid = handle->direct_io ? fuse_req_ctx(req)->uid : handle->uid,
+        .op = FAT_LOG_WRITE,
+        .offset = offset,
+        .buf = buf,
+        .size = size,
+    };
+    if (vol->scanner == NULL) {
+        fat_fuse_scan(vol, &scan);
+    } else {
+        fat_fuse_scan_async(vol, &scan, false);
+    }
+
+    pthread_rwlock_t *file_lock = fat_volume_file_lock(vol, file);
+    pthread_rwlock_wrlock(file_lock);
+    ssize_t bytes_written = 0;
+    if (offset > file->dentry.file_size) {
+        // The kernel flushed its cache out of order, or the file has a hole
+        fat_file_extend(file, offset, parent);
+    }
+    if (errno == 0) {
+        bytes_written = fat_file_pwrite(file, buf, size, offset, parent);
+    }
+    pthread_rwlock_unlock(file_lock);
+    if (bytes_written == 0 && errno != 0) {
+        fuse_reply_err(req, errno);
+        return;
+    }
+    fuse_reply_write(req, bytes_written);
+}
 
-    GSList *censored_words = censored_words_found(buf, size);
-    fat_fuse_log_activity("write", file, censored_words);
-    g_slist_free(censored_words);
+/* Frees @handle, and lets its file be evicted */
+static void fat_fuse_handle_free(fat_fuse_handle handle) {
+    fat_tree_dec_num_times_opened(handle->node);
+    pthread_mutex_destroy(&handle->lock);
+    free(handle);
+}
 
-    return fat_file_pwrite(file, buf, size, offset, parent);
+static void fat_fuse_release_job_run(struct scan_pool_job_s *job) {
+    struct fat_fuse_scan_job_s *scan =
+        container_of(job, struct fat_fuse_scan_job_s, job);
+    fat_fuse_handle_free(scan->scan.handle);
+    free(scan);
 }
 
 /* Close a file */
-static int fat_fuse_release(const char *path, struct fuse_file_info *fi) {
-    fat_tree_node file = (fat_tree_node)fi->fh;
-    fat_tree_dec_num_times_opened(file);
-    return 0;
+static void fat_fuse_release(fuse_req_t req, fuse_ino_t ino,
+                             struct fuse_file_info *fi) {
+    fat_volume vol = fuse_req_userdata(req);
+    fat_fuse_handle handle = (fat_fuse_handle)fi->fh;
+    // Every request reported the words it completed, a word still open at
+    // the end of a stream was never written or read whole
+    if (vol->scanner != NULL) {
+        // The scans still queued use the handle and the path of the file
+        struct fat_fuse_scan_job_s *release =
+            calloc(1, sizeof(struct fat_fuse_scan_job_s));
+        if (release != NULL) {
+            release->job.fn = fat_fuse_release_job_run;
+            release->scan.handle = handle;
+            scan_pool_submit(vol->scanner, (uintptr_t)handle, &release->job);
+            fuse_reply_err(req, 0);
+            return;
+        }
+        scan_pool_sync(vol->scanner);
+    }
+    fat_fuse_handle_free(handle);
+    fuse_reply_err(req, 0);
 }
 
 /* Close a directory */
-static int fat_fuse_releasedir(const char *path, struct fuse_file_info *fi) {
+static void fat_fuse_releasedir(fuse_req_t req, fuse_ino_t ino,
+                                struct fuse_file_info *fi) {
     fat_tree_node file = (fat_tree_node)fi->fh;
     fat_tree_dec_num_times_opened(file);
-    return 0;
+    fuse_reply_err(req, 0);
 }
 
-static int fat_fuse_mkdir(const char *path, mode_t mode) {
+/* Creates a new file or directory in @path, in the tree and in the disk.
+ * The tree lock must be held for writing.
+ */
+static int fat_fuse_create(fat_volume vol, const char *path, bool is_dir) {
     errno = 0;
-    fat_volume vol = NULL;
     fat_file parent = NULL, new_file = NULL;
     fat_tree_node parent_node = NULL;
 
     // The system has already checked the path does not exist. We get the parent
-    vol = get_fat_volume();
     char *copy_path = strdup(path);
-    parent_node = fat_tree_node_search(vol->file_tree, dirname(copy_path));
+    parent_node = fat_fuse_node_search(vol, dirname(copy_path));
     free(copy_path);
     copy_path = NULL;
     if (parent_node == NULL) {
@@ -442,10 +1106,12 @@ static int fat_fuse_mkdir(const char *path, mode_t mode) {
     }
 
     // init child
-    new_file = fat_file_init(vol->table, true, strdup(path));
+    new_file = fat_file_init(vol->table, parent, is_dir, path);
     if (errno != 0) {
         return -errno;
     }
+    // Names that were missing in the parent may be this one
+    fat_file_dir_changed(parent);
     // insert to directory tree representation
     vol->file_tree = fat_tree_insert(vol->file_tree, parent_node, new_file);
     // write file in parent's entry (disk)
@@ -453,114 +1119,97 @@ static int fat_fuse_mkdir(const char *path, mode_t mode) {
     return -errno;
 }
 
-/* Creates a new file in @path. @mode and @dev are ignored. */
-static int fat_fuse_mknod(const char *path, mode_t mode, dev_t dev) {
-    errno = 0;
-    fat_volume vol;
-    fat_file parent, new_file;
-    fat_tree_node parent_node;
-
-    // The system has already checked the path does not exist. We get the parent
-    vol = get_fat_volume();
-    char *copy_path = strdup(path);
-    parent_node = fat_tree_node_search(vol->file_tree, dirname(copy_path));
-    free(copy_path);
-    copy_path = NULL;
-    if (parent_node == NULL) {
-        errno = ENOENT;
-        return -errno;
-    }
-    parent = fat_tree_get_file(parent_node);
-    if (!fat_file_is_directory(parent)) {
-        fat_error("Error! Parent is not directory\n");
-        errno = ENOTDIR;
-        return -errno;
+/* Creates @name in the directory with inode @parent_ino, and replies with
+ * its entry.
+ */
+static void fat_fuse_create_entry(fuse_req_t req, fuse_ino_t parent_ino,
+                                  const char *name, bool is_dir) {
+    fat_volume vol = fuse_req_userdata(req);
+    char path[MAX_PATH_LEN];
+    fat_tree_node file_node = NULL;
+    int ret = 0;
+
+    pthread_rwlock_wrlock(&vol->tree_lock);
+    fat_tree_node parent_node =
+        fat_fuse_resolve_child(vol, parent_ino, name, path);
+    ret = parent_node == NULL ? -errno : fat_fuse_create(vol, path, is_dir);
+    if (ret == 0) {
+        file_node = fat_tree_node_search(vol->file_tree, path);
+        fat_tree_inc_num_times_opened(parent_node);
     }
-    new_file = fat_file_init(vol->table, false, strdup(path));
-    if (errno < 0) {
-        return -errno;
+    pthread_rwlock_unlock(&vol->tree_lock);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
     }
-    // insert to directory tree representation
-    vol->file_tree = fat_tree_insert(vol->file_tree, parent_node, new_file);
-    // Write dentry in parent cluster
-    fat_file_dentry_add_child(parent, new_file);
-    return -errno;
+    fat_fuse_reply_entry(req, vol, file_node);
 }
 
-static int fat_fuse_utime(const char *path, struct utimbuf *buf) {
-    errno = 0;
-    fat_file parent = NULL;
-    fat_volume vol = get_fat_volume();
-    fat_tree_node file_node = fat_tree_node_search(vol->file_tree, path);
-    if (file_node == NULL || errno != 0) {
-        errno = ENOENT;
-        return -errno;
-    }
-    parent = fat_tree_get_parent(file_node);
-    if (parent == NULL || errno != 0) {
-        DEBUG("WARNING: Setting time for parent ignored");
-        return 0; // We do nothing, no utime for parent
-    }
-    fat_utime(fat_tree_get_file(file_node), parent, buf);
-    return -errno;
+static void fat_fuse_mkdir(fuse_req_t req, fuse_ino_t parent_ino,
+                           const char *name, mode_t mode) {
+    fat_fuse_create_entry(req, parent_ino, name, true);
 }
 
-/* Shortens the file at the given offset.*/
-int fat_fuse_truncate(const char *path, off_t offset) {
-    errno = 0;
-    fat_volume vol = get_fat_volume();
-    fat_file file = NULL, parent = NULL;
-    fat_tree_node file_node = fat_tree_node_search(vol->file_tree, path);
-
-    if (file_node == NULL || errno != 0) {
-        errno = ENOENT;
-        return -errno;
-    }
-    file = fat_tree_get_file(file_node);
-    if (fat_file_is_directory(file))
-        return -EISDIR;
-
-    if (is_fs_log(file)) {
-        errno = ENOENT;
-        return -errno;
-    }
-
-    parent = fat_tree_get_parent(file_node);
-    fat_tree_inc_num_times_opened(file_node);
-    fat_file_truncate(file, offset, parent);
-    return -errno;
+/* Creates a new file called @name. @mode and @dev are ignored. */
+static void fat_fuse_mknod(fuse_req_t req, fuse_ino_t parent_ino,
+                           const char *name, mode_t mode, dev_t dev) {
+    fat_fuse_create_entry(req, parent_ino, name, false);
 }
 
-/* Deletes a file (Doesn't work on directories) */
-int fat_fuse_unlink(const char *path) {
+/* Deletes a file (Doesn't work on directories). Fails with EBUSY while the
+ * file is open, like in other systems with FAT volumes.
+ */
+static void fat_fuse_unlink(fuse_req_t req, fuse_ino_t parent_ino,
+                            const char *name) {
     errno = 0;
-    fat_volume vol = get_fat_volume();
-    fat_tree_node file_node = fat_tree_node_search(vol->file_tree, path);
-    if (file_node == NULL || errno != 0) {
-        errno = ENOENT;
-        return -errno;
+    fat_volume vol = fuse_req_userdata(req);
+    char path[MAX_PATH_LEN];
+    fat_tree_node file_node = NULL;
+    pthread_rwlock_wrlock(&vol->tree_lock);
+    if (fat_fuse_resolve_child(vol, parent_ino, name, path) != NULL) {
+        file_node = fat_fuse_node_search(vol, path);
+    }
+    if (file_node == NULL) {
+        pthread_rwlock_unlock(&vol->tree_lock);
+        fuse_reply_err(req, errno != 0 ? errno : ENOENT);
+        return;
     }
     fat_file file = fat_tree_get_file(file_node);
     if (fat_file_is_directory(file)) {
-        errno = EISDIR;
-        return -errno;
+        pthread_rwlock_unlock(&vol->tree_lock);
+        fuse_reply_err(req, EISDIR);
+        return;
     }
-    if (is_fs_log(file)) {
-        errno = ENOENT;
-        return -errno;
+    if (is_log_file(file)) {
+        pthread_rwlock_unlock(&vol->tree_lock);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    // The handles use the file until they are released, and files are opened
+    // with the tree lock held for reading, so the count can't change here
+    if (__atomic_load_n(&file->num_times_opened, __ATOMIC_SEQ_CST) != 0) {
+        pthread_rwlock_unlock(&vol->tree_lock);
+        fuse_reply_err(req, EBUSY);
+        return;
     }
 
     fat_file parent = fat_tree_get_parent(file_node);
+    // Wait for the reads and writes that are still using the file
+    pthread_rwlock_t *file_lock = fat_volume_file_lock(vol, file);
+    pthread_rwlock_wrlock(file_lock);
     fat_file_unlink(file, parent);
+    pthread_rwlock_unlock(file_lock);
+    fat_fuse_drop(vol, file_node);
     fat_tree_delete(vol->file_tree, path);
-    return -errno;
+    pthread_rwlock_unlock(&vol->tree_lock);
+    fuse_reply_err(req, errno);
 }
 
-/* Removes a directory if it is empty */
-static int fat_fuse_rmdir(const char *path) {
-    errno = 0;
-    fat_volume vol = get_fat_volume();
-    fat_tree_node file_node = fat_tree_node_search(vol->file_tree, path);
+/* Removes the directory in @path if it is empty and not open. The tree lock
+ * must be held for writing.
+ */
+static int fat_fuse_remove_dir(fat_volume vol, const char *path) {
+    fat_tree_node file_node = fat_fuse_node_search(vol, path);
     if (file_node == NULL || errno != 0) {
         errno = ENOENT;
         return -errno;
@@ -571,53 +1220,74 @@ static int fat_fuse_rmdir(const char *path) {
         return -errno;
     }
 
-    GList *children = fat_file_read_children(dir);
-    bool is_empty = g_list_length(children) == 0;
-    g_list_free(children);
+    if (dir->children_read != 1) {
+        fat_fuse_read_children(vol, file_node);
+        if (errno != 0) {
+            return -errno;
+        }
+    }
+    fat_file *children = fat_tree_flatten_h_children(file_node);
+    bool is_empty = children == NULL || children[0] == NULL;
+    free(children);
     if (!is_empty) {
         errno = ENOTEMPTY;
         return -errno;
     }
 
     fat_file parent = fat_tree_get_parent(file_node);
-    if (parent == NULL) {
+    // The root, or opened: the handles use the directory until they are
+    // released (it's empty, nothing else pins it)
+    if (parent == NULL ||
+        __atomic_load_n(&dir->num_times_opened, __ATOMIC_SEQ_CST) != 0) {
         errno = EBUSY;
         return -errno;
     }
 
     fat_file_unlink(dir, parent);
+    fat_volume_forget_dir(vol, file_node);
+    fat_fuse_drop(vol, file_node);
     fat_tree_delete(vol->file_tree, path);
     return -errno;
 }
 
+/* Removes a directory if it is empty */
+static void fat_fuse_rmdir(fuse_req_t req, fuse_ino_t parent_ino,
+                           const char *name) {
+    errno = 0;
+    fat_volume vol = fuse_req_userdata(req);
+    char path[MAX_PATH_LEN];
+    int ret = 0;
+    pthread_rwlock_wrlock(&vol->tree_lock);
+    if (fat_fuse_resolve_child(vol, parent_ino, name, path) == NULL) {
+        ret = -errno;
+    } else {
+        ret = fat_fuse_remove_dir(vol, path);
+    }
+    pthread_rwlock_unlock(&vol->tree_lock);
+    fuse_reply_err(req, -ret);
+}
+
 /* Filesystem operations for FUSE.  Only some of the possible operations are
  * implemented (the rest stay as NULL pointers and are interpreted as not
- * implemented by FUSE). */
-struct fuse_operations fat_fuse_operations = {
-    .fgetattr = fat_fuse_fgetattr,
+ * implemented by FUSE). Files are addressed by their inode number, see
+ * fat_file_inode. */
+struct fuse_lowlevel_ops fat_fuse_operations = {
+    .init = fat_fuse_init,
+    .destroy = fat_fuse_destroy,
+    .lookup = fat_fuse_lookup,
+    .forget = fat_fuse_forget,
     .getattr = fat_fuse_getattr,
-    .open = fat_fuse_open,
-    .opendir = fat_fuse_opendir,
-    .mkdir = fat_fuse_mkdir,
+    .setattr = fat_fuse_setattr,
     .mknod = fat_fuse_mknod,
-    .read = fat_fuse_read,
-    .readdir = fat_fuse_readdir,
-    .release = fat_fuse_release,
-    .releasedir = fat_fuse_releasedir,
-    .utime = fat_fuse_utime,
-    .truncate = fat_fuse_truncate,
+    .mkdir = fat_fuse_mkdir,
     .unlink = fat_fuse_unlink,
     .rmdir = fat_fuse_rmdir,
+    .open = fat_fuse_open,
+    .read = fat_fuse_read,
     .write = fat_fuse_write,
-
-/* We use `struct fat_file_s's as file handles, so we do not need to
- * require that the file path be passed to operations such as read() */
-#if FUSE_MAJOR_VERSION > 2 || \
-    (FUSE_MAJOR_VERSION == 2 && FUSE_MINOR_VERSION >= 8)
-    .flag_nullpath_ok = 1,
-#endif
-#if FUSE_MAJOR_VERSION > 2 || \
-    (FUSE_MAJOR_VERSION == 2 && FUSE_MINOR_VERSION >= 9)
-    .flag_nopath = 1,
-#endif
+    .release = fat_fuse_release,
+    .opendir = fat_fuse_opendir,
+    .readdir = fat_fuse_readdir,
+    .readdirplus = fat_fuse_readdirplus,
+    .releasedir = fat_fuse_releasedir,
 };
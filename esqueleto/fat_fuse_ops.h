@@ -1,6 +1,36 @@
-#include <fuse/fuse.h>
+#include "fat_volume.h"
+#include <fuse_lowlevel.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 extern bool log_hide;
 
-extern struct fuse_operations fat_fuse_operations;
+// The kernel keeps names, attributes and file data for long, as nothing else
+// writes the volume while it's mounted (see fat_fuse_notify_attr)
+extern bool fat_fuse_kernel_cache;
+
+// Seconds over which the activity of each user on each file is summed up in a
+// single line of the log, or 0 to log every read and write
+extern unsigned int fat_fuse_log_window;
+
+// Write fs.log with fixed size binary entries (see fat_log_format.h), to be
+// read with fat-logcat
+extern bool fat_fuse_log_binary;
+
+// Size of fs.log when it's rotated to the older generations, or 0 to let it
+// grow without limit
+extern off_t fat_fuse_log_max_size;
+
+// Threads that look for the censored words of reads and writes after they are
+// replied, or 0 to do it before replying
+extern unsigned int fat_fuse_scan_threads;
+
+extern struct fuse_session *fat_fuse_session;
+
+extern struct fuse_lowlevel_ops fat_fuse_operations;
+
+/* Reads the file of censored words again and uses them for the next reads and
+ * writes of @vol (see censored_words_reload). The old words are kept if it
+ * fails.
+ */
+void fat_fuse_reload_words(fat_volume vol);
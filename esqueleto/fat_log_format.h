@@ -0,0 +1,108 @@
+/*
+ * fat_log_format.h
+ *
+ * Layout of fs.log when it's written in binary (see FAT_LOGGER_BINARY).
+ *
+ * The log is a sequence of entries of FAT_LOG_ENTRY_SIZE bytes, in the byte
+ * order of the machine that wrote it:
+ *  - FAT_LOG_ENTRY_HEADER starts the log written by each mount, with
+ *    FAT_LOG_MAGIC in bytes. It forgets the paths defined before.
+ *  - FAT_LOG_ENTRY_PATH defines the path with number path_id. The path_len
+ *    bytes of the path follow the entry, padded with zeros to a multiple of
+ *    FAT_LOG_ENTRY_SIZE.
+ *  - FAT_LOG_ENTRY_WORD defines the censored word number path_id, like a path.
+ *    Word 0 starts a new list, the one that was in use when the next accesses
+ *    were logged.
+ *  - FAT_LOG_ENTRY_ACCESS is an operation, or a sum of count of them, of user
+ *    uid on the file path_id, with the censored words found as a bitmask of
+ *    indexes in the words defined before, or in censored_words if none was.
+ *
+ * Each log file, in text or in binary, has an index next to it (fs.idx for
+ * fs.log, fs1.idx for fs1.log...). For each batch of records written to the
+ * log, it has an entry for each file and hour (FAT_LOG_INDEX_BUCKET) with
+ * records in the batch, with the offset and length of the batch in the log.
+ * In binary logs the paths of a batch are defined before it, or in it, and
+ * the censored words of its accesses in it.
+ */
+
+#ifndef _FAT_LOG_FORMAT_H
+#define _FAT_LOG_FORMAT_H
+
+#include "fat_types.h"
+
+#define FAT_LOG_MAGIC 0x3142474f4c544146ULL // "FATLOGB1"
+
+typedef enum {
+    FAT_LOG_READ,
+    FAT_LOG_WRITE,
+} fat_log_op;
+
+/* Returns the name of @op in the text log */
+static inline const char *fat_log_op_name(fat_log_op op) {
+    return op == FAT_LOG_WRITE ? "write" : "read";
+}
+
+enum {
+    FAT_LOG_ENTRY_HEADER = 1,
+    FAT_LOG_ENTRY_PATH = 2,
+    FAT_LOG_ENTRY_ACCESS = 3,
+    FAT_LOG_ENTRY_WORD = 4,
+};
+
+// Flags of the entries
+#define FAT_LOG_AGGREGATED 0x1 // Written with an aggregation window
+
+struct fat_log_entry_s {
+    u64 time; // Seconds since the epoch
+    u64 bytes;
+    u32 uid;
+    u32 path_id;
+    u32 words;
+    u32 count;
+    u16 path_len;
+    u8 type;
+    u8 op; // fat_log_op
+    u8 flags;
+    u8 reserved[3];
+};
+
+#define FAT_LOG_ENTRY_SIZE 40
+
+_Static_assert(sizeof(struct fat_log_entry_s) == FAT_LOG_ENTRY_SIZE,
+               "fs.log entries must have a fixed size");
+
+#define FAT_LOG_INDEX_BUCKET 3600
+
+struct fat_log_index_entry_s {
+    u64 path_hash; // See fat_log_path_hash
+    u64 offset;
+    u32 length;
+    u32 bucket; // Time of the records divided by FAT_LOG_INDEX_BUCKET
+    u32 path_id; // Number of the path in the batch, for binary logs
+    u32 reserved;
+};
+
+#define FAT_LOG_INDEX_ENTRY_SIZE 32
+
+_Static_assert(sizeof(struct fat_log_index_entry_s) ==
+                   FAT_LOG_INDEX_ENTRY_SIZE,
+               "fs.idx entries must have a fixed size");
+
+/* Returns the hash of @path in the index, FNV-1a of 64 bits */
+static inline u64 fat_log_path_hash(const char *path) {
+    u64 hash = 14695981039346656037ULL;
+    for (const char *c = path; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Returns the number of bytes that follow an entry of type
+ * FAT_LOG_ENTRY_PATH with @path_len.
+ */
+static inline size_t fat_log_path_padded_len(u16 path_len) {
+    return (path_len + FAT_LOG_ENTRY_SIZE - 1) / FAT_LOG_ENTRY_SIZE *
+           FAT_LOG_ENTRY_SIZE;
+}
+
+#endif /* _FAT_LOG_FORMAT_H */
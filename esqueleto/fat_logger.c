@@ -0,0 +1,805 @@
+/*
+ * fat_logger.c
+ *
+ * Writer of the activity log, fs.log.
+ *
+ * The ring buffer is a bounded queue of many producers and one consumer. Each
+ * slot has a sequence number that tells whether it is free for the producer
+ * of a given position (seq == position) or holds its record (seq == position
+ * + 1). Producers claim positions with a compare and swap of the tail, and
+ * the writer frees the slots it reads for the next turn of the ring.
+ *
+ * Aggregates are kept in an array in the order they were first seen, and found
+ * by a hash table of indexes in it, with linear probing. Both are emptied at
+ * the end of each window. The paths of the binary log get their numbers the
+ * same way, until there are too many and a new header starts again from 0.
+ *
+ * The entries of the index of a batch are collected while it's formatted, and
+ * written to the index after the batch, once its offset in the log is known.
+ * A batch never has a header after its first entry, so each path has a single
+ * number in it.
+ */
+
+#include "fat_logger.h"
+
+#include "big_brother.h"
+#include "fat_util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Number of users whose names are remembered by the writer
+#define FAT_LOGGER_USER_CACHE_SIZE 64
+#define FAT_LOGGER_USER_NAME_LEN 33
+
+#define FAT_LOGGER_DATE_LEN 30
+
+// Space needed in the batch for any record, in text or in binary with a
+// header and the definitions of its path and words. Censored words are cut if
+// they don't fit in a text line.
+#define FAT_LOGGER_RECORD_LEN                                                  \
+    (FAT_LOGGER_DATE_LEN + FAT_LOGGER_USER_NAME_LEN + FAT_LOGGER_PATH_LEN +    \
+     96 + CENSORED_WORDS_MAX * (FAT_LOG_ENTRY_SIZE + CENSORED_WORD_MAX_LEN))
+
+// Slots of the hash table of aggregates, twice as many as aggregates
+#define FAT_LOGGER_AGGREGATE_INDEX_SIZE (2 * FAT_LOGGER_AGGREGATE_SIZE)
+
+// Empty slot of the hash tables
+#define FAT_LOGGER_NO_INDEX (-1)
+
+// Paths numbered in the binary log after each header
+#define FAT_LOGGER_PATH_IDS 4096
+#define FAT_LOGGER_PATH_ID_INDEX_SIZE (2 * FAT_LOGGER_PATH_IDS)
+
+// Entries of the index for a batch. If there are more, it's flushed earlier.
+#define FAT_LOGGER_BATCH_INDEX_SIZE 256
+
+struct fat_log_record_s {
+    time_t time;
+    uid_t uid;
+    fat_log_op op;
+    u32 words;
+    u32 words_version; // See censored_word
+    u64 bytes;
+    char path[FAT_LOGGER_PATH_LEN];
+};
+
+struct fat_log_aggregate_s {
+    // Time of the first record, with the union of the words and the sum of
+    // the bytes of all of them
+    struct fat_log_record_s record;
+    u64 count;
+};
+
+struct fat_log_slot_s {
+    size_t seq;
+    struct fat_log_record_s record;
+};
+
+struct fat_log_user_s {
+    bool valid;
+    uid_t uid;
+    char name[FAT_LOGGER_USER_NAME_LEN];
+};
+
+struct fat_logger_s {
+    fat_volume vol;
+    // Nodes of the generations of the log, fs.log first, kept in the tree by
+    // the caller
+    fat_tree_node log_nodes[LOG_GENERATIONS];
+    // Nodes of their indexes, if has_index
+    fat_tree_node index_nodes[LOG_GENERATIONS];
+    bool has_index;
+    size_t generations;
+    // Size when the log is rotated, or 0
+    off_t max_size;
+    fat_logger_written_fn written;
+    // Seconds of the aggregation windows, 0 to write every record
+    unsigned int window;
+    int flags;
+    struct fat_log_slot_s ring[FAT_LOGGER_RING_SIZE];
+    // Next position to claim by the producers
+    size_t tail;
+    // Next position to read by the writer
+    size_t head;
+    pthread_t writer;
+    // Protect stop and the positions of the syncs, and wake the writer
+    // before its interval expires
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stop;
+    // Syncs asked for and finished by the writer. Each one must write at
+    // least the records before sync_target.
+    u64 sync_requests;
+    u64 syncs_done;
+    size_t sync_target;
+    pthread_cond_t synced_cond;
+    // The rest is only used by the writer thread
+    // Bytes that fs.log can take without adding clusters to it
+    off_t reserved;
+    char batch[FAT_LOGGER_BATCH_SIZE];
+    size_t batch_len;
+    // Index of the batch, without its offset and length yet
+    struct fat_log_index_entry_s batch_index[FAT_LOGGER_BATCH_INDEX_SIZE];
+    size_t batch_index_len;
+    time_t date_time;
+    char date[FAT_LOGGER_DATE_LEN];
+    size_t date_len;
+    struct fat_log_user_s users[FAT_LOGGER_USER_CACHE_SIZE];
+    time_t window_start;
+    size_t num_aggregates;
+    struct fat_log_aggregate_s aggregates[FAT_LOGGER_AGGREGATE_SIZE];
+    int aggregate_index[FAT_LOGGER_AGGREGATE_INDEX_SIZE];
+    // Binary log
+    bool header_written;
+    size_t num_path_ids;
+    // Version of the censored words defined in the batch, 0 if none
+    u32 batch_words_version;
+    char path_ids[FAT_LOGGER_PATH_IDS][FAT_LOGGER_PATH_LEN];
+    int path_id_index[FAT_LOGGER_PATH_ID_INDEX_SIZE];
+};
+
+/* Continues the FNV-1a @hash with the characters of @text */
+static uint64_t fnv1a(uint64_t hash, const char *text) {
+    for (const char *c = text; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+#define FNV1A_BASIS 14695981039346656037ULL
+
+/* Adds @record to the ring of @logger, and sets @pos to its position.
+ * Returns false if the ring is full.
+ */
+static bool ring_push(fat_logger logger,
+                      const struct fat_log_record_s *record, size_t *pos) {
+    size_t tail = __atomic_load_n(&logger->tail, __ATOMIC_RELAXED);
+    struct fat_log_slot_s *slot;
+    while (true) {
+        slot = &logger->ring[tail % FAT_LOGGER_RING_SIZE];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)tail;
+        if (diff == 0) {
+            // Free for this position, try to claim it. On failure tail gets
+            // the position claimed by other thread.
+            if (__atomic_compare_exchange_n(&logger->tail, &tail, tail + 1,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // Still has the record of the previous turn
+        } else {
+            tail = __atomic_load_n(&logger->tail, __ATOMIC_RELAXED);
+        }
+    }
+    slot->record = *record;
+    __atomic_store_n(&slot->seq, tail + 1, __ATOMIC_RELEASE);
+    *pos = tail;
+    return true;
+}
+
+/* Takes the oldest record of the ring of @logger into @record. Returns false
+ * if it's empty, or its producer didn't finish writing it yet.
+ * Only called by the writer.
+ */
+static bool ring_pop(fat_logger logger, struct fat_log_record_s *record) {
+    size_t head = logger->head;
+    struct fat_log_slot_s *slot = &logger->ring[head % FAT_LOGGER_RING_SIZE];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1) {
+        return false;
+    }
+    *record = slot->record;
+    __atomic_store_n(&slot->seq, head + FAT_LOGGER_RING_SIZE, __ATOMIC_RELEASE);
+    __atomic_store_n(&logger->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void wake_writer(fat_logger logger) {
+    pthread_mutex_lock(&logger->lock);
+    pthread_cond_signal(&logger->wake);
+    pthread_mutex_unlock(&logger->lock);
+}
+
+void fat_logger_log(fat_logger logger, uid_t uid, fat_log_op op,
+                    fat_file file, size_t bytes, u32 words,
+                    u32 words_version) {
+    int starting_errno = errno;
+    struct fat_log_record_s record;
+    char path[MAX_PATH_LEN];
+
+    record.time = time(NULL);
+    record.uid = uid;
+    record.op = op;
+    record.words = words;
+    record.words_version = words_version;
+    record.bytes = bytes;
+    fat_file_path(file, path);
+    strncpy(record.path, path, FAT_LOGGER_PATH_LEN - 1);
+    record.path[FAT_LOGGER_PATH_LEN - 1] = '\0';
+
+    size_t pos;
+    while (!ring_push(logger, &record, &pos)) {
+        wake_writer(logger);
+        sched_yield();
+    }
+    size_t head = __atomic_load_n(&logger->head, __ATOMIC_ACQUIRE);
+    if (pos + 1 - head == FAT_LOGGER_RING_SIZE / 2) {
+        wake_writer(logger); // Only once per batch
+    }
+    errno = starting_errno;
+}
+
+/* Appends the first @len bytes of @text to the batch of @logger, or as many
+ * as fit.
+ */
+static void batch_append(fat_logger logger, const char *text, size_t len) {
+    len = min(len, FAT_LOGGER_BATCH_SIZE - logger->batch_len);
+    memcpy(logger->batch + logger->batch_len, text, len);
+    logger->batch_len += len;
+}
+
+static void batch_append_str(fat_logger logger, const char *text) {
+    batch_append(logger, text, strlen(text));
+}
+
+/* Returns the date of @t as written in the log. The last one is remembered,
+ * as most records of a batch happen in the same second.
+ */
+static const char *log_date(fat_logger logger, time_t t) {
+    if (logger->date_len == 0 || logger->date_time != t) {
+        struct tm timeinfo;
+        localtime_r(&t, &timeinfo);
+        logger->date_len = strftime(logger->date, FAT_LOGGER_DATE_LEN,
+                                    "%d-%m-%Y %H:%M", &timeinfo);
+        logger->date_time = t;
+    }
+    return logger->date;
+}
+
+/* Returns the name of the user @uid, or its number if it has no name */
+static const char *log_user_name(fat_logger logger, uid_t uid) {
+    struct fat_log_user_s *user =
+        &logger->users[uid % FAT_LOGGER_USER_CACHE_SIZE];
+    if (user->valid && user->uid == uid) {
+        return user->name;
+    }
+    struct passwd pw, *result = NULL;
+    char buf[1024];
+    if (getpwuid_r(uid, &pw, buf, sizeof(buf), &result) == 0 &&
+        result != NULL) {
+        strncpy(user->name, pw.pw_name, FAT_LOGGER_USER_NAME_LEN - 1);
+        user->name[FAT_LOGGER_USER_NAME_LEN - 1] = '\0';
+    } else {
+        DEBUG("Unable to get the name of user %u", uid);
+        snprintf(user->name, FAT_LOGGER_USER_NAME_LEN, "%u", uid);
+    }
+    user->uid = uid;
+    user->valid = true;
+    return user->name;
+}
+
+/* Appends the line of @record to the batch of @logger. With aggregation
+ * windows, the line ends with the @count of operations and their bytes.
+ */
+static void log_format(fat_logger logger,
+                       const struct fat_log_record_s *record, u64 count) {
+    log_date(logger, record->time);
+    batch_append(logger, logger->date, logger->date_len);
+    batch_append(logger, "\t", 1);
+    batch_append_str(logger, log_user_name(logger, record->uid));
+    batch_append(logger, "\t", 1);
+    batch_append_str(logger, fat_log_op_name(record->op));
+    batch_append(logger, "\t", 1);
+    batch_append_str(logger, record->path);
+    batch_append(logger, "\t", 1);
+    if (record->words != 0) {
+        bool first = true;
+        batch_append(logger, "[", 1);
+        for (unsigned int i = 0; i < CENSORED_WORDS_MAX; i++) {
+            const char *word = censored_word(record->words_version, i);
+            if (word != NULL && (record->words & (1u << i))) {
+                if (!first) {
+                    batch_append(logger, ", ", 2);
+                }
+                batch_append_str(logger, word);
+                first = false;
+            }
+        }
+        batch_append(logger, "]", 1);
+    }
+    if (logger->window != 0) {
+        char numbers[48];
+        int len = snprintf(numbers, sizeof(numbers), "\t%llu\t%llu",
+                           (unsigned long long)count,
+                           (unsigned long long)record->bytes);
+        batch_append(logger, numbers, len);
+    }
+    batch_append(logger, "\n", 1);
+}
+
+/* Appends a header to the batch of @logger, forgetting the numbers of the
+ * paths.
+ */
+static void log_encode_header(fat_logger logger, time_t t) {
+    struct fat_log_entry_s entry = {0};
+    entry.type = FAT_LOG_ENTRY_HEADER;
+    entry.time = t;
+    entry.bytes = FAT_LOG_MAGIC;
+    batch_append(logger, (const char *)&entry, sizeof(entry));
+    logger->num_path_ids = 0;
+    for (size_t i = 0; i < FAT_LOGGER_PATH_ID_INDEX_SIZE; i++) {
+        logger->path_id_index[i] = FAT_LOGGER_NO_INDEX;
+    }
+    logger->header_written = true;
+}
+
+/* Returns the number of the path of @record, appending its definition to the
+ * batch of @logger if it's new.
+ */
+static u32 log_encode_path(fat_logger logger,
+                           const struct fat_log_record_s *record) {
+    static const char zeros[FAT_LOG_ENTRY_SIZE] = {0};
+
+    if (!logger->header_written ||
+        logger->num_path_ids == FAT_LOGGER_PATH_IDS) {
+        log_encode_header(logger, record->time);
+    }
+    size_t slot =
+        fnv1a(FNV1A_BASIS, record->path) % FAT_LOGGER_PATH_ID_INDEX_SIZE;
+    int id;
+    while ((id = logger->path_id_index[slot]) != FAT_LOGGER_NO_INDEX) {
+        if (strcmp(logger->path_ids[id], record->path) == 0) {
+            return id;
+        }
+        slot = (slot + 1) % FAT_LOGGER_PATH_ID_INDEX_SIZE;
+    }
+    id = logger->num_path_ids++;
+    logger->path_id_index[slot] = id;
+    strcpy(logger->path_ids[id], record->path);
+
+    struct fat_log_entry_s entry = {0};
+    entry.type = FAT_LOG_ENTRY_PATH;
+    entry.time = record->time;
+    entry.path_id = id;
+    entry.path_len = strlen(record->path);
+    batch_append(logger, (const char *)&entry, sizeof(entry));
+    batch_append(logger, record->path, entry.path_len);
+    batch_append(logger, zeros,
+                 fat_log_path_padded_len(entry.path_len) - entry.path_len);
+    return id;
+}
+
+/* Appends to the batch of @logger the definitions of the censored words of
+ * @record, if they are not in the batch yet.
+ */
+static void log_encode_words(fat_logger logger,
+                             const struct fat_log_record_s *record) {
+    static const char zeros[FAT_LOG_ENTRY_SIZE] = {0};
+
+    if (record->words == 0 ||
+        record->words_version == logger->batch_words_version) {
+        return;
+    }
+    const char *word;
+    for (u32 i = 0; (word = censored_word(record->words_version, i)) != NULL;
+         i++) {
+        struct fat_log_entry_s entry = {0};
+        entry.type = FAT_LOG_ENTRY_WORD;
+        entry.time = record->time;
+        entry.path_id = i;
+        entry.path_len = strlen(word);
+        batch_append(logger, (const char *)&entry, sizeof(entry));
+        batch_append(logger, word, entry.path_len);
+        batch_append(logger, zeros,
+                     fat_log_path_padded_len(entry.path_len) -
+                         entry.path_len);
+    }
+    logger->batch_words_version = record->words_version;
+}
+
+/* Appends the binary entry of @record to the batch of @logger. Returns the
+ * number of its path.
+ */
+static u32 log_encode(fat_logger logger,
+                      const struct fat_log_record_s *record, u64 count) {
+    struct fat_log_entry_s entry = {0};
+    entry.path_id = log_encode_path(logger, record);
+    log_encode_words(logger, record);
+    entry.type = FAT_LOG_ENTRY_ACCESS;
+    entry.time = record->time;
+    entry.bytes = record->bytes;
+    entry.uid = record->uid;
+    entry.words = record->words;
+    entry.count = min(count, (u64)UINT32_MAX);
+    entry.op = record->op;
+    entry.flags = logger->window != 0 ? FAT_LOG_AGGREGATED : 0;
+    batch_append(logger, (const char *)&entry, sizeof(entry));
+    return entry.path_id;
+}
+
+/* Adds the file and hour of @record to the index of the batch of @logger, if
+ * they are not there yet. @path_id is its number in a binary log.
+ */
+static void log_index(fat_logger logger, const struct fat_log_record_s *record,
+                      u32 path_id) {
+    u64 hash = fat_log_path_hash(record->path);
+    u32 bucket = record->time / FAT_LOG_INDEX_BUCKET;
+    // Most records are of the last files seen
+    for (size_t i = logger->batch_index_len; i-- > 0;) {
+        struct fat_log_index_entry_s *entry = &logger->batch_index[i];
+        if (entry->path_hash == hash && entry->bucket == bucket &&
+            entry->path_id == path_id) {
+            return;
+        }
+    }
+    struct fat_log_index_entry_s *entry =
+        &logger->batch_index[logger->batch_index_len++];
+    memset(entry, 0, sizeof(*entry));
+    entry->path_hash = hash;
+    entry->bucket = bucket;
+    entry->path_id = path_id;
+}
+
+/* Makes space for @size bytes in the chain of the log file @log_file, a chunk
+ * at a time. Its lock must be held.
+ */
+static void log_reserve(fat_logger logger, fat_file log_file, off_t size) {
+    if (size <= logger->reserved) {
+        return;
+    }
+    off_t target = (size + FAT_LOGGER_CHUNK_SIZE - 1) / FAT_LOGGER_CHUNK_SIZE *
+                   FAT_LOGGER_CHUNK_SIZE;
+    if (logger->max_size != 0) {
+        target = max(min(target, logger->max_size), size);
+    }
+    errno = 0;
+    // At the end of the volume, away from the files the threads write
+    fat_file_reserve(log_file, target, fat_table_last_group(log_file->table));
+    if (errno == 0) {
+        logger->reserved = target;
+    } else {
+        // The writes still add clusters one by one
+        DEBUG("Unable to reserve space for " LOG_FILEPATH ": %s",
+              strerror(errno));
+    }
+}
+
+/* Appends the index of the batch of @logger to fs.idx, with the @offset
+ * where the batch was written in fs.log. The tree lock must be held.
+ */
+static void log_flush_index(fat_logger logger, off_t offset, fat_file parent) {
+    fat_file index_file = fat_tree_get_file(logger->index_nodes[0]);
+    for (size_t i = 0; i < logger->batch_index_len; i++) {
+        logger->batch_index[i].offset = offset;
+        logger->batch_index[i].length = logger->batch_len;
+    }
+    pthread_rwlock_t *index_lock =
+        fat_volume_file_lock(logger->vol, index_file);
+    pthread_rwlock_wrlock(index_lock);
+    errno = 0;
+    fat_file_pwrite(index_file, (const char *)logger->batch_index,
+                    logger->batch_index_len * FAT_LOG_INDEX_ENTRY_SIZE,
+                    index_file->dentry.file_size, parent);
+    if (errno != 0) {
+        DEBUG("Unable to write the index of " LOG_FILEPATH ": %s",
+              strerror(errno));
+    }
+    pthread_rwlock_unlock(index_lock);
+    if (logger->written != NULL) {
+        logger->written(index_file);
+    }
+}
+
+/* Appends the batch of @logger to the log file, and its entries to the index */
+static void log_flush(fat_logger logger) {
+    if (logger->batch_len == 0) {
+        return;
+    }
+    fat_volume vol = logger->vol;
+    fat_file log_file = fat_tree_get_file(logger->log_nodes[0]);
+    // The entry of the log is written in its directory
+    pthread_rwlock_rdlock(&vol->tree_lock);
+    fat_file parent = fat_tree_get_parent(logger->log_nodes[0]);
+    pthread_rwlock_t *log_lock = fat_volume_file_lock(vol, log_file);
+    pthread_rwlock_wrlock(log_lock);
+    off_t offset = log_file->dentry.file_size;
+    log_reserve(logger, log_file, offset + logger->batch_len);
+    errno = 0;
+    fat_file_pwrite(log_file, logger->batch, logger->batch_len, offset,
+                    parent);
+    bool flushed = errno == 0;
+    if (!flushed) {
+        DEBUG("Unable to write " LOG_FILEPATH ": %s", strerror(errno));
+    }
+    pthread_rwlock_unlock(log_lock);
+    if (flushed && logger->has_index) {
+        log_flush_index(logger, offset, parent);
+    }
+    pthread_rwlock_unlock(&vol->tree_lock);
+    if (logger->written != NULL) {
+        logger->written(log_file);
+    }
+    logger->batch_len = 0;
+    logger->batch_index_len = 0;
+    logger->batch_words_version = 0;
+}
+
+/* Exchanges the data of the log files @file1 and @file2, children of @parent.
+ * The tree lock must be held. This is the only place where a thread holds two
+ * file locks, so they are taken in order of address.
+ */
+static void log_swap(fat_logger logger, fat_file file1, fat_file file2,
+                     fat_file parent) {
+    pthread_rwlock_t *lock1 = fat_volume_file_lock(logger->vol, file1);
+    pthread_rwlock_t *lock2 = fat_volume_file_lock(logger->vol, file2);
+    if (lock1 > lock2) {
+        pthread_rwlock_t *tmp = lock1;
+        lock1 = lock2;
+        lock2 = tmp;
+    }
+    pthread_rwlock_wrlock(lock1);
+    if (lock2 != lock1) {
+        pthread_rwlock_wrlock(lock2);
+    }
+    fat_file_swap_data(file1, file2, parent);
+    if (lock2 != lock1) {
+        pthread_rwlock_unlock(lock2);
+    }
+    pthread_rwlock_unlock(lock1);
+}
+
+/* Moves each of the files in @nodes, the generations of the log or of its
+ * index, to the following older one, and empties the newest reusing the
+ * clusters of the oldest.
+ */
+static void log_rotate_files(fat_logger logger, fat_tree_node *nodes) {
+    fat_volume vol = logger->vol;
+    fat_file files[LOG_GENERATIONS];
+    for (size_t i = 0; i < logger->generations; i++) {
+        files[i] = fat_tree_get_file(nodes[i]);
+    }
+    pthread_rwlock_rdlock(&vol->tree_lock);
+    fat_file parent = fat_tree_get_parent(nodes[0]);
+    for (size_t i = logger->generations - 1; i > 0; i--) {
+        log_swap(logger, files[i], files[i - 1], parent);
+    }
+    pthread_rwlock_t *lock = fat_volume_file_lock(vol, files[0]);
+    pthread_rwlock_wrlock(lock);
+    fat_file_empty(files[0], parent);
+    pthread_rwlock_unlock(lock);
+    pthread_rwlock_unlock(&vol->tree_lock);
+
+    for (size_t i = 0; logger->written != NULL && i < logger->generations;
+         i++) {
+        logger->written(files[i]);
+    }
+}
+
+/* Moves each generation of the log and its index to the following older one,
+ * and starts fs.log again.
+ */
+static void log_rotate(fat_logger logger) {
+    log_rotate_files(logger, logger->log_nodes);
+    if (logger->has_index) {
+        log_rotate_files(logger, logger->index_nodes);
+    }
+    DEBUG("Rotated " LOG_FILEPATH);
+    logger->reserved = 0; // Not known for the chain of the oldest
+    logger->header_written = false;
+}
+
+/* Appends @record to the batch of @logger, flushing it first if there is no
+ * space left or a binary log needs a new header, or rotating the log if it's
+ * full.
+ */
+static void log_append(fat_logger logger,
+                       const struct fat_log_record_s *record, u64 count) {
+    if (logger->max_size != 0) {
+        // Read without the lock, users writing to a shown log can only make
+        // the rotation a bit late
+        off_t size = fat_tree_get_file(logger->log_nodes[0])->dentry.file_size +
+                     logger->batch_len;
+        if (size != 0 && size + FAT_LOGGER_RECORD_LEN > logger->max_size) {
+            log_flush(logger);
+            log_rotate(logger);
+        }
+    }
+    bool binary = logger->flags & FAT_LOGGER_BINARY;
+    if (FAT_LOGGER_BATCH_SIZE - logger->batch_len < FAT_LOGGER_RECORD_LEN ||
+        logger->batch_index_len == FAT_LOGGER_BATCH_INDEX_SIZE ||
+        (binary && logger->num_path_ids == FAT_LOGGER_PATH_IDS)) {
+        log_flush(logger);
+    }
+    u32 path_id = 0;
+    if (binary) {
+        path_id = log_encode(logger, record, count);
+    } else {
+        log_format(logger, record, count);
+    }
+    log_index(logger, record, path_id);
+}
+
+/* Appends all the aggregates of @logger to the batch, and starts a new
+ * window.
+ */
+static void aggregates_close(fat_logger logger) {
+    for (size_t i = 0; i < logger->num_aggregates; i++) {
+        log_append(logger, &logger->aggregates[i].record,
+                   logger->aggregates[i].count);
+    }
+    logger->num_aggregates = 0;
+    for (size_t i = 0; i < FAT_LOGGER_AGGREGATE_INDEX_SIZE; i++) {
+        logger->aggregate_index[i] = FAT_LOGGER_NO_INDEX;
+    }
+}
+
+/* Hash of the user, operation and path of @record */
+static size_t aggregate_hash(const struct fat_log_record_s *record) {
+    uint64_t hash = FNV1A_BASIS;
+    hash = (hash ^ record->uid) * 1099511628211ULL;
+    hash = (hash ^ record->op) * 1099511628211ULL;
+    return fnv1a(hash, record->path) % FAT_LOGGER_AGGREGATE_INDEX_SIZE;
+}
+
+/* Adds @record to the aggregate of its user, operation and file */
+static void aggregates_add(fat_logger logger,
+                           const struct fat_log_record_s *record) {
+    if (logger->num_aggregates != 0 &&
+        record->time >= logger->window_start + logger->window) {
+        aggregates_close(logger);
+    }
+    if (logger->num_aggregates == FAT_LOGGER_AGGREGATE_SIZE) {
+        aggregates_close(logger);
+    }
+    if (logger->num_aggregates == 0) {
+        logger->window_start = record->time;
+    }
+
+    size_t slot = aggregate_hash(record);
+    int index;
+    while ((index = logger->aggregate_index[slot]) !=
+           FAT_LOGGER_NO_INDEX) {
+        struct fat_log_aggregate_s *aggregate = &logger->aggregates[index];
+        if (aggregate->record.uid == record->uid &&
+            aggregate->record.op == record->op &&
+            aggregate->record.words_version == record->words_version &&
+            strcmp(aggregate->record.path, record->path) == 0) {
+            aggregate->record.words |= record->words;
+            aggregate->record.bytes += record->bytes;
+            aggregate->count++;
+            return;
+        }
+        slot = (slot + 1) % FAT_LOGGER_AGGREGATE_INDEX_SIZE;
+    }
+    index = logger->num_aggregates++;
+    logger->aggregate_index[slot] = index;
+    logger->aggregates[index].record = *record;
+    logger->aggregates[index].count = 1;
+}
+
+/* Writes all the records in the ring of @logger, and the aggregates of the
+ * window if it's over. With @all, the aggregates are written anyway.
+ */
+static void log_drain(fat_logger logger, bool all) {
+    struct fat_log_record_s record;
+    while (ring_pop(logger, &record)) {
+        if (logger->window != 0) {
+            aggregates_add(logger, &record);
+        } else {
+            log_append(logger, &record, 1);
+        }
+    }
+    if (logger->num_aggregates != 0 &&
+        (all || time(NULL) >= logger->window_start + logger->window)) {
+        aggregates_close(logger);
+    }
+    log_flush(logger);
+}
+
+static void *writer_main(void *arg) {
+    fat_logger logger = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&logger->lock);
+    while (!logger->stop) {
+        u64 requested = logger->sync_requests;
+        if (requested == logger->syncs_done) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += FAT_LOGGER_FLUSH_INTERVAL_MS % 1000 * 1000000L;
+            deadline.tv_sec += FAT_LOGGER_FLUSH_INTERVAL_MS / 1000 +
+                               deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&logger->wake, &logger->lock, &deadline);
+            requested = logger->sync_requests;
+        }
+        size_t target = logger->sync_target;
+        pthread_mutex_unlock(&logger->lock);
+        log_drain(logger, requested != logger->syncs_done);
+        pthread_mutex_lock(&logger->lock);
+        // Otherwise some producer didn't finish its record yet
+        if (logger->head >= target) {
+            logger->syncs_done = requested;
+            pthread_cond_broadcast(&logger->synced_cond);
+        }
+    }
+    pthread_mutex_unlock(&logger->lock);
+    log_drain(logger, true); // Records logged while stopping
+    return NULL;
+}
+
+fat_logger fat_logger_init(fat_volume vol, fat_tree_node *log_nodes,
+                           fat_tree_node *index_nodes,
+                           size_t generations, off_t max_size,
+                           unsigned int window, int flags,
+                           fat_logger_written_fn written) {
+    fat_logger logger = calloc(1, sizeof(struct fat_logger_s));
+    if (logger == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    logger->vol = vol;
+    for (size_t i = 0; i < generations; i++) {
+        logger->log_nodes[i] = log_nodes[i];
+        if (index_nodes != NULL) {
+            logger->index_nodes[i] = index_nodes[i];
+        }
+    }
+    logger->has_index = index_nodes != NULL;
+    logger->generations = generations;
+    logger->max_size = max_size;
+    logger->written = written;
+    logger->window = window;
+    logger->flags = flags;
+    for (size_t i = 0; i < FAT_LOGGER_RING_SIZE; i++) {
+        logger->ring[i].seq = i;
+    }
+    for (size_t i = 0; i < FAT_LOGGER_AGGREGATE_INDEX_SIZE; i++) {
+        logger->aggregate_index[i] = FAT_LOGGER_NO_INDEX;
+    }
+    pthread_mutex_init(&logger->lock, NULL);
+    pthread_cond_init(&logger->wake, NULL);
+    pthread_cond_init(&logger->synced_cond, NULL);
+    int err = pthread_create(&logger->writer, NULL, writer_main, logger);
+    if (err != 0) {
+        pthread_cond_destroy(&logger->synced_cond);
+        pthread_cond_destroy(&logger->wake);
+        pthread_mutex_destroy(&logger->lock);
+        free(logger);
+        errno = err;
+        return NULL;
+    }
+    return logger;
+}
+
+void fat_logger_sync(fat_logger logger) {
+    size_t tail = __atomic_load_n(&logger->tail, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&logger->lock);
+    logger->sync_target = max(logger->sync_target, tail);
+    u64 request = ++logger->sync_requests;
+    pthread_cond_signal(&logger->wake);
+    while (logger->syncs_done < request) {
+        pthread_cond_wait(&logger->synced_cond, &logger->lock);
+    }
+    pthread_mutex_unlock(&logger->lock);
+}
+
+void fat_logger_destroy(fat_logger logger) {
+    pthread_mutex_lock(&logger->lock);
+    logger->stop = true;
+    pthread_cond_signal(&logger->wake);
+    pthread_mutex_unlock(&logger->lock);
+    pthread_join(logger->writer, NULL);
+    pthread_cond_destroy(&logger->synced_cond);
+    pthread_cond_destroy(&logger->wake);
+    pthread_mutex_destroy(&logger->lock);
+    free(logger);
+}
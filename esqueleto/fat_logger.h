@@ -0,0 +1,107 @@
+/*
+ * fat_logger.h
+ *
+ * Writer of the activity log, fs.log.
+ *
+ * The threads that serve requests only fill a record and push it to a ring
+ * buffer, without locks nor allocations. A background thread takes the records
+ * in order, formats them and appends them to the log in big batches, so the
+ * log costs one write of the file every many operations instead of two disk
+ * writes each.
+ *
+ * Records are written a while after the operation, at most
+ * FAT_LOGGER_FLUSH_INTERVAL_MS later or when the ring is half full, and all
+ * the pending ones when the logger is destroyed.
+ *
+ * With an aggregation window, the records of the same user, operation and file
+ * are summed up, and a single line is written for them at the end of the
+ * window, with the number of operations, the bytes and all the censored words
+ * found.
+ *
+ * The log can be written as text, one line per record separated by tabs, or
+ * in binary, with the layout in fat_log_format.h.
+ *
+ * Clusters are reserved for the log in big runs of consecutive ones ahead of
+ * its end, so it's not scattered among the files written meanwhile. With a
+ * maximum size, the log is rotated through its generations (see
+ * LOG_GENERATIONS) when it's full: each one takes the data of the following
+ * newer one, and fs.log reuses the clusters of the oldest.
+ *
+ * Each log file can have an index, where the batches of records of each file
+ * and hour are found (see fat_log_format.h). It's written after each batch,
+ * and rotated with the log.
+ */
+
+#ifndef _FAT_LOGGER_H
+#define _FAT_LOGGER_H
+
+#include "fat_file.h"
+#include "fat_fs_tree.h"
+#include "fat_log_format.h"
+#include "fat_volume.h"
+#include <sys/types.h>
+
+// Number of records in the ring buffer, a power of 2. When it's full the
+// threads that log wait for the writer.
+#define FAT_LOGGER_RING_SIZE 4096
+
+// Longest path kept in a record, longer ones are truncated
+#define FAT_LOGGER_PATH_LEN 256
+
+// Time between two writes of the log when there are few records
+#define FAT_LOGGER_FLUSH_INTERVAL_MS 1000
+
+// Size of the buffer where the records are formatted before writing them
+#define FAT_LOGGER_BATCH_SIZE 65536
+
+// Different (user, operation, file) in an aggregation window. If there are
+// more, the window is closed earlier.
+#define FAT_LOGGER_AGGREGATE_SIZE 1024
+
+// Clusters reserved for the log each time it grows
+#define FAT_LOGGER_CHUNK_SIZE (1 << 20)
+
+// Flags of fat_logger_init()
+#define FAT_LOGGER_BINARY 0x1 // Fixed size entries, see fat_log_format.h
+
+typedef struct fat_logger_s *fat_logger;
+
+/* Called after each change of a log file, with the file */
+typedef void (*fat_logger_written_fn)(fat_file log_file);
+
+/* Starts a logger that appends to the file in @log_nodes[0], of volume @vol.
+ * If @max_size is not 0, the log is rotated through the @generations files in
+ * @log_nodes, the newest first, before it gets bigger than @max_size bytes.
+ * @index_nodes has the indexes of those files, in the same directory, or is
+ * NULL to write the log without an index. The nodes must be kept in the tree
+ * (see fat_tree_inc_num_times_opened) until the logger is destroyed. If
+ * @window is not 0, activity is aggregated over windows of that many seconds.
+ * @flags are the FAT_LOGGER_* flags, and @written can be NULL.
+ * Returns NULL and sets errno if the writer couldn't be started.
+ *
+ * PRE: 1 <= @generations <= LOG_GENERATIONS
+ */
+fat_logger fat_logger_init(fat_volume vol, fat_tree_node *log_nodes,
+                           fat_tree_node *index_nodes,
+                           size_t generations, off_t max_size,
+                           unsigned int window, int flags,
+                           fat_logger_written_fn written);
+
+/* Waits until the records logged before the call are in the log file. With
+ * aggregation, the current window is closed.
+ */
+void fat_logger_sync(fat_logger logger);
+
+/* Writes the pending records, stops the writer and frees @logger */
+void fat_logger_destroy(fat_logger logger);
+
+/* Logs that the user @uid did @op on @bytes bytes of @file, and found the
+ * censored words in @words (a bitmask of indexes in the words of
+ * @words_version, see censored_word). The words must be kept until the record
+ * is written. It can be called from any thread, and doesn't change errno.
+ */
+void fat_logger_log(fat_logger logger, uid_t uid, fat_log_op op,
+                    fat_file file, size_t bytes, u32 words,
+                    u32 words_version);
+
+#endif /* _FAT_LOGGER_H */
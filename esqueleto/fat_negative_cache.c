@@ -0,0 +1,92 @@
+/*
+ * fat_negative_cache.c
+ *
+ * Cache of names that are known not to exist in a directory.
+ *
+ * It's a direct mapped table. Lookups don't take locks: each entry has a
+ * sequence number that is odd while it's being written, and readers retry
+ * the comparison if it changed.
+ */
+
+#include "fat_negative_cache.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct fat_negative_entry_s {
+    unsigned int seq;
+    fat_file dir;
+    u32 generation;
+    char name[MAX_FILENAME];
+};
+
+struct fat_negative_cache_s {
+    struct fat_negative_entry_s entries[FAT_NEGATIVE_CACHE_SIZE];
+};
+
+fat_negative_cache fat_negative_cache_init(void) {
+    fat_negative_cache cache = calloc(1, sizeof(struct fat_negative_cache_s));
+    if (cache == NULL) {
+        errno = ENOMEM;
+    }
+    return cache;
+}
+
+void fat_negative_cache_destroy(fat_negative_cache cache) { free(cache); }
+
+/* FNV-1a hash of @name, mixed with the address of @dir */
+static size_t entry_index(const fat_file dir, const char *name) {
+    uint64_t hash = 14695981039346656037ULL ^ (uintptr_t)dir;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    return hash % FAT_NEGATIVE_CACHE_SIZE;
+}
+
+void fat_negative_cache_add(fat_negative_cache cache, const fat_file dir,
+                            const char *name) {
+    if (strlen(name) >= MAX_FILENAME) {
+        return; // Can't be the name of a file, nothing to remember
+    }
+    struct fat_negative_entry_s *entry =
+        &cache->entries[entry_index(dir, name)];
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&entry->dir, dir, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->generation,
+                     __atomic_load_n(&dir->dir.generation, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELAXED);
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i < MAX_FILENAME; i++) {
+        char c = i <= name_len ? name[i] : '\0';
+        __atomic_store_n(&entry->name[i], c, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
+
+bool fat_negative_cache_lookup(const fat_negative_cache cache,
+                               const fat_file dir, const char *name) {
+    if (strlen(name) >= MAX_FILENAME) {
+        return false;
+    }
+    const struct fat_negative_entry_s *entry =
+        &cache->entries[entry_index(dir, name)];
+    unsigned int seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (seq % 2 != 0) {
+        return false; // Being replaced
+    }
+    bool found =
+        __atomic_load_n(&entry->dir, __ATOMIC_RELAXED) == dir &&
+        __atomic_load_n(&entry->generation, __ATOMIC_RELAXED) ==
+            __atomic_load_n(&dir->dir.generation, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; found && i < MAX_FILENAME; i++) {
+        char c = __atomic_load_n(&entry->name[i], __ATOMIC_RELAXED);
+        found = c == name[i];
+        if (c == '\0') {
+            break;
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return found && __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq;
+}
@@ -0,0 +1,47 @@
+/*
+ * fat_negative_cache.h
+ *
+ * Cache of names that are known not to exist in a directory, so repeated
+ * lookups of missing files are answered without searching the tree or
+ * reading the disk.
+ *
+ * Entries are keyed by (directory, name) and remember the generation of the
+ * directory when they were added. Creating a child gives the directory a new
+ * generation (see fat_file_dir_changed), which invalidates all its entries at
+ * once.
+ */
+
+#ifndef _FAT_NEGATIVE_CACHE_H
+#define _FAT_NEGATIVE_CACHE_H
+
+#include "fat_file.h"
+#include <stdbool.h>
+
+// Number of entries. Each (directory, name) can only be in one of them, so
+// new entries replace old ones.
+#define FAT_NEGATIVE_CACHE_SIZE 4096
+
+typedef struct fat_negative_cache_s *fat_negative_cache;
+
+/* Initializes a new empty cache.
+ * Returns NULL and sets errno to ENOMEM if there is no memory.
+ */
+fat_negative_cache fat_negative_cache_init(void);
+
+/* Frees @cache */
+void fat_negative_cache_destroy(fat_negative_cache cache);
+
+/* Remembers that there is no file called @name in directory @dir.
+ * Calls to this function must be serialized by the caller.
+ */
+void fat_negative_cache_add(fat_negative_cache cache, const fat_file dir,
+                            const char *name);
+
+/* Returns true iff @name is known not to exist in directory @dir, since the
+ * last time a child was created in it. It can be called without locks, as
+ * long as @dir is not freed meanwhile.
+ */
+bool fat_negative_cache_lookup(const fat_negative_cache cache,
+                               const fat_file dir, const char *name);
+
+#endif /* _FAT_NEGATIVE_CACHE_H */
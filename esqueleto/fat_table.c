@@ -6,6 +6,9 @@
  */
 
 #include "fat_table.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 inline bool fat_table_is_valid_cluster_number(const fat_table table,
@@ -13,9 +16,22 @@ inline bool fat_table_is_valid_cluster_number(const fat_table table,
     return cluster >= 2 && cluster < table->num_data_clusters + 2;
 }
 
+/* Entries of the FAT can be changed by other threads while they are read, but
+ * each one is written as a whole.
+ */
+static inline u32 read_entry(const fat_table table, u32 cluster) {
+    le32 entry =
+        __atomic_load_n(&((le32 *)table->fat_map)[cluster], __ATOMIC_RELAXED);
+    return le32_to_cpu(entry);
+}
+
+static inline bool is_free(const fat_table table, u32 cluster) {
+    return read_entry(table, cluster) == FAT_CLUSTER_FREE;
+}
+
 u32 fat_table_get_next_cluster(fat_table table, u32 cur_cluster) {
     u32 next_cluster;
-    next_cluster = le32_to_cpu(((const le32 *)table->fat_map)[cur_cluster]);
+    next_cluster = read_entry(table, cur_cluster);
 
     /* We currently don't check for the actual special cluster values, but
      * instead treat all out of range values as end-of-chain. This may be
@@ -48,22 +64,107 @@ u32 fat_table_get_clusters_for_size(fat_table table, size_t file_size) {
     return ((off_t)file_size + (bytes_per_cluster - 1)) >> table->cluster_order;
 }
 
-u32 fat_table_get_next_free_cluster(fat_table table) {
-    u32 fat_table_get_next_free_cluster =
-        2; /* First two clusters are reserved */
-    while (
-        le32_to_cpu(
-            ((const le32 *)table->fat_map)[fat_table_get_next_free_cluster]) !=
-        FAT_CLUSTER_FREE) {
-        fat_table_get_next_free_cluster++;
+int fat_table_init_groups(fat_table table) {
+    // A volume without data clusters still gets an empty group, so there is
+    // always a home group to start from
+    table->num_groups =
+        max((table->num_data_clusters + FAT_TABLE_GROUP_CLUSTERS - 1) /
+                FAT_TABLE_GROUP_CLUSTERS,
+            1U);
+    table->groups = calloc(table->num_groups, sizeof(struct fat_alloc_group_s));
+    table->generations = calloc(FAT_TABLE_GENERATIONS, sizeof(u32));
+    if (table->groups == NULL || table->generations == NULL) {
+        free(table->groups);
+        free(table->generations);
+        table->groups = NULL;
+        table->generations = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    for (u32 i = 0; i < table->num_groups; i++) {
+        struct fat_alloc_group_s *group = &table->groups[i];
+        pthread_mutex_init(&group->lock, NULL);
+        group->first = 2 + i * FAT_TABLE_GROUP_CLUSTERS; // 0 and 1 reserved
+        group->end = min(group->first + FAT_TABLE_GROUP_CLUSTERS,
+                         table->num_data_clusters + 2);
+        group->hint = group->first;
+        group->longest_run = group->end - group->first;
+        group->free_count = 0;
+        for (u32 cluster = group->first; cluster < group->end; cluster++) {
+            group->free_count += is_free(table, cluster);
+        }
+    }
+    return 0;
+}
+
+void fat_table_destroy_groups(fat_table table) {
+    for (u32 i = 0; i < table->num_groups; i++) {
+        pthread_mutex_destroy(&table->groups[i].lock);
+    }
+    free(table->groups);
+    table->groups = NULL;
+    table->num_groups = 0;
+    free(table->generations);
+    table->generations = NULL;
+}
+
+static inline struct fat_alloc_group_s *group_of(const fat_table table,
+                                                 u32 cluster) {
+    return &table->groups[(cluster - 2) / FAT_TABLE_GROUP_CLUSTERS];
+}
+
+u32 fat_table_home_group(const fat_table table) {
+    static u32 next_home = 0;
+    static __thread u32 home = 0;
+    static __thread bool has_home = false;
+    if (!has_home) {
+        home = __atomic_fetch_add(&next_home, 1, __ATOMIC_RELAXED);
+        has_home = true;
+    }
+    return home % table->num_groups;
+}
+
+u32 fat_table_last_group(const fat_table table) {
+    return table->num_groups - 1;
+}
+
+/* Returns a free cluster of @group, or FAT_CLUSTER_END_OF_CHAIN if it has
+ * none. The lock of @group must be held.
+ */
+static u32 find_free_in_group(const fat_table table,
+                              struct fat_alloc_group_s *group) {
+    if (group->free_count == 0) {
+        return FAT_CLUSTER_END_OF_CHAIN;
+    }
+    // Search from the hint to the end, and then from the start to the hint
+    for (u32 cluster = group->hint; cluster < group->end; cluster++) {
+        if (is_free(table, cluster)) {
+            return cluster;
+        }
     }
-    if (!fat_table_is_valid_cluster_number(table,
-                                           fat_table_get_next_free_cluster)) {
-        fat_error("There was a problem fetching for a free cluster");
-        fat_table_get_next_free_cluster = FAT_CLUSTER_END_OF_CHAIN;
+    for (u32 cluster = group->first; cluster < group->hint; cluster++) {
+        if (is_free(table, cluster)) {
+            return cluster;
+        }
+    }
+    return FAT_CLUSTER_END_OF_CHAIN;
+}
+
+u32 fat_table_get_next_free_cluster(fat_table table) {
+    u32 start = fat_table_home_group(table);
+    for (u32 i = 0; i < table->num_groups; i++) {
+        struct fat_alloc_group_s *group =
+            &table->groups[(start + i) % table->num_groups];
+        pthread_mutex_lock(&group->lock);
+        u32 cluster = find_free_in_group(table, group);
+        pthread_mutex_unlock(&group->lock);
+        if (!fat_table_is_EOC(table, cluster)) {
+            DEBUG("next free cluster = %u", cluster);
+            return cluster;
+        }
     }
-    DEBUG("next free cluster = %u", fat_table_get_next_free_cluster);
-    return fat_table_get_next_free_cluster;
+    fat_error("There was a problem fetching for a free cluster");
+    return FAT_CLUSTER_END_OF_CHAIN;
 }
 
 inline off_t fat_table_cluster_offset(const fat_table table, u32 cluster) {
@@ -71,12 +172,27 @@ inline off_t fat_table_cluster_offset(const fat_table table, u32 cluster) {
            ((off_t)(cluster - 2) << table->cluster_order);
 }
 
+u32 fat_table_cluster_generation(const fat_table table, u32 cluster) {
+    return __atomic_load_n(
+        &table->generations[cluster & (FAT_TABLE_GENERATIONS - 1)],
+        __ATOMIC_ACQUIRE);
+}
+
+void fat_table_cluster_written(fat_table table, u32 cluster) {
+    __atomic_add_fetch(
+        &table->generations[cluster & (FAT_TABLE_GENERATIONS - 1)], 1,
+        __ATOMIC_RELEASE);
+}
+
 inline bool fat_table_is_cluster_used(fat_table table, u32 cluster) {
-    return le32_to_cpu(((const le32 *)table->fat_map)[cluster]) != 0;
+    return !is_free(table, cluster);
 }
 
-void fat_table_set_next_cluster(fat_table table, u32 cur_cluster,
-                                u32 next_cluster) {
+/* Writes the entry of @cur_cluster in the disk and in memory. Changes from or
+ * to free need the lock of the group of @cur_cluster.
+ */
+static void set_next_cluster(fat_table table, u32 cur_cluster,
+                             u32 next_cluster) {
     le32 next_cluster_le32 = cpu_to_le32(next_cluster);
     /* Write the disk fat table */
     off_t entry_offset = (off_t)(cur_cluster * 4) + table->fat_offset;
@@ -88,7 +204,153 @@ void fat_table_set_next_cluster(fat_table table, u32 cur_cluster,
         return;
     }
     /* Alter the in-memory table */
-    ((le32 *)table->fat_map)[cur_cluster] = next_cluster_le32;
+    __atomic_store_n(&((le32 *)table->fat_map)[cur_cluster],
+                     next_cluster_le32, __ATOMIC_RELAXED);
+}
+
+void fat_table_set_next_cluster(fat_table table, u32 cur_cluster,
+                                u32 next_cluster) {
+    if (!fat_table_is_valid_cluster_number(table, cur_cluster)) {
+        set_next_cluster(table, cur_cluster, next_cluster);
+        return;
+    }
+    struct fat_alloc_group_s *group = group_of(table, cur_cluster);
+    pthread_mutex_lock(&group->lock);
+    bool was_free = is_free(table, cur_cluster);
+    set_next_cluster(table, cur_cluster, next_cluster);
+    bool now_free = is_free(table, cur_cluster);
+    if (was_free && !now_free) {
+        group->free_count--;
+    } else if (!was_free && now_free) {
+        group->free_count++;
+        group->longest_run = group->end - group->first;
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+u32 fat_table_alloc_cluster(fat_table table) {
+    u32 start = fat_table_home_group(table);
+    for (u32 i = 0; i < table->num_groups; i++) {
+        // Only take clusters from other groups when the home one is full
+        struct fat_alloc_group_s *group =
+            &table->groups[(start + i) % table->num_groups];
+        pthread_mutex_lock(&group->lock);
+        u32 cluster = find_free_in_group(table, group);
+        if (!fat_table_is_EOC(table, cluster)) {
+            set_next_cluster(table, cluster, FAT_CLUSTER_END_OF_CHAIN);
+            if (is_free(table, cluster)) { // The write failed
+                pthread_mutex_unlock(&group->lock);
+                return FAT_CLUSTER_END_OF_CHAIN;
+            }
+            group->free_count--;
+            group->hint = cluster + 1 < group->end ? cluster + 1 : group->first;
+            pthread_mutex_unlock(&group->lock);
+            return cluster;
+        }
+        pthread_mutex_unlock(&group->lock);
+    }
+    fat_error("No free clusters left");
+    return FAT_CLUSTER_END_OF_CHAIN;
+}
+
+/* Returns true if the @count clusters from @first are free and in @group,
+ * whose lock must be held.
+ */
+static bool run_is_free(const fat_table table, struct fat_alloc_group_s *group,
+                        u32 first, u32 count) {
+    if (first < group->first || first + count > group->end) {
+        return false;
+    }
+    for (u32 cluster = first; cluster < first + count; cluster++) {
+        if (!is_free(table, cluster)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns the first of @count free consecutive clusters of @group, or
+ * FAT_CLUSTER_END_OF_CHAIN if it has none. The lock of @group must be held.
+ */
+static u32 find_run_in_group(const fat_table table,
+                             struct fat_alloc_group_s *group, u32 count) {
+    if (group->free_count < count || group->longest_run < count) {
+        return FAT_CLUSTER_END_OF_CHAIN;
+    }
+    u32 run_start = group->first, run_len = 0, longest_run = 0;
+    for (u32 cluster = group->first; cluster < group->end; cluster++) {
+        if (!is_free(table, cluster)) {
+            run_len = 0;
+            continue;
+        }
+        if (run_len == 0) {
+            run_start = cluster;
+        }
+        if (++run_len == count) {
+            return run_start;
+        }
+        longest_run = max(longest_run, run_len);
+    }
+    group->longest_run = longest_run;
+    return FAT_CLUSTER_END_OF_CHAIN;
+}
+
+/* Chains the @count free clusters from @first, of @group, with a single write
+ * of the FAT. The lock of @group must be held. Returns false if the write
+ * failed, leaving them free.
+ */
+static bool take_run(fat_table table, struct fat_alloc_group_s *group,
+                     u32 first, u32 count) {
+    le32 *entries = (le32 *)table->fat_map + first;
+    for (u32 i = 0; i < count; i++) {
+        u32 next = i + 1 < count ? first + i + 1 : FAT_CLUSTER_END_OF_CHAIN;
+        __atomic_store_n(&entries[i], cpu_to_le32(next), __ATOMIC_RELAXED);
+    }
+    off_t offset = (off_t)first * sizeof(le32) + table->fat_offset;
+    size_t size = count * sizeof(le32);
+    if (full_pwrite(table->fd, entries, size, offset) != size) {
+        DEBUG("Error writing %u entries of the FAT", count);
+        for (u32 i = 0; i < count; i++) {
+            __atomic_store_n(&entries[i], cpu_to_le32(FAT_CLUSTER_FREE),
+                             __ATOMIC_RELAXED);
+        }
+        errno = EIO;
+        return false;
+    }
+    group->free_count -= count;
+    return true;
+}
+
+u32 fat_table_alloc_run(fat_table table, u32 near, u32 count, u32 group) {
+    if (count == 0 || count > FAT_TABLE_GROUP_CLUSTERS ||
+        group >= table->num_groups) {
+        errno = EINVAL;
+        return FAT_CLUSTER_END_OF_CHAIN;
+    }
+    if (fat_table_is_valid_cluster_number(table, near)) {
+        struct fat_alloc_group_s *group = group_of(table, near);
+        pthread_mutex_lock(&group->lock);
+        bool taken = run_is_free(table, group, near, count) &&
+                     take_run(table, group, near, count);
+        pthread_mutex_unlock(&group->lock);
+        if (taken) {
+            return near;
+        }
+    }
+    for (u32 i = 0; i < table->num_groups; i++) {
+        struct fat_alloc_group_s *cur_group =
+            &table->groups[(group + i) % table->num_groups];
+        pthread_mutex_lock(&cur_group->lock);
+        u32 first = find_run_in_group(table, cur_group, count);
+        bool taken = !fat_table_is_EOC(table, first) &&
+                     take_run(table, cur_group, first, count);
+        pthread_mutex_unlock(&cur_group->lock);
+        if (taken) {
+            return first;
+        }
+    }
+    errno = ENOSPC;
+    return FAT_CLUSTER_END_OF_CHAIN;
 }
 
 u32 fat_table_seek_cluster(fat_table table, u32 start_cluster, off_t offset) {
@@ -106,13 +368,12 @@ u32 fat_table_seek_cluster(fat_table table, u32 start_cluster, off_t offset) {
 }
 
 u32 fat_table_add_new_cluster_to_chain(fat_table table, u32 last_cluster) {
-    u32 new_cluster = fat_table_get_next_free_cluster(table);
+    u32 new_cluster = fat_table_alloc_cluster(table);
     if (fat_table_is_EOC(table, new_cluster)) {
         // If there's no free clusters return -1
         return FAT_CLUSTER_END_OF_CHAIN;
     }
     fat_table_set_next_cluster(table, last_cluster, new_cluster);
-    fat_table_set_next_cluster(table, new_cluster, FAT_CLUSTER_END_OF_CHAIN);
     return new_cluster;
 }
 
@@ -9,6 +9,8 @@
 
 #include "fat_types.h"
 #include "fat_util.h"
+#include "slab.h"
+#include <pthread.h>
 #include <sys/types.h>
 
 // Both values of EOC are valid in FAT32 systems
@@ -16,6 +18,29 @@
 #define FAT_CLUSTER_END_OF_CHAIN2 0x0FFFFFFF
 #define FAT_CLUSTER_FREE 0x00000000
 
+// Number of clusters in each allocation group, see fat_table_init_groups
+#define FAT_TABLE_GROUP_CLUSTERS 4096
+
+// Generations of the data clusters, see fat_table_cluster_generation. A power
+// of 2, the clusters with the same remainder share one.
+#define FAT_TABLE_GENERATIONS (1 << 16)
+
+/* A range of clusters that is allocated independently of the others, so
+ * threads allocating in different groups don't wait for each other.
+ */
+struct fat_alloc_group_s {
+    pthread_mutex_t lock;
+    // Clusters from first to end (excluded) belong to the group
+    u32 first, end;
+    // Number of free clusters in the group
+    u32 free_count;
+    // Where the search of a free cluster starts
+    u32 hint;
+    // No run of free clusters in the group is longer than this, so searches
+    // of longer ones fail without looking at the clusters
+    u32 longest_run;
+};
+
 /* Abstraction of the fat table that handles cluster information and
  * read/write operations
  */
@@ -31,8 +56,36 @@ struct fat_table_s {
     // Open file descriptor to the volume file or device
     int fd;
     u16 cluster_order;
+    // Where the `struct fat_file_s's of the volume are allocated
+    slab file_slab;
+    // The data clusters divided in allocation groups. Changing an entry from
+    // or to free needs the lock of the group of the cluster. Other changes
+    // are only done to chains of files that are locked.
+    struct fat_alloc_group_s *groups;
+    u32 num_groups;
+    // Changed atomically after writing the clusters
+    u32 *generations;
 };
 
+/* Part of a buffer with the data of a whole cluster, read when the cluster
+ * had the generation @generation (see fat_file_pread_clusters)
+ */
+struct fat_cluster_read_s {
+    size_t start;
+    u32 cluster;
+    u32 generation;
+};
+
+/* Divides the data clusters of @table in allocation groups and counts their
+ * free clusters, and starts their generations. Must be called after mapping
+ * the FAT into memory.
+ * Returns -1 and sets errno to ENOMEM if there is no memory.
+ */
+int fat_table_init_groups(fat_table table);
+
+/* Frees the allocation groups and the generations of @table */
+void fat_table_destroy_groups(fat_table table);
+
 bool fat_table_is_valid_cluster_number(const fat_table table, u32 cluster);
 
 /* Get the next cluster in the chain of clusters for @cur_cluster.
@@ -61,9 +114,42 @@ size_t fat_table_get_cluster_remaining_bytes(fat_table table,
 /* Calculates the number of clusters necessary to fit @size bytes. */
 u32 fat_table_get_clusters_for_size(fat_table table, size_t file_size);
 
-/* Returns the number of the first unused cluster in the data sector. */
+/* Returns the number of an unused cluster in the data sector, or
+ * FAT_CLUSTER_END_OF_CHAIN if there is none. The cluster may be taken by
+ * other thread before it's used, to get a cluster for a new chain use
+ * fat_table_alloc_cluster instead.
+ */
 u32 fat_table_get_next_free_cluster(fat_table table);
 
+/* Marks an unused cluster as the end of a new chain, and returns it. The
+ * cluster is taken from the allocation group of the calling thread, or from
+ * other group if it has none free.
+ * In error returns FAT_CLUSTER_END_OF_CHAIN.
+ */
+u32 fat_table_alloc_cluster(fat_table table);
+
+/* Returns the allocation group where the calling thread allocates first.
+ * Threads get consecutive groups in the order they allocate for the first
+ * time.
+ */
+u32 fat_table_home_group(const fat_table table);
+
+/* Returns the allocation group at the end of the volume, the last one that
+ * threads get as their home group.
+ */
+u32 fat_table_last_group(const fat_table table);
+
+/* Marks @count consecutive unused clusters as a new chain, and returns the
+ * first one. The clusters from @near are taken if they are free, so a chain
+ * can grow without gaps, otherwise they are searched from the allocation
+ * @group on: the home group for the files of the calling thread, or the last
+ * group to keep them away from those. @count can't be more than
+ * FAT_TABLE_GROUP_CLUSTERS.
+ * In error returns FAT_CLUSTER_END_OF_CHAIN and sets errno to ENOSPC if there
+ * is no such run of clusters.
+ */
+u32 fat_table_alloc_run(fat_table table, u32 near, u32 count, u32 group);
+
 /* Returns the offset in bytes to the address where @cluster starts. */
 off_t fat_table_cluster_offset(const fat_table table, u32 cluster);
 
@@ -89,6 +175,15 @@ u32 fat_table_seek_cluster(fat_table table, u32 start_cluster, off_t offset);
  */
 u32 fat_table_add_new_cluster_to_chain(fat_table table, u32 last_cluster);
 
+/* Returns the generation of the data of @cluster. It changes every time the
+ * cluster is written, so the data read from it with the same generation is
+ * the same. It can also change when other clusters are written.
+ */
+u32 fat_table_cluster_generation(const fat_table table, u32 cluster);
+
+/* Changes the generation of @cluster, after writing its data */
+void fat_table_cluster_written(fat_table table, u32 cluster);
+
 /* Returns true if @cluster is the end of the cluster chain */
 bool fat_table_is_EOC(fat_table table, u32 cluster);
 
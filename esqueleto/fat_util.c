@@ -94,6 +94,19 @@ int fill_time(le16 *entry_date, le16 *entry_time, const time_t t) {
     return 0;
 }
 
+/* Start of the hours already converted by time_to_unix_time. FAT times are
+ * local, and mktime is slow and takes a global lock to read the time zone.
+ * Offsets only change at the start of an hour, so the minutes and seconds
+ * are added to the cached start.
+ */
+#define TIME_CACHE_SIZE 256
+struct time_cache_entry {
+    // Date and hour of the entry, plus one so 0 is an empty entry
+    u32 key;
+    time_t hour_start;
+};
+static __thread struct time_cache_entry time_cache[TIME_CACHE_SIZE];
+
 time_t time_to_unix_time(u16 le_date, u16 le_time) {
     u16 date = le16_to_cpu(le_date), time = le16_to_cpu(le_time);
     // FAT dates are years since 1980.  mktime() expects years since 1900.
@@ -110,9 +123,15 @@ time_t time_to_unix_time(u16 le_date, u16 le_time) {
     // multiply by 2.
     u16 seconds = (time & 0x1f) * 2;
 
+    u32 key = ((u32)date << 5 | hours) + 1;
+    struct time_cache_entry *entry = &time_cache[key % TIME_CACHE_SIZE];
+    if (entry->key == key) {
+        return entry->hour_start + minutes * 60 + seconds;
+    }
+
     struct tm tm = {
-        .tm_sec = seconds,
-        .tm_min = minutes,
+        .tm_sec = 0,
+        .tm_min = 0,
         .tm_hour = hours,
         .tm_mday = day,
         .tm_mon = month,
@@ -121,5 +140,11 @@ time_t time_to_unix_time(u16 le_date, u16 le_time) {
         .tm_yday = 0,
         .tm_isdst = -1,
     };
-    return mktime(&tm);
+    time_t hour_start = mktime(&tm);
+    if (hour_start == -1) {
+        return -1;
+    }
+    entry->key = key;
+    entry->hour_start = hour_start;
+    return hour_start + minutes * 60 + seconds;
 }
@@ -62,6 +62,8 @@ int fill_time(le16 *entry_date, le16 *entry_time, const time_t t);
 
 /* Given a 16-bit FAT date and 16-bit FAT time in the eccentric FAT format,
  * return a standard UNIX time (seconds since January 1, 1970).
+ * Each thread remembers the last hours it converted, so converting the times
+ * of files modified close together is just some arithmetic.
  */
 time_t time_to_unix_time(u16 le_date, u16 le_time);
 
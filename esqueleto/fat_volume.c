@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -291,25 +292,23 @@ static int map_fat(fat_volume vol, int fd, int mount_flags) {
 }
 
 static fat_file init_root_dir(fat_volume vol) {
-    fat_dir_entry root_entry =
-        fat_file_init_direntry(true, "/", vol->root_dir_start_cluster);
-    fat_file root_dir = fat_file_init_empty(true, strdup("/"));
-    if (errno != 0) {
-        free(root_entry);
-        free(root_dir);
-        free(vol);
+    fat_file root_dir = fat_file_init_empty(vol->table, true);
+    if (root_dir == NULL) {
         return NULL;
     }
-    root_dir->dentry = root_entry;
+    fat_file_init_direntry(&root_dir->dentry, true, "/",
+                           vol->root_dir_start_cluster);
     root_dir->start_cluster = vol->root_dir_start_cluster; // Only FAT32
-    root_dir->table = vol->table;
     return root_dir;
 }
 
 static fat_volume init_file_tree(fat_volume vol) {
     fat_file root_dir = init_root_dir(vol);
     vol->file_tree = fat_tree_init();
+    fat_tree_set_epoch(vol->file_tree, vol->reclaim);
     vol->file_tree = fat_tree_insert(vol->file_tree, NULL, root_dir);
+    // The kernel always knows the root, it never looks it up
+    fat_volume_inode_ref(vol, fat_tree_node_search(vol->file_tree, "/"));
     return vol;
 }
 
@@ -368,9 +367,36 @@ fat_volume fat_volume_mount(const char *volume, int mount_flags) {
 
     // Initialize other fields of the `struct fat_volume_s'
     vol->table->fd = fd; // File descriptor to use when reading data
+    vol->table->file_slab = slab_init(sizeof(struct fat_file_s));
+    vol->reclaim = epoch_init();
+    vol->negative_cache = fat_negative_cache_init();
+    if (vol->table->file_slab == NULL || vol->reclaim == NULL ||
+        vol->negative_cache == NULL || fat_table_init_groups(vol->table) != 0) {
+        slab_destroy(vol->table->file_slab);
+        epoch_destroy(vol->reclaim);
+        fat_negative_cache_destroy(vol->negative_cache);
+        munmap(vol->table->fat_map,
+               (size_t)vol->sectors_per_fat << vol->sector_order);
+        close(fd);
+        free(vol->table);
+        free(vol);
+        vol = NULL;
+        return vol;
+    }
+    slab_set_epoch(vol->table->file_slab, vol->reclaim);
+    pthread_rwlock_init(&vol->tree_lock, NULL);
+    for (int i = 0; i < FAT_VOLUME_FILE_LOCKS; i++) {
+        pthread_rwlock_init(&vol->file_locks[i], NULL);
+    }
+    vol->inodes = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                                        NULL);
+    vol->inode_generations = g_hash_table_new_full(
+        g_int64_hash, g_int64_equal, g_free, g_free);
+    pthread_rwlock_init(&vol->inode_lock, NULL);
     vol->mount_flags = mount_flags;
     // Arbitrary soft limit, to keep memory usage down.
-    vol->max_allocated_files = 100;
+    vol->max_allocated_files = FAT_DEFAULT_MAX_ALLOCATED_FILES;
+    g_queue_init(&vol->dir_lru);
 
     // Compute the offset of the first byte of the data area so it doesn't
     // need to be re-calculated over and over.
@@ -393,8 +419,180 @@ int fat_volume_unmount(fat_volume vol) {
     ret = close(vol->table->fd);
     munmap(vol->table->fat_map,
            (size_t)vol->sectors_per_fat << vol->sector_order);
-    fat_tree_destroy(vol->file_tree);
+    // All the nodes and files are released at once with their slabs
+    fat_tree_discard(vol->file_tree);
+    slab_destroy(vol->table->file_slab);
+    epoch_destroy(vol->reclaim);
+    fat_negative_cache_destroy(vol->negative_cache);
+    for (int i = 0; i < FAT_VOLUME_FILE_LOCKS; i++) {
+        pthread_rwlock_destroy(&vol->file_locks[i]);
+    }
+    pthread_rwlock_destroy(&vol->tree_lock);
+    g_hash_table_destroy(vol->inodes);
+    g_hash_table_destroy(vol->inode_generations);
+    pthread_rwlock_destroy(&vol->inode_lock);
+    fat_table_destroy_groups(vol->table);
     free(vol->table);
     free(vol);
     return ret;
-}
\ No newline at end of file
+}
+
+pthread_rwlock_t *fat_volume_file_lock(fat_volume vol, const fat_file file) {
+    // Files are slab objects of the same size, the low bits are always equal
+    uintptr_t hash = (uintptr_t)file / sizeof(struct fat_file_s);
+    return &vol->file_locks[hash % FAT_VOLUME_FILE_LOCKS];
+}
+
+fat_tree_node fat_volume_inode_get(fat_volume vol, u64 ino) {
+    pthread_rwlock_rdlock(&vol->inode_lock);
+    fat_tree_node node = g_hash_table_lookup(vol->inodes, &ino);
+    pthread_rwlock_unlock(&vol->inode_lock);
+    return node;
+}
+
+void fat_volume_inode_ref(fat_volume vol, fat_tree_node node) {
+    fat_file file = fat_tree_get_file(node);
+    pthread_rwlock_wrlock(&vol->inode_lock);
+    if (file->nlookup++ == 0) {
+        u64 *ino = g_new(u64, 1);
+        *ino = fat_file_inode(file);
+        g_hash_table_insert(vol->inodes, ino, node);
+    }
+    pthread_rwlock_unlock(&vol->inode_lock);
+}
+
+fat_tree_node fat_volume_inode_unref(fat_volume vol, u64 ino, u64 *nlookup) {
+    pthread_rwlock_wrlock(&vol->inode_lock);
+    fat_tree_node node = g_hash_table_lookup(vol->inodes, &ino);
+    if (node == NULL) {
+        // Deleted while the kernel still knew it
+        *nlookup = 0;
+    } else {
+        fat_file file = fat_tree_get_file(node);
+        if (*nlookup > file->nlookup) {
+            *nlookup = file->nlookup;
+        }
+        file->nlookup -= *nlookup;
+        if (file->nlookup == 0) {
+            g_hash_table_remove(vol->inodes, &ino);
+        }
+    }
+    pthread_rwlock_unlock(&vol->inode_lock);
+    return node;
+}
+
+u64 fat_volume_inode_drop(fat_volume vol, fat_tree_node node) {
+    fat_file file = fat_tree_get_file(node);
+    u64 ino = fat_file_inode(file);
+    pthread_rwlock_wrlock(&vol->inode_lock);
+    u64 nlookup = file->nlookup;
+    if (nlookup > 0) {
+        g_hash_table_remove(vol->inodes, &ino);
+        file->nlookup = 0;
+    }
+    u64 *generation = g_hash_table_lookup(vol->inode_generations, &ino);
+    if (generation == NULL) {
+        u64 *key = g_new(u64, 1);
+        *key = ino;
+        generation = g_new0(u64, 1);
+        g_hash_table_insert(vol->inode_generations, key, generation);
+    }
+    (*generation)++;
+    pthread_rwlock_unlock(&vol->inode_lock);
+    return nlookup;
+}
+
+u64 fat_volume_inode_generation(fat_volume vol, u64 ino) {
+    pthread_rwlock_rdlock(&vol->inode_lock);
+    u64 *generation = g_hash_table_lookup(vol->inode_generations, &ino);
+    u64 result = generation != NULL ? *generation : 0;
+    pthread_rwlock_unlock(&vol->inode_lock);
+    return result;
+}
+
+void fat_volume_add_dir(fat_volume vol, fat_tree_node dir_node) {
+    fat_file dir = fat_tree_get_file(dir_node);
+    if (dir->parent == NULL || !dir->children_read) {
+        return;
+    }
+    GList *link = &dir->dir.lru_link;
+    if (link->data != NULL) {
+        g_queue_unlink(&vol->dir_lru, link);
+    }
+    link->data = dir_node;
+    g_queue_push_head_link(&vol->dir_lru, link);
+}
+
+void fat_volume_touch_dir(fat_volume vol, fat_tree_node dir_node) {
+    fat_file dir = fat_tree_get_file(dir_node);
+    __atomic_store_n(&dir->dir.lru_referenced, true, __ATOMIC_RELAXED);
+}
+
+void fat_volume_forget_dir(fat_volume vol, fat_tree_node dir_node) {
+    fat_file dir = fat_tree_get_file(dir_node);
+    GList *link = &dir->dir.lru_link;
+    if (!fat_file_is_directory(dir) || link->data == NULL) {
+        return;
+    }
+    g_queue_unlink(&vol->dir_lru, link);
+    link->data = NULL;
+}
+
+/* Forgets all the directories inside the one in @dir_node, recursively. */
+static void forget_subdirs(fat_volume vol, fat_tree_node dir_node) {
+    fat_file *children = fat_tree_flatten_h_children(dir_node);
+    for (fat_file *child = children; child != NULL && *child != NULL;
+         child++) {
+        if (!fat_file_is_directory(*child) ||
+            (*child)->dir.lru_link.data == NULL) {
+            continue; // It has no children in memory
+        }
+        fat_tree_node child_node = (*child)->dir.lru_link.data;
+        forget_subdirs(vol, child_node);
+        fat_volume_forget_dir(vol, child_node);
+    }
+    free(children);
+}
+
+/* Removes the children of the directory in @dir_node from the tree. */
+static void evict_dir(fat_volume vol, fat_tree_node dir_node) {
+    fat_file dir = fat_tree_get_file(dir_node);
+    DEBUG("Evicting children of %s", dir->name);
+    forget_subdirs(vol, dir_node);
+    fat_volume_forget_dir(vol, dir_node);
+    vol->file_tree = fat_tree_delete_children(vol->file_tree, dir_node);
+    dir->children_read = 0;
+}
+
+void fat_volume_evict(fat_volume vol) {
+    // Files are opened without the tree lock. Starting the modification
+    // before checking the counters makes those opens fail and retry with it.
+    fat_tree_write_begin(vol->file_tree);
+    // Each directory can get a second chance at most once
+    guint second_chances = g_queue_get_length(&vol->dir_lru);
+    GList *link = g_queue_peek_tail_link(&vol->dir_lru);
+    while (link != NULL &&
+           (size_t)fat_tree_size(vol->file_tree) > vol->max_allocated_files) {
+        fat_tree_node dir_node = link->data;
+        fat_file dir = fat_tree_get_file(dir_node);
+        if (__atomic_load_n(&dir->num_times_opened, __ATOMIC_SEQ_CST) != 0) {
+            link = link->prev; // Still in use, try with a newer one
+            continue;
+        }
+        if (second_chances > 0 &&
+            __atomic_exchange_n(&dir->dir.lru_referenced, false,
+                                __ATOMIC_RELAXED)) {
+            // Used since it was read, move it to the head
+            second_chances--;
+            GList *prev = link->prev;
+            g_queue_unlink(&vol->dir_lru, link);
+            g_queue_push_head_link(&vol->dir_lru, link);
+            link = prev;
+            continue;
+        }
+        evict_dir(vol, dir_node);
+        // Evicting may remove other directories from the list, start again
+        link = g_queue_peek_tail_link(&vol->dir_lru);
+    }
+    fat_tree_write_end(vol->file_tree);
+}
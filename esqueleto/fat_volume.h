@@ -3,21 +3,57 @@
 
 #include "fat_file.h"
 #include "fat_fs_tree.h"
+#include "fat_negative_cache.h"
 #include "fat_table.h"
 #include "fat_types.h"
+#include <pthread.h>
 #include <sys/types.h>
 
 #define FAT_MOUNT_FLAG_READONLY 0x1
 #define FAT_MOUNT_FLAG_READWRITE 0x2
 
+#define FAT_DEFAULT_MAX_ALLOCATED_FILES 65536
+
+// Number of locks shared by the files of a volume, see fat_volume_file_lock
+#define FAT_VOLUME_FILE_LOCKS 64
+
 struct fat_volume_s {
     fat_table table;
     // Flags passed to fat_volume_mount()
     int mount_flags;
     // Tree of directories and files. In memory structure
     fat_tree file_tree;
-    // Maximum number of `struct fat_file_s's to allocate (soft limit only)
+    // Delays the reuse of the files and nodes removed from file_tree, so
+    // lookups can search it without locking tree_lock
+    epoch reclaim;
+    // Names known not to exist, added with the tree lock held for writing
+    fat_negative_cache negative_cache;
+    // Protects file_tree, dir_lru and the fields of the files that are not
+    // protected by their own lock (names, parents, children_read). Taken for
+    // writing to add, remove or reorder files. Lookups that find the file
+    // don't need it (see fat_tree_node_search_lockless).
+    pthread_rwlock_t tree_lock;
+    // Protect the data, size and cluster chain of the files, and their
+    // entry in the parent directory. Each file uses one of them.
+    pthread_rwlock_t file_locks[FAT_VOLUME_FILE_LOCKS];
+    // Files that the kernel holds references to, by inode number (see
+    // fat_file_inode). The data is the tree node. Protected by inode_lock.
+    GHashTable *inodes;
+    // Generation of the inode numbers of the files deleted so far, that the
+    // next files with the same number take. Protected by inode_lock.
+    GHashTable *inode_generations;
+    pthread_rwlock_t inode_lock;
+    // Maximum number of `struct fat_file_s's to allocate (soft limit only, open
+    // files and their ancestors are never evicted)
     size_t max_allocated_files;
+    // Directories with their children in memory, except for the root. The
+    // most recently used is the head.
+    GQueue dir_lru;
+    // Writer of fs.log while the volume is mounted with FUSE, or NULL
+    struct fat_logger_s *logger;
+    // Threads that scan the reads and writes for the log, or NULL to do it
+    // in the requests (see fat_fuse_scan_threads)
+    struct scan_pool_s *scanner;
     // Standard boot sector info
     char oem_name[8 + 1];
     // Data from DOS 2.0 BIOS Parameter Block
@@ -59,4 +95,65 @@ fat_volume fat_volume_mount(const char *volume, int mount_flags);
 /* Unmount FAT volume @vol */
 int fat_volume_unmount(fat_volume vol);
 
+/* Returns the lock for the data of @file. Different files can share a lock,
+ * so a thread must not hold two of them at once.
+ */
+pthread_rwlock_t *fat_volume_file_lock(fat_volume vol, const fat_file file);
+
+/* Returns the node of the file with inode number @ino, if the kernel holds a
+ * reference to it, or NULL otherwise. Files are removed from the tree with the
+ * tree lock held for writing, and retired with the epoch of the volume, so the
+ * node is valid while the caller holds the tree lock or is in a read section.
+ */
+fat_tree_node fat_volume_inode_get(fat_volume vol, u64 ino);
+
+/* Adds a reference of the kernel to the file in @node, adding it to the inode
+ * table if it's the first one. The caller must keep the file in the tree while
+ * it's referenced (see fat_tree_inc_num_times_opened).
+ */
+void fat_volume_inode_ref(fat_volume vol, fat_tree_node node);
+
+/* Removes up to @nlookup references of the kernel to the file with inode
+ * number @ino, and sets @nlookup to the number removed. Returns the node of
+ * the file, or NULL if it had no references. The file is removed from the
+ * inode table when it has none left.
+ */
+fat_tree_node fat_volume_inode_unref(fat_volume vol, u64 ino, u64 *nlookup);
+
+/* Removes the file in @node from the inode table, before deleting it, and
+ * returns the number of references it had. The next file that gets its inode
+ * number has a new generation.
+ */
+u64 fat_volume_inode_drop(fat_volume vol, fat_tree_node node);
+
+/* Returns the generation of the inode number @ino: the number of files with it
+ * that were deleted while the volume is mounted. Inode numbers are reused by
+ * the files created in the same place (see fat_file_inode), the pair of both
+ * is not.
+ */
+u64 fat_volume_inode_generation(fat_volume vol, u64 ino);
+
+/* Adds the directory in @dir_node as the most recently used one, after
+ * reading its children. The root directory is ignored.
+ * The tree lock must be held for writing.
+ */
+void fat_volume_add_dir(fat_volume vol, fat_tree_node dir_node);
+
+/* Marks that the directory in @dir_node has been used, so it's not evicted
+ * before the ones that weren't. It can be called without locks.
+ */
+void fat_volume_touch_dir(fat_volume vol, fat_tree_node dir_node);
+
+/* Removes the directory in @dir_node from the list of directories with their
+ * children read. Must be called before deleting it from the tree.
+ */
+void fat_volume_forget_dir(fat_volume vol, fat_tree_node dir_node);
+
+/* While there are more than max_allocated_files files in the tree, removes
+ * the children of the least recently used directory that is not opened, and
+ * marks it as not read. As all writes go directly to disk there is nothing to
+ * save, the children will be read again on the next readdir.
+ */
+void fat_volume_evict(fat_volume vol);
+
 #endif /* _FAT_VOLUME_H */
@@ -43,9 +43,21 @@ struct h_tree_s {
     int size;              // number of elements in subtrees + 1
 };
 
-static h_tree h_node_init(void *new_data, h_tree h_parent) {
+/* The links of the search tree can be read without locks by
+ * h_tree_search_concurrent, so they are written with release semantics: a
+ * reader that reaches a node also sees it initialized.
+ */
+#define publish(link, node) __atomic_store_n(&(link), (node), __ATOMIC_RELEASE)
+#define follow(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+
+slab h_tree_node_slab_init(void) { return slab_init(sizeof(struct h_tree_s)); }
+
+static h_tree h_node_init(void *new_data, h_tree h_parent, slab node_slab) {
     h_tree new_node;
-    new_node = malloc(sizeof(struct h_tree_s));
+    new_node = slab_alloc(node_slab);
+    if (new_node == NULL) {
+        return NULL;
+    }
     new_node->data = new_data;
     new_node->left = NULL;
     new_node->right = NULL;
@@ -72,7 +84,7 @@ void h_tree_destroy(h_tree root, data_modify_fn data_destroy) {
     if (root->left != NULL) {
         h_tree_destroy(root->left, data_destroy);
     }
-    free(root);
+    slab_free(root);
 }
 
 /***************** ACCESORS *****************/
@@ -98,6 +110,20 @@ h_tree h_tree_get_h_parent(const h_tree root) {
     return root->h_parent;
 }
 
+h_tree h_tree_get_h_children(const h_tree root) {
+    if (root == NULL) {
+        return NULL;
+    }
+    return root->h_children;
+}
+
+h_tree h_tree_get_h_next_sibling(const h_tree root) {
+    if (root == NULL) {
+        return NULL;
+    }
+    return root->h_next_sibling;
+}
+
 /* Returs a pointer to the node whose value is equal to @key */
 h_tree h_tree_search(const h_tree root, const void *key,
                      data_cmp_fn data_cmp_key) {
@@ -118,27 +144,55 @@ h_tree h_tree_search(const h_tree root, const void *key,
     return root; // it's this one!
 }
 
+h_tree h_tree_search_concurrent(const h_tree root, const void *key,
+                                data_cmp_fn data_cmp_key) {
+    if (key == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (root == NULL) {
+        return NULL;
+    }
+    // Nodes moved by a writer could make the search go around in circles
+    int max_steps = __atomic_load_n(&root->size, __ATOMIC_RELAXED) + 1;
+    h_tree node = root;
+    while (node != NULL && max_steps-- > 0) {
+        int smaller_data = data_cmp_key(node->data, key);
+        if (smaller_data == 0) {
+            return node;
+        }
+        node = smaller_data < 0 ? follow(node->right) : follow(node->left);
+    }
+    return NULL;
+}
+
 /***************** MODIFIERS *****************/
 static inline void update_size(h_tree root) {
-    root->size = 1 + h_tree_size(root->left) + h_tree_size(root->right);
+    __atomic_store_n(&root->size,
+                     1 + h_tree_size(root->left) + h_tree_size(root->right),
+                     __ATOMIC_RELAXED);
 }
 
 h_tree h_tree_insert(h_tree root, void *new_data, h_tree h_parent,
-                     data_cmp_fn data_cmp) {
+                     data_cmp_fn data_cmp, slab node_slab) {
     if (new_data == NULL) {
         errno = EINVAL;
         return root;
     }
     if (root == NULL) {
-        h_tree new_node = h_node_init(new_data, h_parent);
+        h_tree new_node = h_node_init(new_data, h_parent, node_slab);
         return new_node;
     }
 
     int cmp = data_cmp(new_data, root->data);
     if (cmp > 0) { // x is greater. Should be inserted to right
-        root->right = h_tree_insert(root->right, new_data, h_parent, data_cmp);
+        publish(root->right, h_tree_insert(root->right, new_data, h_parent,
+                                           data_cmp, node_slab));
     } else if (cmp < 0) { // x is smaller should be inserted to left
-        root->left = h_tree_insert(root->left, new_data, h_parent, data_cmp);
+        publish(root->left, h_tree_insert(root->left, new_data, h_parent,
+                                          data_cmp, node_slab));
+    } else {
+        errno = EEXIST;
     }
     update_size(root);
     return root;
@@ -146,18 +200,6 @@ h_tree h_tree_insert(h_tree root, void *new_data, h_tree h_parent,
 
 static inline bool is_minimum(const h_tree root) { return root->left == NULL; }
 
-static void swap_nodes(h_tree old_file, h_tree new_file) {
-    h_tree temp_old_l = NULL, temp_old_r = NULL;
-    temp_old_l = old_file->left;
-    temp_old_r = old_file->right;
-    old_file->left = new_file->left;
-    old_file->right = new_file->right;
-    new_file->left = temp_old_l;
-    new_file->right = temp_old_r;
-    update_size(new_file);
-    update_size(old_file);
-}
-
 /* Remove a child node from the hierarchy. This does not affect tree structure.
  * Child parent is set to NULL
  */
@@ -193,26 +235,30 @@ static h_tree delete_root(h_tree root, data_modify_fn data_destroy) {
         } else {
             minimum = root->left;
         }
-        free(root);
+        slab_free(root);
         return minimum;
     }
-    // Two Children. Copy min child data reference of right tree to current root
+    // Two Children. The minimum node of the right tree takes the place of root
     h_tree minimum_parent = root->right;
     if (is_minimum(minimum_parent)) {
-        minimum_parent->left = root->left;
+        publish(minimum_parent->left, root->left);
         update_size(minimum_parent);
-        free(root);
+        slab_free(root);
         return minimum_parent;
     }
-    minimum = minimum_parent->left; // We are sure it's not null
-    minimum_parent->size--;         // We will eventually remove one child
-    while (!is_minimum(minimum)) {
-        minimum = minimum->left;
-        minimum_parent = minimum;
-        minimum_parent->size--; // We will eventually remove one child
+    while (!is_minimum(minimum_parent->left)) {
+        minimum_parent = minimum_parent->left;
+    }
+    minimum = minimum_parent->left;
+    // Every node in the way to the minimum loses one element
+    for (h_tree node = root->right; node != minimum; node = node->left) {
+        __atomic_store_n(&node->size, node->size - 1, __ATOMIC_RELAXED);
     }
-    swap_nodes(root, minimum);
-    minimum_parent->left = delete_root(root, data_destroy);
+    publish(minimum_parent->left, minimum->right);
+    publish(minimum->left, root->left);
+    publish(minimum->right, root->right);
+    update_size(minimum);
+    slab_free(root);
     return minimum;
 }
 
@@ -230,16 +276,33 @@ h_tree h_tree_delete(h_tree root, const void *key, data_cmp_fn data_cmp_key,
         return delete_root(root, data_destroy);
     }
     if (cmp < 0) {
-        root->right =
-            h_tree_delete(root->right, key, data_cmp_key, data_destroy);
+        publish(root->right,
+                h_tree_delete(root->right, key, data_cmp_key, data_destroy));
     } else if (cmp > 0) {
-        root->left = h_tree_delete(root->left, key, data_cmp_key, data_destroy);
+        publish(root->left,
+                h_tree_delete(root->left, key, data_cmp_key, data_destroy));
     }
     // If key is not present in the tree, nothing changes.
     update_size(root);
     return root;
 }
 
+h_tree h_tree_delete_h_children(h_tree root, h_tree h_node,
+                                data_cmp_fn data_cmp,
+                                data_modify_fn data_destroy) {
+    if (root == NULL || h_node == NULL) {
+        return root;
+    }
+    // Deleting a node removes it from the children list of h_node
+    while (h_node->h_children != NULL) {
+        h_tree h_child = h_node->h_children;
+        root = h_tree_delete_h_children(root, h_child, data_cmp, data_destroy);
+        // The data is also the key of the node
+        root = h_tree_delete(root, h_child->data, data_cmp, data_destroy);
+    }
+    return root;
+}
+
 /************* ITERATORS ********************/
 
 void h_tree_iterate_preorder(h_tree root, data_modify_fn mod_fn) {
@@ -25,6 +25,7 @@
 #ifndef HIERARCHY_TREE_H
 #define HIERARCHY_TREE_H
 
+#include "slab.h"
 #include <stdlib.h>
 
 // Function to compare two h_node_tree->data in the tree
@@ -33,6 +34,12 @@ typedef void (*data_modify_fn)(void *d1);
 
 typedef struct h_tree_s *h_tree;
 
+/* Returns a new slab where the nodes of a tree can be allocated, to be used
+ * with h_tree_insert. Destroying the slab frees all the nodes of the
+ * trees that used it at once, without traversing them.
+ */
+slab h_tree_node_slab_init(void);
+
 /* Destroys every node in @tree, and applies @data_destroy function to the
  * data field.
  */
@@ -53,6 +60,17 @@ void *h_tree_get_data(const h_tree root);
  */
 h_tree h_tree_get_h_parent(const h_tree root);
 
+/* Returns a reference to the first h_child of @root, or NULL if it has none.
+ * New h_children are added at the front, so they are ordered from the last
+ * inserted to the first one.
+ */
+h_tree h_tree_get_h_children(const h_tree root);
+
+/* Returns a reference to the h_child of @root's h_parent that follows @root,
+ * or NULL if @root is the last one.
+ */
+h_tree h_tree_get_h_next_sibling(const h_tree root);
+
 /* Returns a reference to the node in @root that matches @key accoding to
  * @data_cmp_key. I.e, data_cmp_key(node->data, key) == 0
  * If @key is not found, returns NULL. If @key is NULL, sets errno to EINVAL.
@@ -62,17 +80,29 @@ h_tree h_tree_get_h_parent(const h_tree root);
 h_tree h_tree_search(const h_tree root, const void *key,
                      data_cmp_fn data_cmp_key);
 
+/* Same as h_tree_search, but it can run while other thread modifies the tree.
+ * The nodes removed by the writer must not be reused until the search ends
+ * (see slab_set_epoch). The result may be wrong if the tree changed during
+ * the search, so the caller must check it didn't.
+ */
+h_tree h_tree_search_concurrent(const h_tree root, const void *key,
+                                data_cmp_fn data_cmp_key);
+
 /* Inserts @new_data into @tree using the funcition @data_cmp to determine the
  * location of the new node in the tree. To correctly retrieve the node, the
  * same @data_cmp function must be used when calling h_tree_search and
  * h_tree_delete.
  * @h_parent should be a reference to the parent of @new_data in the hierarchy,
  * and must be a node of @tree. It may be NULL.
+ * The new node is allocated from @node_slab, that must have been created with
+ * h_tree_node_slab_init. All the nodes of a tree must come from the same slab.
  * The TAD is the owner of the reference to @new_data and will destroy it when
  * destroying the whole tree.
+ * If an element equal to @new_data is already in @tree, nothing is inserted,
+ * errno is set to EEXIST and the caller keeps the reference to @new_data.
  */
 h_tree h_tree_insert(h_tree tree, void *new_data, h_tree h_parent,
-                     data_cmp_fn data_cmp);
+                     data_cmp_fn data_cmp, slab node_slab);
 
 /* Deletes @key from @tree using the funcition @data_cmp to determine the
  * location of the node in the tree. The function @data_destroy will be applied
@@ -82,6 +112,15 @@ h_tree h_tree_insert(h_tree tree, void *new_data, h_tree h_parent,
 h_tree h_tree_delete(h_tree tree, const void *key, data_cmp_fn data_cmp_key,
                      data_modify_fn data_destroy);
 
+/* Deletes from @tree all the descendants of @h_node in the hierarchy, starting
+ * from the deepest ones. @h_node itself is kept. The function @data_destroy
+ * will be applied to every deleted node, and @data_cmp is the function used
+ * to insert them.
+ */
+h_tree h_tree_delete_h_children(h_tree tree, h_tree h_node,
+                                data_cmp_fn data_cmp,
+                                data_modify_fn data_destroy);
+
 /* Applies the function @mod_fn to all elements in @tree, in pre-order. */
 void h_tree_iterate_preorder(h_tree tree, data_modify_fn mod_fn);
 
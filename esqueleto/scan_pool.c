@@ -0,0 +1,164 @@
+/*
+ * scan_pool.c
+ *
+ * Pool of threads that run jobs in the background.
+ *
+ * A single lock protects the queues and the count of bytes: jobs are big
+ * (a read or a write each), so it's taken a few times per job at most. Each
+ * thread has its own FIFO queue and waits on its own condition, so a job only
+ * wakes the thread that runs it.
+ */
+
+#include "scan_pool.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct scan_pool_worker_s {
+    scan_pool pool;
+    pthread_t thread;
+    // Signaled when a job is queued or the pool stops
+    pthread_cond_t wake;
+    struct scan_pool_job_s *head;
+    struct scan_pool_job_s *tail;
+    // Jobs queued and run so far, for scan_pool_sync
+    uint64_t queued;
+    uint64_t done;
+};
+
+struct scan_pool_s {
+    pthread_mutex_t lock;
+    // Signaled when jobs are run, for the threads waiting for space or syncs
+    pthread_cond_t space_cond;
+    pthread_cond_t done_cond;
+    size_t max_bytes;
+    size_t bytes; // Of the jobs queued or running
+    bool stop;
+    unsigned int num_workers;
+    struct scan_pool_worker_s workers[];
+};
+
+static void *worker_main(void *arg) {
+    struct scan_pool_worker_s *worker = arg;
+    scan_pool pool = worker->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (worker->head == NULL && !pool->stop) {
+            pthread_cond_wait(&worker->wake, &pool->lock);
+        }
+        struct scan_pool_job_s *job = worker->head;
+        if (job == NULL) {
+            break; // Stopped, and every job was run
+        }
+        worker->head = job->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        size_t bytes = job->bytes;
+        job->fn(job);
+        pthread_mutex_lock(&pool->lock);
+        pool->bytes -= bytes;
+        worker->done++;
+        pthread_cond_broadcast(&pool->space_cond);
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Stops the first @num_started threads of @pool and frees it */
+static void pool_stop(scan_pool pool, unsigned int num_started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    for (unsigned int i = 0; i < num_started; i++) {
+        pthread_cond_signal(&pool->workers[i].wake);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned int i = 0; i < num_started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (unsigned int i = 0; i < pool->num_workers; i++) {
+        pthread_cond_destroy(&pool->workers[i].wake);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->space_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+scan_pool scan_pool_init(unsigned int num_threads, size_t max_bytes) {
+    scan_pool pool = calloc(1, sizeof(struct scan_pool_s) +
+                                   num_threads *
+                                       sizeof(struct scan_pool_worker_s));
+    if (pool == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    pool->max_bytes = max_bytes;
+    pool->num_workers = num_threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->space_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (unsigned int i = 0; i < num_threads; i++) {
+        pool->workers[i].pool = pool;
+        pthread_cond_init(&pool->workers[i].wake, NULL);
+    }
+    for (unsigned int i = 0; i < num_threads; i++) {
+        int err = pthread_create(&pool->workers[i].thread, NULL, worker_main,
+                                 &pool->workers[i]);
+        if (err != 0) {
+            pool_stop(pool, i);
+            errno = err;
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void scan_pool_submit(scan_pool pool, size_t key, struct scan_pool_job_s *job) {
+    // Keys are usually addresses, whose low bits are all alike
+    uint64_t hash = (uint64_t)key * 0x9e3779b97f4a7c15ULL;
+    struct scan_pool_worker_s *worker =
+        &pool->workers[(hash >> 32) % pool->num_workers];
+
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    while (pool->bytes != 0 && pool->bytes + job->bytes > pool->max_bytes) {
+        pthread_cond_wait(&pool->space_cond, &pool->lock);
+    }
+    pool->bytes += job->bytes;
+    if (worker->tail == NULL) {
+        worker->head = job;
+    } else {
+        worker->tail->next = job;
+    }
+    worker->tail = job;
+    worker->queued++;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void scan_pool_sync(scan_pool pool) {
+    uint64_t targets[SCAN_POOL_MAX_THREADS];
+
+    pthread_mutex_lock(&pool->lock);
+    // Jobs submitted while waiting are not waited for
+    for (unsigned int i = 0; i < pool->num_workers; i++) {
+        targets[i] = pool->workers[i].queued;
+    }
+    for (unsigned int i = 0; i < pool->num_workers; i++) {
+        // Each thread runs its jobs in order
+        while (pool->workers[i].done < targets[i]) {
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void scan_pool_destroy(scan_pool pool) {
+    pool_stop(pool, pool->num_workers);
+}
@@ -0,0 +1,55 @@
+/*
+ * scan_pool.h
+ *
+ * Pool of threads that run jobs in the background, in order of arrival for
+ * the jobs with the same key.
+ *
+ * Each job has a key, and all the jobs of a key go to the same thread, one
+ * after the other. The jobs carry the bytes they hold, and when the jobs
+ * queued add up to the limit of the pool, the threads that submit wait for
+ * them to finish, so the memory they use stays bounded however fast they
+ * arrive.
+ */
+
+#ifndef _SCAN_POOL_H
+#define _SCAN_POOL_H
+
+#include <stddef.h>
+
+// Most threads of a pool
+#define SCAN_POOL_MAX_THREADS 64
+
+typedef struct scan_pool_s *scan_pool;
+
+struct scan_pool_job_s;
+
+/* Runs @job in a thread of the pool. It can free @job. */
+typedef void (*scan_pool_fn)(struct scan_pool_job_s *job);
+
+/* Job to embed in the data of each one (see container_of) */
+struct scan_pool_job_s {
+    scan_pool_fn fn;
+    size_t bytes; // Counted in the limit of the pool until it's run
+    struct scan_pool_job_s *next; // Used by the pool
+};
+
+/* Starts a pool of @num_threads threads, where up to @max_bytes of jobs can
+ * be queued.
+ * Returns NULL and sets errno if the threads can't be started.
+ *
+ * PRE: 0 < @num_threads <= SCAN_POOL_MAX_THREADS
+ */
+scan_pool scan_pool_init(unsigned int num_threads, size_t max_bytes);
+
+/* Queues @job after the other ones of @key. Waits first if the pool is full,
+ * unless it's empty: a job bigger than the limit is run alone.
+ */
+void scan_pool_submit(scan_pool pool, size_t key, struct scan_pool_job_s *job);
+
+/* Waits until the jobs submitted before the call have been run */
+void scan_pool_sync(scan_pool pool);
+
+/* Runs the jobs still queued, stops the threads and frees @pool */
+void scan_pool_destroy(scan_pool pool);
+
+#endif /* _SCAN_POOL_H */
@@ -0,0 +1,192 @@
+/*
+ * slab.c
+ *
+ * Allocators for the in memory metadata of a mounted volume.
+ */
+
+#include "slab.h"
+#include "fat_util.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SLAB_ALIGN 16
+#define round_up(n, align) (((n) + (align)-1) & ~((size_t)(align)-1))
+
+/* Every chunk starts with this header. The objects come right after it. */
+struct slab_chunk_s {
+    slab owner;
+    struct slab_chunk_s *next;
+};
+
+#define SLAB_FIRST_OBJ_OFFSET                                                  \
+    round_up(sizeof(struct slab_chunk_s), SLAB_ALIGN)
+
+/* Freed objects are linked through their first bytes */
+struct slab_free_obj_s {
+    struct slab_free_obj_s *next;
+};
+
+/* An object in the limbo. Readers may still be using its contents, so it's
+ * not overwritten until it's moved to the free list.
+ */
+struct slab_limbo_entry_s {
+    void *obj;
+    unsigned long retired; // Epoch it was freed on
+};
+
+struct slab_s {
+    size_t obj_size;
+    // List of all the chunks, the first one is where new objects are carved
+    struct slab_chunk_s *chunks;
+    // Offset of the first never used byte in the first chunk
+    size_t chunk_used;
+    struct slab_free_obj_s *free_list;
+    size_t count;
+    // If not NULL, freed objects wait in the limbo until it's safe to reuse
+    // them. The limbo is in the order they were freed, entries from
+    // limbo_first to limbo_len are still waiting.
+    epoch reclaim;
+    struct slab_limbo_entry_s *limbo;
+    size_t limbo_first, limbo_len, limbo_capacity;
+};
+
+slab slab_init(size_t obj_size) {
+    assert(obj_size < SLAB_CHUNK_SIZE / 2);
+    slab s = calloc(1, sizeof(struct slab_s));
+    if (s == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    s->obj_size = round_up(max(obj_size, sizeof(struct slab_free_obj_s)),
+                           SLAB_ALIGN);
+    s->chunks = NULL;
+    s->chunk_used = SLAB_CHUNK_SIZE; // Forces a new chunk on first alloc
+    s->free_list = NULL;
+    s->count = 0;
+    s->reclaim = NULL;
+    s->limbo = NULL;
+    s->limbo_first = s->limbo_len = s->limbo_capacity = 0;
+    return s;
+}
+
+void slab_destroy(slab s) {
+    if (s == NULL) {
+        return;
+    }
+    struct slab_chunk_s *chunk = s->chunks, *next = NULL;
+    while (chunk != NULL) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(s->limbo);
+    free(s);
+}
+
+/* Adds a new chunk to @s, where the following objects will be carved. */
+static int add_chunk(slab s) {
+    struct slab_chunk_s *chunk =
+        aligned_alloc(SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE);
+    if (chunk == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    chunk->owner = s;
+    chunk->next = s->chunks;
+    s->chunks = chunk;
+    s->chunk_used = SLAB_FIRST_OBJ_OFFSET;
+    return 0;
+}
+
+void slab_set_epoch(slab s, epoch e) { s->reclaim = e; }
+
+/* Moves the objects of the limbo that no reader can use to the free list. */
+static void reclaim_limbo(slab s) {
+    while (s->limbo_first < s->limbo_len &&
+           epoch_is_safe(s->reclaim, s->limbo[s->limbo_first].retired)) {
+        struct slab_free_obj_s *free_obj = s->limbo[s->limbo_first].obj;
+        free_obj->next = s->free_list;
+        s->free_list = free_obj;
+        s->limbo_first++;
+    }
+    if (s->limbo_first == s->limbo_len) {
+        s->limbo_first = s->limbo_len = 0;
+    }
+}
+
+/* Adds @obj to the limbo of @s. If there is no memory for it, @obj is never
+ * reused.
+ */
+static void add_to_limbo(slab s, void *obj) {
+    if (s->limbo_len == s->limbo_capacity && s->limbo_first > 0) {
+        // Move the waiting entries to the start
+        s->limbo_len -= s->limbo_first;
+        memmove(s->limbo, s->limbo + s->limbo_first,
+                s->limbo_len * sizeof(struct slab_limbo_entry_s));
+        s->limbo_first = 0;
+    }
+    if (s->limbo_len == s->limbo_capacity) {
+        size_t new_capacity = max(2 * s->limbo_capacity, (size_t)64);
+        struct slab_limbo_entry_s *new_limbo = reallocarray(
+            s->limbo, new_capacity, sizeof(struct slab_limbo_entry_s));
+        if (new_limbo == NULL) {
+            return;
+        }
+        s->limbo = new_limbo;
+        s->limbo_capacity = new_capacity;
+    }
+    // Readers that found @obj before it was removed must see the epoch it's
+    // retired on as already started
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s->limbo[s->limbo_len].obj = obj;
+    s->limbo[s->limbo_len].retired = epoch_current(s->reclaim);
+    s->limbo_len++;
+}
+
+void *slab_alloc(slab s) {
+    void *obj = NULL;
+    if (s->free_list == NULL && s->limbo_first < s->limbo_len) {
+        reclaim_limbo(s);
+    }
+    if (s->free_list != NULL) {
+        obj = s->free_list;
+        s->free_list = s->free_list->next;
+    } else {
+        if (s->chunk_used + s->obj_size > SLAB_CHUNK_SIZE && add_chunk(s)) {
+            return NULL;
+        }
+        obj = (char *)s->chunks + s->chunk_used;
+        s->chunk_used += s->obj_size;
+    }
+    s->count++;
+    memset(obj, 0, s->obj_size);
+    return obj;
+}
+
+void slab_free(void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    // Chunks are aligned to their size, so the header is found by masking
+    uintptr_t chunk_mask = ~(uintptr_t)(SLAB_CHUNK_SIZE - 1);
+    struct slab_chunk_s *chunk = (struct slab_chunk_s *)((uintptr_t)obj &
+                                                         chunk_mask);
+    slab s = chunk->owner;
+    struct slab_free_obj_s *free_obj = obj;
+    s->count--;
+    if (s->reclaim != NULL) {
+        add_to_limbo(s, obj);
+        return;
+    }
+    free_obj->next = s->free_list;
+    s->free_list = free_obj;
+}
+
+size_t slab_count(const slab s) {
+    if (s == NULL) {
+        return 0;
+    }
+    return s->count;
+}
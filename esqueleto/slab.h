@@ -0,0 +1,57 @@
+/*
+ * slab.h
+ *
+ * Allocator for the in memory metadata of a mounted volume.
+ *
+ * A slab hands out objects of a single fixed size, carved from big chunks of
+ * memory. Freed objects are kept in a free list and reused by the following
+ * allocations, and destroying the slab releases all the chunks at once, no
+ * matter how many objects are still alive.
+ *
+ * A slab can be attached to an epoch domain when its objects are read without
+ * locks. Freed objects are then kept aside until no reader can reach them.
+ * Either way, allocating and freeing objects of a slab must be serialized by
+ * the caller.
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "epoch.h"
+#include <stdlib.h>
+
+/* Size in bytes of every chunk requested to the system. Chunks are aligned to
+ * this size, so the chunk of an object can be found by masking its address.
+ */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+typedef struct slab_s *slab;
+
+/* Initializes a new slab for objects of @obj_size bytes.
+ * @obj_size must be smaller than SLAB_CHUNK_SIZE / 2.
+ * Returns NULL and sets errno to ENOMEM if there is no memory.
+ */
+slab slab_init(size_t obj_size);
+
+/* Frees every chunk of @s. Objects that were not freed become invalid. */
+void slab_destroy(slab s);
+
+/* Returns a new zeroed object of @s. If there is no memory, returns NULL and
+ * sets errno to ENOMEM.
+ */
+void *slab_alloc(slab s);
+
+/* Returns @obj to the slab it was allocated from. @obj may be NULL.
+ * If the slab has an epoch, @obj is not reused until it's safe.
+ */
+void slab_free(void *obj);
+
+/* Makes the objects freed from @s wait until no reader of @e can be using
+ * them before being allocated again.
+ */
+void slab_set_epoch(slab s, epoch e);
+
+/* Returns the number of objects of @s that are currently allocated. */
+size_t slab_count(const slab s);
+
+#endif /* _SLAB_H */
@@ -6,12 +6,17 @@
 
 #include "mock_fat_file.h"
 
-fat_file fat_file_init(fat_volume vol, bool is_dir, char *filepath) {
+fat_file fat_file_init(fat_volume vol, fat_file parent, bool is_dir,
+                       char *filepath) {
     return filepath;
 }
 
 void fat_file_destroy(fat_file file) { free(file); }
 
+char *fat_file_path(const fat_file file, char *buf) {
+    return strcpy(buf, file);
+}
+
 int fat_file_cmp(fat_file file1, fat_file file2) {
     return strcmp(file1, file2);
 }
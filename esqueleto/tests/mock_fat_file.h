@@ -6,10 +6,13 @@
 typedef char *fat_file;
 typedef void *fat_volume;
 
-fat_file fat_file_init(fat_volume vol, bool is_dir, char *filepath);
+fat_file fat_file_init(fat_volume vol, fat_file parent, bool is_dir,
+                       char *filepath);
 
 void fat_file_destroy(fat_file file);
 
+char *fat_file_path(const fat_file file, char *buf);
+
 int fat_file_cmp(fat_file file1, fat_file file2);
 
 int fat_file_cmp_path(fat_file file1, char *filepath);
@@ -0,0 +1,275 @@
+/*
+ * Tests for the scan of censored words of the clusters read, compared with
+ * the scan of the same requests as a stream
+ *
+ */
+
+#include "big_brother.h"
+#include "epoch.h"
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_RANDOM_LISTS 40
+#define MAX_RANDOM_WORDS 6
+#define MAX_RANDOM_WORD_LEN 8
+// Writes to the file of each list, and requests between two of them, in
+// sequences of consecutive ones
+#define WRITES_PER_LIST 16
+#define REQUESTS_PER_WRITE 128
+#define FILE_CLUSTERS 64
+#define MAX_CLUSTER_SIZE 256
+
+// Bytes of the random words and files, few so that the words are found
+static const char *alphabet = "abcABC x";
+
+static const size_t cluster_sizes[] = {16, 64, MAX_CLUSTER_SIZE};
+#define NUM_CLUSTER_SIZES (sizeof(cluster_sizes) / sizeof(cluster_sizes[0]))
+
+#define WORDS_PATH_TEMPLATE "/tmp/test_big_brother_XXXXXX"
+
+char words_path[sizeof(WORDS_PATH_TEMPLATE)];
+epoch reclaim = NULL;
+
+/* Writes @words, ended by NULL, in the file of the words */
+static void words_write(char *const *words) {
+    FILE *file = fopen(words_path, "w");
+    fail_unless(file != NULL);
+    for (size_t i = 0; words[i] != NULL; i++) {
+        fprintf(file, "%s\n", words[i]);
+    }
+    fail_unless(fclose(file) == 0);
+}
+
+/* Uses @words, ended by NULL, from now on */
+static void words_use(char *const *words) {
+    words_write(words);
+    censored_words_list old = censored_words_reload();
+    fail_unless(old != NULL);
+    censored_words_release(old);
+}
+
+static void words_setup(void) {
+    char *words[] = {"ab", NULL};
+    strcpy(words_path, WORDS_PATH_TEMPLATE);
+    int fd = mkstemp(words_path);
+    fail_unless(fd != -1);
+    close(fd);
+    words_write(words);
+    reclaim = epoch_init();
+    fail_unless(reclaim != NULL);
+    fail_unless(censored_words_load(words_path, reclaim));
+}
+
+static void words_teardown(void) {
+    censored_words_free();
+    epoch_destroy(reclaim);
+    unlink(words_path);
+}
+
+/* Returns the next pseudo random number of @seed (xorshift64*) */
+static u64 test_random(u64 *seed) {
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 0x2545f4914f6cdd1dULL;
+}
+
+/* Fills the @size bytes of @buf with bytes of the alphabet */
+static void random_fill(char *buf, size_t size, u64 *seed) {
+    size_t num_chars = strlen(alphabet);
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = alphabet[test_random(seed) % num_chars];
+    }
+}
+
+/* File whose clusters are scanned, with their generations */
+struct test_file_s {
+    char data[FILE_CLUSTERS * MAX_CLUSTER_SIZE];
+    u32 generations[FILE_CLUSTERS];
+    size_t cluster_size;
+    size_t size;
+};
+
+/* Changes some bytes of @file, and the generations of their clusters */
+static void file_write(struct test_file_s *file, u64 *seed) {
+    size_t num_bytes = 1 + test_random(seed) % 4;
+    for (size_t i = 0; i < num_bytes; i++) {
+        size_t pos = test_random(seed) % file->size;
+        random_fill(file->data + pos, 1, seed);
+        file->generations[pos / file->cluster_size]++;
+    }
+}
+
+/* Sets in @reads a random part of the whole clusters of @file in the @size
+ * bytes from @offset, in order, and returns their number. The clusters left
+ * out leave gaps between the others.
+ */
+static size_t random_reads(const struct test_file_s *file, size_t offset,
+                           size_t size, struct fat_cluster_read_s *reads,
+                           u64 *seed) {
+    size_t cluster_size = file->cluster_size;
+    size_t num_reads = 0;
+    bool all = test_random(seed) % 2 == 0;
+    for (size_t c = (offset + cluster_size - 1) / cluster_size;
+         (c + 1) * cluster_size <= offset + size; c++) {
+        if (all || test_random(seed) % 3 != 0) {
+            reads[num_reads].start = c * cluster_size - offset;
+            reads[num_reads].cluster = c + 2; // The first data cluster
+            reads[num_reads].generation = file->generations[c];
+            num_reads++;
+        }
+    }
+    return num_reads;
+}
+
+/* Scans sequences of consecutive requests of @file from random offsets,
+ * with censored_words_found_stream and censored_words_found_clusters
+ */
+static void check_requests(const struct test_file_s *file, u64 *seed) {
+    struct fat_cluster_read_s reads[FILE_CLUSTERS];
+    struct censored_words_stream_s stream = {0}, clusters = {0};
+    size_t cluster_size = file->cluster_size;
+    size_t offset = file->size;
+    for (size_t r = 0; r < REQUESTS_PER_WRITE; r++) {
+        if (offset == file->size) {
+            // A new sequence, often from the start of a cluster
+            offset = test_random(seed) % file->size;
+            if (test_random(seed) % 2 == 0) {
+                offset -= offset % cluster_size;
+            }
+            stream.state = WORD_MATCHER_START;
+            clusters.state = WORD_MATCHER_START;
+        }
+        // Whole clusters often, so the next one starts with one
+        size_t size = test_random(seed) % 2 == 0
+                          ? cluster_size * (1 + test_random(seed) % 4)
+                          : 1 + test_random(seed) % (4 * cluster_size);
+        if (size > file->size - offset) {
+            size = file->size - offset;
+        }
+        size_t num_reads = random_reads(file, offset, size, reads, seed);
+        epoch_enter(reclaim);
+        u32 expected = censored_words_found_stream(&stream,
+                                                   file->data + offset, size);
+        u32 found = censored_words_found_clusters(
+            &clusters, file->data + offset, size, reads, num_reads,
+            cluster_size);
+        epoch_exit(reclaim);
+        fail_unless(found == expected);
+        fail_unless(clusters.version == stream.version);
+        offset += size;
+    }
+}
+
+START_TEST(test_clusters_random) {
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    char storage[MAX_RANDOM_WORDS][MAX_RANDOM_WORD_LEN + 1];
+    char *words[MAX_RANDOM_WORDS + 1];
+    struct test_file_s *file = malloc(sizeof(struct test_file_s));
+    fail_unless(file != NULL);
+    for (size_t l = 0; l < NUM_RANDOM_LISTS; l++) {
+        size_t num_words = 1 + test_random(&seed) % MAX_RANDOM_WORDS;
+        for (size_t i = 0; i < num_words; i++) {
+            size_t len = 1 + test_random(&seed) % MAX_RANDOM_WORD_LEN;
+            random_fill(storage[i], len, &seed);
+            storage[i][len] = '\0';
+            words[i] = storage[i];
+        }
+        words[num_words] = NULL;
+        words_use(words);
+
+        memset(file->generations, 0, sizeof(file->generations));
+        file->cluster_size =
+            cluster_sizes[test_random(&seed) % NUM_CLUSTER_SIZES];
+        file->size = FILE_CLUSTERS * file->cluster_size;
+        random_fill(file->data, file->size, &seed);
+        // The clusters are read again and again, from the cache, until they
+        // are written
+        for (size_t w = 0; w < WRITES_PER_LIST; w++) {
+            check_requests(file, &seed);
+            file_write(file, &seed);
+        }
+    }
+    free(file);
+}
+END_TEST
+
+/* The words of a cluster read again unchanged come from the cache, the
+ * contents of the buffer are not looked at
+ */
+START_TEST(test_clusters_cache_hit) {
+    struct fat_cluster_read_s read = {.start = 0, .cluster = 7,
+                                      .generation = 1};
+    struct censored_words_stream_s stream = {0};
+    char buf[16];
+    memset(buf, 'x', sizeof(buf));
+    memcpy(buf + 4, "ab", 2);
+    epoch_enter(reclaim);
+    fail_unless(censored_words_found_clusters(&stream, buf, sizeof(buf),
+                                              &read, 1, sizeof(buf)) == 1);
+    // Only the cache knows that the word is there
+    memset(buf, 'x', sizeof(buf));
+    fail_unless(censored_words_found_clusters(&stream, buf, sizeof(buf),
+                                              &read, 1, sizeof(buf)) == 1);
+    // Around the ends of the clusters the bytes are scanned
+    read.start = 2;
+    read.cluster = 8;
+    memcpy(buf + 1, "ab", 2);
+    fail_unless(censored_words_found_clusters(&stream, buf, 2 + 8, &read, 1,
+                                              8) == 1);
+    epoch_exit(reclaim);
+}
+END_TEST
+
+/* A cluster is scanned again when it was written, or the words changed */
+START_TEST(test_clusters_cache_miss) {
+    struct fat_cluster_read_s read = {.start = 0, .cluster = 7,
+                                      .generation = 1};
+    struct censored_words_stream_s stream = {0};
+    char buf[16];
+    memset(buf, 'x', sizeof(buf));
+    memcpy(buf + 4, "ab", 2);
+    epoch_enter(reclaim);
+    fail_unless(censored_words_found_clusters(&stream, buf, sizeof(buf),
+                                              &read, 1, sizeof(buf)) == 1);
+    memset(buf, 'x', sizeof(buf));
+    read.generation++;
+    fail_unless(censored_words_found_clusters(&stream, buf, sizeof(buf),
+                                              &read, 1, sizeof(buf)) == 0);
+    epoch_exit(reclaim);
+
+    // The same words, with a new version
+    char *words[] = {"ab", NULL};
+    memcpy(buf + 4, "ab", 2);
+    words_use(words);
+    epoch_enter(reclaim);
+    fail_unless(censored_words_found_clusters(&stream, buf, sizeof(buf),
+                                              &read, 1, sizeof(buf)) == 1);
+    epoch_exit(reclaim);
+}
+END_TEST
+
+Suite *big_brother_suite(void) {
+    Suite *test_suit = suite_create("big_brother");
+    TCase *tcase_functionality = tcase_create("Censored words functions");
+    tcase_add_checked_fixture(tcase_functionality, words_setup,
+                              words_teardown);
+    tcase_add_test(tcase_functionality, test_clusters_random);
+    tcase_add_test(tcase_functionality, test_clusters_cache_hit);
+    tcase_add_test(tcase_functionality, test_clusters_cache_miss);
+    suite_add_tcase(test_suit, tcase_functionality);
+
+    return test_suit;
+}
+
+int main() {
+    SRunner *runner = srunner_create(big_brother_suite());
+
+    srunner_set_log(runner, "test.log");
+    srunner_run_all(runner, CK_NORMAL);
+    srunner_free(runner);
+    return 0;
+}
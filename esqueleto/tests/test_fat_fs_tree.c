@@ -15,7 +15,8 @@
 static fat_tree insert_many_files(fat_tree tree, int n, char **filenames) {
     int original_size = fat_tree_size(tree);
     for (int i = 0; i < n; i++) {
-        fat_file new_file = fat_file_init(NULL, false, strdup(filenames[i]));
+        fat_file new_file =
+            fat_file_init(NULL, NULL, false, strdup(filenames[i]));
         tree = fat_tree_insert(tree, NULL, new_file);
         fail_unless(fat_tree_size(tree) == original_size + i + 1);
     }
@@ -56,7 +57,7 @@ END_TEST
 
 START_TEST(test_insert_null_tree) {
     fat_tree new_tree = NULL;
-    fat_file new_file = fat_file_init(NULL, false, strdup("f"));
+    fat_file new_file = fat_file_init(NULL, NULL, false, strdup("f"));
     new_tree = fat_tree_insert(NULL, NULL, new_file);
     fail_unless(new_tree == NULL);
     fail_unless(errno == EINVAL);
@@ -66,7 +67,7 @@ END_TEST
 
 START_TEST(test_insert_one) {
     fat_tree new_tree = NULL;
-    fat_file new_file = fat_file_init(NULL, false, strdup("f"));
+    fat_file new_file = fat_file_init(NULL, NULL, false, strdup("f"));
     tree = fat_tree_init();
     new_tree = fat_tree_insert(tree, NULL, new_file);
     fail_unless(fat_tree_size(new_tree) == 1);
@@ -100,7 +101,7 @@ END_TEST
 
 START_TEST(test_search_small_tree) {
     fat_file found_node = NULL;
-    fat_file new_file = fat_file_init(NULL, false, strdup("f1"));
+    fat_file new_file = fat_file_init(NULL, NULL, false, strdup("f1"));
     tree = fat_tree_init();
     tree = fat_tree_insert(tree, NULL, new_file);
     found_node = fat_tree_search(tree, "f1");
@@ -140,19 +141,19 @@ START_TEST(test_increase_time_opened) {
     h_tree node1 = NULL, node11 = NULL, node12 = NULL, node111 = NULL;
 
     tree = fat_tree_init();
-    new_file = fat_file_init(NULL, false, strdup("f1"));
+    new_file = fat_file_init(NULL, NULL, false, strdup("f1"));
     tree = fat_tree_insert(tree, NULL, new_file);
     node1 = fat_tree_node_search(tree, "f1");
 
-    new_file = fat_file_init(NULL, false, strdup("f1.1"));
+    new_file = fat_file_init(NULL, NULL, false, strdup("f1.1"));
     tree = fat_tree_insert(tree, node1, new_file);
     node11 = fat_tree_node_search(tree, "f1.1");
 
-    new_file = fat_file_init(NULL, false, strdup("f1.2"));
+    new_file = fat_file_init(NULL, NULL, false, strdup("f1.2"));
     tree = fat_tree_insert(tree, node1, new_file);
     node12 = fat_tree_node_search(tree, "f1.2");
 
-    new_file = fat_file_init(NULL, false, strdup("f1.1.1"));
+    new_file = fat_file_init(NULL, NULL, false, strdup("f1.1.1"));
     tree = fat_tree_insert(tree, node11, new_file);
     node111 = fat_tree_node_search(tree, "f1.1.1");
 
@@ -0,0 +1,582 @@
+/*
+ * Tests for the writer of the activity log, fat_logger, and the lines that
+ * the tools print for its binary entries, log_print
+ *
+ */
+
+#include "big_brother.h"
+#include "epoch.h"
+#include "fat_fs_tree.h"
+#include "fat_logger.h"
+#include "fat_table.h"
+#include "fat_volume.h"
+#include "slab.h"
+#include "tools/log_print.h"
+#include <check.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Volume of 16 MiB, enough for the chunks reserved by two loggers
+#define VOLUME_CLUSTERS 4096
+#define CLUSTER_ORDER 12
+
+// Producers that log at the same time, several turns of the ring each
+#define NUM_PRODUCERS 4
+#define RECORDS_PER_PRODUCER (3 * FAT_LOGGER_RING_SIZE)
+#define FIRST_PRODUCER_UID 1000
+
+// Paths numbered in the binary logs of the tests
+#define MAX_TEST_PATHS 16
+// Accesses read back from a log
+#define MAX_TEST_ACCESSES (NUM_PRODUCERS * RECORDS_PER_PRODUCER)
+
+#define NUM_FILES 4
+
+#define IMAGE_PATH_TEMPLATE "/tmp/test_fat_logger_XXXXXX"
+#define WORDS_PATH_TEMPLATE "/tmp/test_fat_logger_words_XXXXXX"
+
+static const char *file_paths[NUM_FILES] = {
+    "/abcdefg.txt", "/hijklmn.txt", "/opqrstu.txt", "/vwxyzab.txt"};
+
+struct fat_table_s table;
+struct fat_volume_s vol;
+fat_tree_node root_node = NULL;
+// Logs of the text and the binary loggers, with their indexes
+fat_tree_node text_log = NULL, text_index = NULL;
+fat_tree_node binary_log = NULL, binary_index = NULL;
+fat_file files[NUM_FILES];
+char words_path[sizeof(WORDS_PATH_TEMPLATE)];
+epoch reclaim = NULL;
+
+/* Auxiliary functions */
+
+/* Creates the file @path in the root, and returns its node */
+static fat_tree_node add_file(const char *path) {
+    fat_file root = fat_tree_get_file(root_node);
+    errno = 0;
+    fat_file file = fat_file_init(&table, root, false, path);
+    fail_unless(file != NULL && errno == 0);
+    vol.file_tree = fat_tree_insert(vol.file_tree, root_node, file);
+    fat_file_dentry_add_child(root, file);
+    fail_unless(errno == 0);
+    fat_tree_node node = fat_tree_node_search(vol.file_tree, path);
+    fail_unless(node != NULL);
+    return node;
+}
+
+/* Writes @words, ended by NULL, in the file of the words */
+static void words_write(char *const *words) {
+    FILE *file = fopen(words_path, "w");
+    fail_unless(file != NULL);
+    for (size_t i = 0; words[i] != NULL; i++) {
+        fprintf(file, "%s\n", words[i]);
+    }
+    fail_unless(fclose(file) == 0);
+}
+
+/* Returns the version of the censored words in use */
+static u32 words_version(void) {
+    u32 version = 0;
+    epoch_enter(reclaim);
+    censored_words_found("", 0, &version);
+    epoch_exit(reclaim);
+    return version;
+}
+
+static void volume_setup(void) {
+    char image_path[] = IMAGE_PATH_TEMPLATE;
+    memset(&table, 0, sizeof(table));
+    table.num_data_clusters = VOLUME_CLUSTERS;
+    table.cluster_order = CLUSTER_ORDER;
+    table.fat_map = calloc(VOLUME_CLUSTERS + 2, sizeof(le32));
+    table.data_start_offset = (VOLUME_CLUSTERS + 2) * sizeof(le32);
+    table.fd = mkstemp(image_path);
+    unlink(image_path);
+    table.file_slab = slab_init(sizeof(struct fat_file_s));
+    fail_unless(table.fat_map != NULL && table.fd != -1 &&
+                table.file_slab != NULL);
+    fail_unless(fat_table_init_groups(&table) == 0);
+
+    memset(&vol, 0, sizeof(vol));
+    vol.table = &table;
+    pthread_rwlock_init(&vol.tree_lock, NULL);
+    for (size_t i = 0; i < FAT_VOLUME_FILE_LOCKS; i++) {
+        pthread_rwlock_init(&vol.file_locks[i], NULL);
+    }
+    fat_file root = fat_file_init_empty(&table, true);
+    fail_unless(root != NULL);
+    u32 root_cluster = fat_table_alloc_cluster(&table);
+    fat_file_init_direntry(&root->dentry, true, "/", root_cluster);
+    root->start_cluster = root_cluster;
+    vol.file_tree = fat_tree_insert(fat_tree_init(), NULL, root);
+    root_node = fat_tree_node_search(vol.file_tree, "/");
+    fail_unless(root_node != NULL);
+
+    text_log = add_file("/access.log");
+    text_index = add_file("/access.idx");
+    binary_log = add_file("/binary.log");
+    binary_index = add_file("/binary.idx");
+    for (size_t i = 0; i < NUM_FILES; i++) {
+        files[i] = fat_tree_get_file(add_file(file_paths[i]));
+    }
+
+    char *words[] = {"ab", "cd", NULL};
+    strcpy(words_path, WORDS_PATH_TEMPLATE);
+    int fd = mkstemp(words_path);
+    fail_unless(fd != -1);
+    close(fd);
+    words_write(words);
+    reclaim = epoch_init();
+    fail_unless(reclaim != NULL);
+    fail_unless(censored_words_load(words_path, reclaim));
+}
+
+static void volume_teardown(void) {
+    censored_words_free();
+    epoch_destroy(reclaim);
+    unlink(words_path);
+    fat_tree_destroy(vol.file_tree);
+    for (size_t i = 0; i < FAT_VOLUME_FILE_LOCKS; i++) {
+        pthread_rwlock_destroy(&vol.file_locks[i]);
+    }
+    pthread_rwlock_destroy(&vol.tree_lock);
+    fat_table_destroy_groups(&table);
+    slab_destroy(table.file_slab);
+    close(table.fd);
+    free(table.fat_map);
+}
+
+/* Starts a logger of @log_node, with the index @index_node if not NULL */
+static fat_logger logger_start(fat_tree_node log_node,
+                               fat_tree_node index_node, unsigned int window,
+                               int flags) {
+    fat_logger logger =
+        fat_logger_init(&vol, &log_node, index_node ? &index_node : NULL, 1,
+                        0, window, flags, NULL);
+    fail_unless(logger != NULL);
+    return logger;
+}
+
+/* Returns the contents of the file of @node, ended by a zero, and sets @size
+ * to its number of bytes. Must be freed.
+ */
+static char *file_contents(fat_tree_node node, size_t *size) {
+    fat_file file = fat_tree_get_file(node);
+    *size = file->dentry.file_size;
+    char *buf = malloc(*size + 1);
+    fail_unless(buf != NULL);
+    errno = 0;
+    fail_unless(fat_file_pread(file, buf, *size, 0,
+                               fat_tree_get_file(root_node)) ==
+                (ssize_t)*size);
+    buf[*size] = '\0';
+    return buf;
+}
+
+/* Access read back from a binary log, with the path of its file */
+struct test_access_s {
+    struct fat_log_entry_s entry;
+    char path[FAT_LOGGER_PATH_LEN];
+};
+
+/* Reads the entries of the @size bytes of the binary @log, setting in
+ * @accesses the first @max ones of type FAT_LOG_ENTRY_ACCESS. With @print,
+ * the accesses are printed with log_print_access, after defining their words
+ * with log_define_word. Returns the number of accesses.
+ */
+static size_t binary_decode(const char *log, size_t size,
+                            struct test_access_s *accesses, size_t max,
+                            bool print) {
+    char paths[MAX_TEST_PATHS][FAT_LOGGER_PATH_LEN];
+    size_t num_accesses = 0;
+    size_t offset = 0;
+    while (offset < size) {
+        struct fat_log_entry_s entry;
+        fail_unless(size - offset >= FAT_LOG_ENTRY_SIZE);
+        memcpy(&entry, log + offset, FAT_LOG_ENTRY_SIZE);
+        offset += FAT_LOG_ENTRY_SIZE;
+        switch (entry.type) {
+        case FAT_LOG_ENTRY_HEADER:
+            fail_unless(entry.bytes == FAT_LOG_MAGIC);
+            break;
+        case FAT_LOG_ENTRY_PATH:
+            fail_unless(entry.path_id < MAX_TEST_PATHS);
+            fail_unless(entry.path_len < FAT_LOGGER_PATH_LEN);
+            memcpy(paths[entry.path_id], log + offset, entry.path_len);
+            paths[entry.path_id][entry.path_len] = '\0';
+            offset += fat_log_path_padded_len(entry.path_len);
+            break;
+        case FAT_LOG_ENTRY_WORD:
+            if (print) {
+                fail_unless(log_define_word(entry.path_id, log + offset,
+                                            entry.path_len));
+            }
+            offset += fat_log_path_padded_len(entry.path_len);
+            break;
+        case FAT_LOG_ENTRY_ACCESS:
+            fail_unless(entry.path_id < MAX_TEST_PATHS);
+            if (print) {
+                log_print_access(&entry, paths[entry.path_id]);
+            }
+            if (num_accesses < max) {
+                accesses[num_accesses].entry = entry;
+                strcpy(accesses[num_accesses].path, paths[entry.path_id]);
+            }
+            num_accesses++;
+            break;
+        default:
+            ck_abort_msg("Unknown entry of type %u", entry.type);
+        }
+    }
+    fail_unless(offset == size);
+    return num_accesses;
+}
+
+/* Threads that log at the same time */
+struct producer_s {
+    pthread_t thread;
+    fat_logger logger;
+    uid_t uid;
+    fat_file file;
+};
+
+/* Logs RECORDS_PER_PRODUCER records, with their number as the bytes */
+static void *producer_main(void *arg) {
+    struct producer_s *producer = arg;
+    for (size_t i = 0; i < RECORDS_PER_PRODUCER; i++) {
+        fat_logger_log(producer->logger, producer->uid, FAT_LOG_WRITE,
+                       producer->file, i, 0, 0);
+    }
+    return NULL;
+}
+
+/* The records of each producer are written in the order they were logged,
+ * none lost nor repeated, while the ring wraps around several times.
+ */
+START_TEST(test_ring_concurrent_producers) {
+    struct producer_s producers[NUM_PRODUCERS];
+    fat_logger logger = logger_start(binary_log, NULL, 0, FAT_LOGGER_BINARY);
+    for (size_t i = 0; i < NUM_PRODUCERS; i++) {
+        producers[i].logger = logger;
+        producers[i].uid = FIRST_PRODUCER_UID + i;
+        producers[i].file = files[i];
+        fail_unless(pthread_create(&producers[i].thread, NULL, producer_main,
+                                   &producers[i]) == 0);
+    }
+    for (size_t i = 0; i < NUM_PRODUCERS; i++) {
+        fail_unless(pthread_join(producers[i].thread, NULL) == 0);
+    }
+    fat_logger_sync(logger);
+    fat_logger_destroy(logger);
+
+    size_t size;
+    char *log = file_contents(binary_log, &size);
+    struct test_access_s *accesses =
+        malloc(MAX_TEST_ACCESSES * sizeof(struct test_access_s));
+    fail_unless(accesses != NULL);
+    size_t num_accesses =
+        binary_decode(log, size, accesses, MAX_TEST_ACCESSES, false);
+    fail_unless(num_accesses == MAX_TEST_ACCESSES);
+
+    u64 next[NUM_PRODUCERS] = {0};
+    for (size_t i = 0; i < num_accesses; i++) {
+        const struct fat_log_entry_s *entry = &accesses[i].entry;
+        size_t p = entry->uid - FIRST_PRODUCER_UID;
+        fail_unless(p < NUM_PRODUCERS);
+        fail_unless(strcmp(accesses[i].path, file_paths[p]) == 0);
+        fail_unless(entry->op == FAT_LOG_WRITE && entry->count == 1);
+        fail_unless(entry->flags == 0);
+        fail_unless(entry->bytes == next[p]);
+        next[p]++;
+    }
+    for (size_t p = 0; p < NUM_PRODUCERS; p++) {
+        fail_unless(next[p] == RECORDS_PER_PRODUCER);
+    }
+    free(accesses);
+    free(log);
+}
+END_TEST
+
+/* The records of the same user, operation and file in a window are summed up
+ * in a single access, in the order they were first seen.
+ */
+START_TEST(test_aggregates_merge) {
+    struct test_access_s accesses[8];
+    u32 version = words_version();
+    fat_logger logger =
+        logger_start(binary_log, NULL, 3600, FAT_LOGGER_BINARY);
+    fat_logger_log(logger, 1, FAT_LOG_READ, files[0], 10, 0x1, version);
+    fat_logger_log(logger, 1, FAT_LOG_WRITE, files[0], 5, 0, version);
+    fat_logger_log(logger, 1, FAT_LOG_READ, files[0], 20, 0x2, version);
+    fat_logger_log(logger, 2, FAT_LOG_READ, files[0], 7, 0, version);
+    fat_logger_log(logger, 1, FAT_LOG_READ, files[1], 1, 0, version);
+    fat_logger_log(logger, 1, FAT_LOG_READ, files[0], 3, 0x1, version);
+    // Closes the window, the next records start new aggregates
+    fat_logger_sync(logger);
+    fat_logger_log(logger, 1, FAT_LOG_READ, files[0], 4, 0, version);
+    fat_logger_destroy(logger);
+
+    size_t size;
+    char *log = file_contents(binary_log, &size);
+    fail_unless(binary_decode(log, size, accesses, 8, false) == 5);
+    struct {
+        uid_t uid;
+        fat_log_op op;
+        const char *path;
+        u32 count;
+        u64 bytes;
+        u32 words;
+    } expected[] = {
+        {1, FAT_LOG_READ, file_paths[0], 3, 33, 0x3},
+        {1, FAT_LOG_WRITE, file_paths[0], 1, 5, 0},
+        {2, FAT_LOG_READ, file_paths[0], 1, 7, 0},
+        {1, FAT_LOG_READ, file_paths[1], 1, 1, 0},
+        {1, FAT_LOG_READ, file_paths[0], 1, 4, 0},
+    };
+    for (size_t i = 0; i < 5; i++) {
+        const struct fat_log_entry_s *entry = &accesses[i].entry;
+        fail_unless(entry->uid == expected[i].uid);
+        fail_unless(entry->op == expected[i].op);
+        fail_unless(strcmp(accesses[i].path, expected[i].path) == 0);
+        fail_unless(entry->count == expected[i].count);
+        fail_unless(entry->bytes == expected[i].bytes);
+        fail_unless(entry->words == expected[i].words);
+        fail_unless(entry->flags == FAT_LOG_AGGREGATED);
+    }
+    free(log);
+}
+END_TEST
+
+/* Logs the same record to the text and the binary loggers */
+static void log_both(fat_logger text, fat_logger binary, fat_log_op op,
+                     fat_file file, size_t bytes, u32 words, u32 version) {
+    fat_logger_log(text, getuid(), op, file, bytes, words, version);
+    fat_logger_log(binary, getuid(), op, file, bytes, words, version);
+}
+
+/* The lines printed for the binary log are the ones of the text log, with
+ * the censored words that were in use when each record was logged.
+ */
+START_TEST(test_binary_prints_text) {
+    // Both loggers take the time of each record, in the same minute
+    while (time(NULL) % 60 >= 50) {
+        sleep(1);
+    }
+    fat_logger text = logger_start(text_log, NULL, 0, 0);
+    fat_logger binary = logger_start(binary_log, NULL, 0, FAT_LOGGER_BINARY);
+    u32 first = words_version();
+    log_both(text, binary, FAT_LOG_READ, files[0], 10, 0x1, first);
+    log_both(text, binary, FAT_LOG_WRITE, files[1], 5, 0x3, first);
+    log_both(text, binary, FAT_LOG_READ, files[2], 0, 0, first);
+    fat_logger_sync(text);
+    fat_logger_sync(binary);
+
+    // Other words, while the records of the old ones may still be written
+    char *words[] = {"xy", "ab", "zw", NULL};
+    words_write(words);
+    censored_words_list old = censored_words_reload();
+    fail_unless(old != NULL);
+    u32 second = words_version();
+    fail_unless(second != first);
+    log_both(text, binary, FAT_LOG_READ, files[0], 3, 0x5, second);
+    log_both(text, binary, FAT_LOG_READ, files[1], 4, 0x2, first);
+    log_both(text, binary, FAT_LOG_WRITE, files[2], 8, 0x2, second);
+    fat_logger_sync(text);
+    fat_logger_sync(binary);
+    censored_words_release(old);
+    fat_logger_destroy(text);
+    fat_logger_destroy(binary);
+
+    size_t text_size, binary_size;
+    char *text_contents = file_contents(text_log, &text_size);
+    char *binary_contents = file_contents(binary_log, &binary_size);
+    FILE *printed = tmpfile();
+    fail_unless(printed != NULL);
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    fail_unless(saved_stdout != -1);
+    fail_unless(dup2(fileno(printed), STDOUT_FILENO) != -1);
+    fail_unless(binary_decode(binary_contents, binary_size, NULL, 0,
+                              true) == 6);
+    fflush(stdout);
+    fail_unless(dup2(saved_stdout, STDOUT_FILENO) != -1);
+    close(saved_stdout);
+
+    char *lines = malloc(text_size + 1);
+    fail_unless(lines != NULL);
+    rewind(printed);
+    size_t printed_size = fread(lines, 1, text_size + 1, printed);
+    fail_unless(printed_size == text_size);
+    fail_unless(memcmp(lines, text_contents, text_size) == 0);
+    fail_unless(strstr(text_contents, "\t[xy, zw]\n") != NULL);
+    fail_unless(strstr(text_contents, "\t[cd]\n") != NULL);
+    fail_unless(strstr(text_contents, "\t[ab]\n") != NULL);
+    fclose(printed);
+    free(lines);
+    free(binary_contents);
+    free(text_contents);
+}
+END_TEST
+
+/* Returns the number of entries of the index file @node in @entries, that
+ * must be freed
+ */
+static size_t index_entries(fat_tree_node node,
+                            struct fat_log_index_entry_s **entries) {
+    size_t size;
+    char *index = file_contents(node, &size);
+    fail_unless(size % FAT_LOG_INDEX_ENTRY_SIZE == 0);
+    *entries = (struct fat_log_index_entry_s *)index;
+    return size / FAT_LOG_INDEX_ENTRY_SIZE;
+}
+
+/* Checks that the batches of the index @entries cover the @size bytes of the
+ * log one after the other, and returns their number.
+ */
+static size_t check_index_batches(const struct fat_log_index_entry_s *entries,
+                                  size_t num_entries, size_t size) {
+    size_t num_batches = 0;
+    u64 end = 0;
+    for (size_t i = 0; i < num_entries; i++) {
+        if (entries[i].offset == end) {
+            // The first entry of the next batch
+            fail_unless(entries[i].length != 0);
+            end += entries[i].length;
+            num_batches++;
+        } else {
+            // Other entry of the last one
+            fail_unless(num_batches != 0);
+            fail_unless(entries[i].offset + entries[i].length == end);
+        }
+    }
+    fail_unless(end == size);
+    return num_batches;
+}
+
+/* The entries of the text index point to the batch with the lines of their
+ * file and hour, and every line of a batch has its entry.
+ */
+START_TEST(test_index_text_batches) {
+    struct fat_log_index_entry_s *entries;
+    fat_logger logger = logger_start(text_log, text_index, 0, 0);
+    time_t start = time(NULL);
+    fat_logger_log(logger, getuid(), FAT_LOG_READ, files[0], 1, 0, 0);
+    fat_logger_log(logger, getuid(), FAT_LOG_READ, files[1], 1, 0, 0);
+    fat_logger_sync(logger);
+    fat_logger_log(logger, getuid(), FAT_LOG_WRITE, files[1], 1, 0, 0);
+    fat_logger_log(logger, getuid(), FAT_LOG_READ, files[2], 1, 0, 0);
+    fat_logger_log(logger, getuid(), FAT_LOG_READ, files[1], 1, 0, 0);
+    fat_logger_sync(logger);
+    time_t end = time(NULL);
+    fat_logger_destroy(logger);
+
+    size_t size;
+    char *log = file_contents(text_log, &size);
+    size_t num_entries = index_entries(text_index, &entries);
+    fail_unless(check_index_batches(entries, num_entries, size) >= 2);
+    for (size_t i = 0; i < num_entries; i++) {
+        fail_unless(entries[i].bucket >= start / FAT_LOG_INDEX_BUCKET &&
+                    entries[i].bucket <= end / FAT_LOG_INDEX_BUCKET);
+        fail_unless(entries[i].path_id == 0);
+    }
+
+    // The path of each line is in the index of its batch
+    size_t num_lines = 0;
+    for (char *line = log; line < log + size; num_lines++) {
+        char *newline = strchr(line, '\n');
+        fail_unless(newline != NULL);
+        *newline = '\0';
+        char *path = line;
+        for (size_t field = 0; field < 3; field++) {
+            path = strchr(path, '\t');
+            fail_unless(path != NULL);
+            path++;
+        }
+        char *path_end = strchr(path, '\t');
+        fail_unless(path_end != NULL);
+        *path_end = '\0';
+        u64 hash = fat_log_path_hash(path);
+        u64 offset = line - log;
+        bool found = false;
+        for (size_t i = 0; i < num_entries && !found; i++) {
+            found = entries[i].path_hash == hash &&
+                    entries[i].offset <= offset &&
+                    offset < entries[i].offset + entries[i].length;
+        }
+        fail_unless(found);
+        line = newline + 1;
+    }
+    fail_unless(num_lines == 5);
+    free(entries);
+    free(log);
+}
+END_TEST
+
+/* In binary, the entries of the index have the number of their path in the
+ * batch they point to.
+ */
+START_TEST(test_index_binary_path_ids) {
+    struct fat_log_index_entry_s *entries;
+    struct test_access_s accesses[8];
+    fat_logger logger =
+        logger_start(binary_log, binary_index, 0, FAT_LOGGER_BINARY);
+    fat_logger_log(logger, getuid(), FAT_LOG_READ, files[0], 1, 0, 0);
+    fat_logger_sync(logger);
+    fat_logger_log(logger, getuid(), FAT_LOG_READ, files[1], 1, 0, 0);
+    fat_logger_log(logger, getuid(), FAT_LOG_READ, files[0], 1, 0, 0);
+    fat_logger_sync(logger);
+    fat_logger_destroy(logger);
+
+    size_t size;
+    char *log = file_contents(binary_log, &size);
+    size_t num_entries = index_entries(binary_index, &entries);
+    fail_unless(check_index_batches(entries, num_entries, size) >= 2);
+    fail_unless(binary_decode(log, size, accesses, 8, false) == 3);
+    // Each entry has an access of its batch. The paths of a batch are
+    // defined before it or in it, so the log is read from the start.
+    for (size_t i = 0; i < num_entries; i++) {
+        size_t first =
+            binary_decode(log, entries[i].offset, accesses, 8, false);
+        size_t num_accesses = binary_decode(
+            log, entries[i].offset + entries[i].length, accesses, 8, false);
+        bool found = false;
+        for (size_t a = first; a < num_accesses && !found; a++) {
+            found = accesses[a].entry.path_id == entries[i].path_id &&
+                    fat_log_path_hash(accesses[a].path) ==
+                        entries[i].path_hash;
+        }
+        fail_unless(found);
+    }
+    free(entries);
+    free(log);
+}
+END_TEST
+
+Suite *fat_logger_suite(void) {
+    Suite *test_suit = suite_create("fat_logger");
+    TCase *tcase_functionality = tcase_create("Logger functions");
+    tcase_add_checked_fixture(tcase_functionality, volume_setup,
+                              volume_teardown);
+    tcase_add_test(tcase_functionality, test_ring_concurrent_producers);
+    tcase_add_test(tcase_functionality, test_aggregates_merge);
+    tcase_add_test(tcase_functionality, test_binary_prints_text);
+    tcase_add_test(tcase_functionality, test_index_text_batches);
+    tcase_add_test(tcase_functionality, test_index_binary_path_ids);
+    suite_add_tcase(test_suit, tcase_functionality);
+
+    return test_suit;
+}
+
+int main() {
+    SRunner *runner = srunner_create(fat_logger_suite());
+
+    srunner_set_log(runner, "test.log");
+    srunner_run_all(runner, CK_NORMAL);
+    srunner_free(runner);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Tests for the cache of negative lookups, fat_negative_cache
+ *
+ */
+
+#include "fat_negative_cache.h"
+#include "fat_table.h"
+#include "slab.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Enough directories to find one whose entry collides with another one
+#define MAX_COLLISION_TRIES (64 * FAT_NEGATIVE_CACHE_SIZE)
+
+struct fat_table_s table;
+fat_negative_cache cache = NULL;
+
+static void cache_setup(void) {
+    memset(&table, 0, sizeof(table));
+    table.file_slab = slab_init(sizeof(struct fat_file_s));
+    cache = fat_negative_cache_init();
+    fail_unless(table.file_slab != NULL && cache != NULL);
+}
+
+static void cache_teardown(void) {
+    fat_negative_cache_destroy(cache);
+    slab_destroy(table.file_slab);
+}
+
+/* Same index as the one of fat_negative_cache.c, FNV-1a hash of @name mixed
+ * with the address of @dir
+ */
+static size_t entry_index(const fat_file dir, const char *name) {
+    uint64_t hash = 14695981039346656037ULL ^ (uintptr_t)dir;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    return hash % FAT_NEGATIVE_CACHE_SIZE;
+}
+
+/* Returns a new directory whose entry for @name is the same as the one of
+ * @dir, or NULL if none was found.
+ */
+static fat_file colliding_dir(const fat_file dir, const char *name) {
+    size_t index = entry_index(dir, name);
+    for (size_t i = 0; i < MAX_COLLISION_TRIES; i++) {
+        fat_file other = fat_file_init_empty(&table, true);
+        if (other == NULL) {
+            return NULL;
+        }
+        if (entry_index(other, name) == index) {
+            return other;
+        }
+    }
+    return NULL;
+}
+
+START_TEST(test_lookup_empty) {
+    fat_file dir = fat_file_init_empty(&table, true);
+    fail_unless(!fat_negative_cache_lookup(cache, dir, "missing.txt"));
+}
+END_TEST
+
+START_TEST(test_hit_after_add) {
+    fat_file dir = fat_file_init_empty(&table, true);
+    fat_negative_cache_add(cache, dir, "missing.txt");
+    fail_unless(fat_negative_cache_lookup(cache, dir, "missing.txt"));
+    fail_unless(fat_negative_cache_lookup(cache, dir, "missing.txt"));
+    // Only the name added is known
+    fail_unless(!fat_negative_cache_lookup(cache, dir, "missing.tx"));
+    fail_unless(!fat_negative_cache_lookup(cache, dir, "missing.txt2"));
+}
+END_TEST
+
+START_TEST(test_miss_after_dir_changed) {
+    fat_file dir = fat_file_init_empty(&table, true);
+    fat_file other = fat_file_init_empty(&table, true);
+    fat_negative_cache_add(cache, dir, "missing.txt");
+    fat_negative_cache_add(cache, other, "other.txt");
+    fat_file_dir_changed(dir);
+    fail_unless(!fat_negative_cache_lookup(cache, dir, "missing.txt"));
+    // The entries of other directories are still valid
+    fail_unless(fat_negative_cache_lookup(cache, other, "other.txt"));
+    // And the directory can be cached again in its new generation
+    fat_negative_cache_add(cache, dir, "missing.txt");
+    fail_unless(fat_negative_cache_lookup(cache, dir, "missing.txt"));
+}
+END_TEST
+
+START_TEST(test_miss_colliding_dir) {
+    fat_file dir = fat_file_init_empty(&table, true);
+    fat_file other = colliding_dir(dir, "missing.txt");
+    fail_unless(other != NULL);
+    // Generations are unique, with the same one only the directory tells the
+    // entries apart
+    other->dir.generation = dir->dir.generation;
+    fat_negative_cache_add(cache, dir, "missing.txt");
+    // Same entry and name, but another directory
+    fail_unless(!fat_negative_cache_lookup(cache, other, "missing.txt"));
+    // Adding the other one replaces the entry
+    fat_negative_cache_add(cache, other, "missing.txt");
+    fail_unless(fat_negative_cache_lookup(cache, other, "missing.txt"));
+    fail_unless(!fat_negative_cache_lookup(cache, dir, "missing.txt"));
+}
+END_TEST
+
+START_TEST(test_long_name_ignored) {
+    fat_file dir = fat_file_init_empty(&table, true);
+    char name[MAX_FILENAME + 1];
+    memset(name, 'a', MAX_FILENAME);
+    name[MAX_FILENAME] = '\0';
+    fat_negative_cache_add(cache, dir, name);
+    fail_unless(!fat_negative_cache_lookup(cache, dir, name));
+}
+END_TEST
+
+Suite *negative_cache_suite(void) {
+    Suite *test_suit = suite_create("fat_negative_cache");
+    TCase *tcase_functionality = tcase_create("Negative cache functions");
+    tcase_add_checked_fixture(tcase_functionality, cache_setup,
+                              cache_teardown);
+    tcase_add_test(tcase_functionality, test_lookup_empty);
+    tcase_add_test(tcase_functionality, test_hit_after_add);
+    tcase_add_test(tcase_functionality, test_miss_after_dir_changed);
+    tcase_add_test(tcase_functionality, test_miss_colliding_dir);
+    tcase_add_test(tcase_functionality, test_long_name_ignored);
+    suite_add_tcase(test_suit, tcase_functionality);
+
+    return test_suit;
+}
+
+int main() {
+    SRunner *runner = srunner_create(negative_cache_suite());
+
+    srunner_set_log(runner, "test.log");
+    srunner_run_all(runner, CK_NORMAL);
+    srunner_free(runner);
+    return 0;
+}
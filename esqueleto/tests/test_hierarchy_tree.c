@@ -3,10 +3,12 @@
  *
  */
 
+#include "epoch.h"
 #include "hierarchy_tree.h"
 #include <assert.h>
 #include <check.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -14,12 +16,23 @@
 
 char *test_elems[7] = {"5", "6", "3", "7", "2", "4", "1"};
 
+// Where the nodes of the trees of each test are allocated
+slab node_slab = NULL;
+
+static void node_slab_setup(void) { node_slab = h_tree_node_slab_init(); }
+
+static void node_slab_teardown(void) {
+    slab_destroy(node_slab);
+    node_slab = NULL;
+}
+
 static h_tree add_elem_list(h_tree tree, int size, char **elem_array) {
     void *new_elem = NULL;
     int current_size = h_tree_size(tree);
     for (int i = 0; i < size; ++i) {
         new_elem = (void *)strdup(elem_array[i]);
-        tree = h_tree_insert(tree, new_elem, NULL, (data_cmp_fn)strcmp);
+        tree = h_tree_insert(tree, new_elem, NULL, (data_cmp_fn)strcmp,
+                             node_slab);
         fail_unless(h_tree_size(tree) == current_size + i + 1);
     }
     return tree;
@@ -58,7 +71,7 @@ END_TEST
 
 START_TEST(test_insert_null) {
     void *new_tree = NULL;
-    new_tree = h_tree_insert(tree, NULL, NULL, (data_cmp_fn)strcmp);
+    new_tree = h_tree_insert(tree, NULL, NULL, (data_cmp_fn)strcmp, node_slab);
     fail_unless(h_tree_size(new_tree) == 0);
     fail_unless(new_tree == tree);
     fail_unless(errno == EINVAL);
@@ -66,7 +79,8 @@ START_TEST(test_insert_null) {
 END_TEST
 
 START_TEST(test_insert_null_tree) {
-    tree = h_tree_insert(NULL, strdup("node 1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("node 1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     fail_unless(h_tree_size(tree) == 1);
     fail_unless(strcmp((char *)h_tree_get_data(tree), "node 1") == 0);
     h_tree_destroy(tree, free);
@@ -83,6 +97,23 @@ START_TEST(test_insert_many) {
 }
 END_TEST
 
+START_TEST(test_insert_duplicate) {
+    char *duplicate = strdup("3");
+    tree = add_test_elems(tree);
+    errno = 0;
+    tree = h_tree_insert(tree, duplicate, NULL, (data_cmp_fn)strcmp,
+                         node_slab);
+    fail_unless(errno == EEXIST);
+    fail_unless(h_tree_size(tree) == 7);
+    // The element in the tree is kept, the new one still belongs to the caller
+    fail_unless(h_tree_get_data(h_tree_search(tree, "3",
+                                              (data_cmp_fn)strcmp)) !=
+                duplicate);
+    free(duplicate);
+    h_tree_destroy(tree, free);
+}
+END_TEST
+
 START_TEST(test_search_null_tree) {
     h_tree found_node = h_tree_search(NULL, "1", (data_cmp_fn)strcmp);
     fail_unless(found_node == NULL);
@@ -98,7 +129,8 @@ END_TEST
 
 START_TEST(test_search_small_tree) {
     h_tree found_node = NULL;
-    tree = h_tree_insert(NULL, strdup("1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     found_node = h_tree_search(tree, "1", (data_cmp_fn)strcmp);
     fail_unless(found_node != NULL);
     fail_unless(strcmp((char *)h_tree_get_data(found_node), "1") == 0);
@@ -177,16 +209,79 @@ START_TEST(test_delete_all) {
 }
 END_TEST
 
+/* The successor of the deleted root is deep in the right subtree:
+ *     4
+ *   2    8
+ *      6   9
+ *     5 7
+ */
+START_TEST(test_delete_root_deep_successor) {
+    char *elems[8] = {"4", "2", "8", "6", "9", "5", "7", "3"};
+    char *expected_elems[7] = {"5", "2", "3", "8", "6", "7", "9"};
+    tree = add_elem_list(tree, 8, elems);
+    tree = h_tree_delete(tree, "4", (data_cmp_fn)strcmp, free);
+    fail_unless(h_tree_size(tree) == 7);
+    compare_preorder_list(tree, expected_elems);
+    fail_unless(h_tree_search(tree, "6", (data_cmp_fn)strcmp) != NULL);
+    fail_unless(h_tree_size(h_tree_search(tree, "8", (data_cmp_fn)strcmp)) ==
+                4);
+    h_tree_destroy(tree, free);
+}
+END_TEST
+
+/* The deleted node has two children and a deeper right subtree, whose
+ * minimum has a right child of its own:
+ *          50
+ *     20        80
+ *   10    30       90
+ *       25   40
+ *        27 35 45
+ *             37
+ */
+START_TEST(test_delete_middle_deep_right_subtree) {
+    char *elems[12] = {"50", "20", "80", "10", "30", "25",
+                       "27", "40", "35", "45", "37", "90"};
+    char *remaining[11] = {"50", "80", "10", "30", "25", "27",
+                           "40", "35", "45", "37", "90"};
+    tree = add_elem_list(tree, 12, elems);
+    tree = h_tree_delete(tree, "20", (data_cmp_fn)strcmp, free);
+    fail_unless(h_tree_size(tree) == 11);
+    fail_unless(h_tree_search(tree, "20", (data_cmp_fn)strcmp) == NULL);
+    for (int i = 0; i < 11; ++i) {
+        fail_unless(h_tree_search(tree, remaining[i], (data_cmp_fn)strcmp) !=
+                    NULL);
+    }
+    // The successor took the place of the deleted node
+    fail_unless(h_tree_size(h_tree_search(tree, "25", (data_cmp_fn)strcmp)) ==
+                8);
+    fail_unless(h_tree_size(h_tree_search(tree, "30", (data_cmp_fn)strcmp)) ==
+                6);
+    // Every size is still right after deleting the rest of the keys
+    for (int i = 0; i < 11; ++i) {
+        tree = h_tree_delete(tree, remaining[i], (data_cmp_fn)strcmp, free);
+        fail_unless(h_tree_size(tree) == 10 - i);
+        for (int j = i + 1; j < 11; ++j) {
+            fail_unless(h_tree_search(tree, remaining[j],
+                                      (data_cmp_fn)strcmp) != NULL);
+        }
+    }
+    fail_unless(tree == NULL);
+}
+END_TEST
+
 /* Building the test suites */
 
 Suite *binary_search_tree_suite(void) {
     Suite *test_suit = suite_create("binary_search_tree");
     TCase *tcase_functionality = tcase_create("Binary Search Tree functions");
+    tcase_add_checked_fixture(tcase_functionality, node_slab_setup,
+                              node_slab_teardown);
     tcase_add_test(tcase_functionality, test_init_destroy);
     tcase_add_test(tcase_functionality, test_destroy_null);
     tcase_add_test(tcase_functionality, test_insert_null);
     tcase_add_test(tcase_functionality, test_insert_null_tree);
     tcase_add_test(tcase_functionality, test_insert_many);
+    tcase_add_test(tcase_functionality, test_insert_duplicate);
     tcase_add_test(tcase_functionality, test_search_null_tree);
     tcase_add_test(tcase_functionality, test_search_null_key);
     tcase_add_test(tcase_functionality, test_search_small_tree);
@@ -196,6 +291,8 @@ Suite *binary_search_tree_suite(void) {
     tcase_add_test(tcase_functionality, test_delete_middle);
     tcase_add_test(tcase_functionality, test_delete_root);
     tcase_add_test(tcase_functionality, test_delete_all);
+    tcase_add_test(tcase_functionality, test_delete_root_deep_successor);
+    tcase_add_test(tcase_functionality, test_delete_middle_deep_right_subtree);
     suite_add_tcase(test_suit, tcase_functionality);
 
     return test_suit;
@@ -203,9 +300,11 @@ Suite *binary_search_tree_suite(void) {
 
 START_TEST(test_insert_with_parent) {
     h_tree child_node = NULL;
-    tree = h_tree_insert(tree, strdup("l1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     fail_unless(h_tree_size(tree) == 1);
-    tree = h_tree_insert(tree, strdup("l1.1"), tree, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.1"), tree, (data_cmp_fn)strcmp,
+                         node_slab);
     fail_unless(h_tree_size(tree) == 2);
     child_node = h_tree_search(tree, "l1.1", (data_cmp_fn)strcmp);
     fail_unless(h_tree_get_h_parent(child_node) == tree);
@@ -220,7 +319,8 @@ START_TEST(test_iterate_ancestors_null) {
 END_TEST
 
 START_TEST(test_iterate_ancestors_small_tree) {
-    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     fail_unless(tree != NULL);
     h_tree_iterate_h_ancestors(tree, (data_modify_fn)mark_node_visited);
     fail_unless(errno >= 0);
@@ -231,11 +331,15 @@ END_TEST
 
 START_TEST(test_iterate_ancestors_small_tree2) {
     h_tree node_l2 = NULL, node_l21 = NULL;
-    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.1"), tree, (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l2"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l1.1"), tree, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l2"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l2 = h_tree_search(tree, "l2", (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l2.1"), node_l2, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l2.1"), node_l2, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l21 = h_tree_search(tree, "l2.1", (data_cmp_fn)strcmp);
 
     h_tree_iterate_h_ancestors(node_l21, (data_modify_fn)mark_node_visited);
@@ -253,13 +357,17 @@ END_TEST
  */
 START_TEST(test_iterate_ancestors_big_tree) {
     h_tree node_l1 = NULL, node_l11 = NULL, node_l12 = NULL, node_l111 = NULL;
-    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l1 = tree; // For readability
-    tree = h_tree_insert(tree, strdup("l1.1"), node_l1, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.1"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l11 = h_tree_search(tree, "l1.1", (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.2"), node_l1, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.2"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l12 = h_tree_search(tree, "l1.2", (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.1.1"), node_l11, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.1.1"), node_l11, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l111 = h_tree_search(tree, "l1.1.1", (data_cmp_fn)strcmp);
 
     h_tree_iterate_h_ancestors(node_l11, (data_modify_fn)mark_node_visited);
@@ -284,7 +392,8 @@ END_TEST
 
 START_TEST(test_flatten_h_children_small_tree) {
     void **elem_array = calloc(1, sizeof(void *));
-    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     fail_unless(tree != NULL);
     h_tree_flatten_h_children(tree, elem_array);
     fail_unless(errno >= 0);
@@ -297,11 +406,15 @@ END_TEST
 START_TEST(test_flatten_h_children_small_tree2) {
     h_tree node_l2 = NULL;
     void **elem_array = calloc(2, sizeof(void *));
-    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.1"), tree, (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l2"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l1.1"), tree, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l2"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l2 = h_tree_search(tree, "l2", (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l2.1"), node_l2, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l2.1"), node_l2, (data_cmp_fn)strcmp,
+                         node_slab);
 
     h_tree_flatten_h_children(node_l2, elem_array);
 
@@ -322,12 +435,16 @@ START_TEST(test_flatten_h_children_big_tree) {
     h_tree node_l1 = NULL, node_l11 = NULL;
     void **elem_array = calloc(3, sizeof(void *));
 
-    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l1 = tree; // For readability
-    tree = h_tree_insert(tree, strdup("l1.1"), node_l1, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.1"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l11 = h_tree_search(tree, "l1.1", (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.2"), node_l1, (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.1.1"), node_l11, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.2"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l1.1.1"), node_l11, (data_cmp_fn)strcmp,
+                         node_slab);
 
     h_tree_flatten_h_children(node_l1, elem_array);
     fail_unless(errno >= 0);
@@ -350,13 +467,18 @@ START_TEST(test_flatten_h_children_delete) {
     h_tree node_l1 = NULL, node_l11 = NULL;
     void **elem_array = calloc(3, sizeof(void *));
 
-    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l1 = tree; // For readability
-    tree = h_tree_insert(tree, strdup("l1.1"), node_l1, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.1"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
     node_l11 = h_tree_search(tree, "l1.1", (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.2"), node_l1, (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.3"), node_l1, (data_cmp_fn)strcmp);
-    tree = h_tree_insert(tree, strdup("l1.1.1"), node_l11, (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.2"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l1.3"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l1.1.1"), node_l11, (data_cmp_fn)strcmp,
+                         node_slab);
     // Delete the middle children of l1
     tree = h_tree_delete(tree, "l1.2", (data_cmp_fn)strcmp, free);
 
@@ -372,9 +494,55 @@ START_TEST(test_flatten_h_children_delete) {
 }
 END_TEST
 
+/* Tree used for test. We delete the children of l1.
+ * l1  _ l1.1 -> l1.1.1 -> l1.1.1.1
+ *    |_ l1.2
+ * l2  _ l2.1
+ */
+START_TEST(test_delete_h_children) {
+    h_tree node_l1 = NULL, node_l11 = NULL, node_l111 = NULL, node_l2 = NULL;
+    void **elem_array = calloc(2, sizeof(void *));
+    tree = h_tree_insert(NULL, strdup("l1"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
+    node_l1 = tree; // For readability
+    tree = h_tree_insert(tree, strdup("l1.1"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
+    node_l11 = h_tree_search(tree, "l1.1", (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.2"), node_l1, (data_cmp_fn)strcmp,
+                         node_slab);
+    tree = h_tree_insert(tree, strdup("l1.1.1"), node_l11, (data_cmp_fn)strcmp,
+                         node_slab);
+    node_l111 = h_tree_search(tree, "l1.1.1", (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l1.1.1.1"), node_l111,
+                         (data_cmp_fn)strcmp, node_slab);
+    tree = h_tree_insert(tree, strdup("l2"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
+    node_l2 = h_tree_search(tree, "l2", (data_cmp_fn)strcmp);
+    tree = h_tree_insert(tree, strdup("l2.1"), node_l2, (data_cmp_fn)strcmp,
+                         node_slab);
+
+    tree = h_tree_delete_h_children(tree, node_l1, (data_cmp_fn)strcmp, free);
+    fail_unless(h_tree_size(tree) == 3);
+    fail_unless(h_tree_search(tree, "l1", (data_cmp_fn)strcmp) == node_l1);
+    fail_unless(h_tree_search(tree, "l1.1", (data_cmp_fn)strcmp) == NULL);
+    fail_unless(h_tree_search(tree, "l1.1.1.1", (data_cmp_fn)strcmp) == NULL);
+    h_tree_flatten_h_children(node_l1, elem_array);
+    fail_unless(elem_array[0] == NULL);
+    // Other branches of the hierarchy are kept
+    h_tree_flatten_h_children(node_l2, elem_array);
+    fail_unless(strcmp(elem_array[0], "l2.1") == 0);
+    fail_unless(elem_array[1] == NULL);
+
+    free(elem_array);
+    h_tree_destroy(tree, free);
+}
+END_TEST
+
 Suite *hierarchy_tree_suite(void) {
     Suite *test_suit = suite_create("hierarchy_tree");
     TCase *tcase_functionality = tcase_create("Hierarchy Tree functions");
+    tcase_add_checked_fixture(tcase_functionality, node_slab_setup,
+                              node_slab_teardown);
     tcase_add_test(tcase_functionality, test_insert_with_parent);
     tcase_add_test(tcase_functionality, test_iterate_ancestors_null);
     tcase_add_test(tcase_functionality, test_iterate_ancestors_small_tree);
@@ -385,6 +553,182 @@ Suite *hierarchy_tree_suite(void) {
     tcase_add_test(tcase_functionality, test_flatten_h_children_small_tree2);
     tcase_add_test(tcase_functionality, test_flatten_h_children_big_tree);
     tcase_add_test(tcase_functionality, test_flatten_h_children_delete);
+    tcase_add_test(tcase_functionality, test_delete_h_children);
+    suite_add_tcase(test_suit, tcase_functionality);
+
+    return test_suit;
+}
+
+/* A reader that stays in a read section of an epoch until it's told to
+ * leave.
+ */
+struct reader_s {
+    epoch e;
+    pthread_t thread;
+    pthread_barrier_t entered;
+    pthread_barrier_t leave;
+};
+
+static void *reader_main(void *arg) {
+    struct reader_s *reader = arg;
+    epoch_enter(reader->e);
+    pthread_barrier_wait(&reader->entered);
+    pthread_barrier_wait(&reader->leave);
+    epoch_exit(reader->e);
+    return NULL;
+}
+
+/* Starts @reader in a read section of @e, and waits until it's inside. */
+static void reader_start(struct reader_s *reader, epoch e) {
+    reader->e = e;
+    pthread_barrier_init(&reader->entered, NULL, 2);
+    pthread_barrier_init(&reader->leave, NULL, 2);
+    fail_unless(pthread_create(&reader->thread, NULL, reader_main, reader) ==
+                0);
+    pthread_barrier_wait(&reader->entered);
+}
+
+/* Ends the read section of @reader, and waits for it to finish. */
+static void reader_stop(struct reader_s *reader) {
+    pthread_barrier_wait(&reader->leave);
+    pthread_join(reader->thread, NULL);
+    pthread_barrier_destroy(&reader->entered);
+    pthread_barrier_destroy(&reader->leave);
+}
+
+START_TEST(test_epoch_safe_after_two_advances) {
+    epoch e = epoch_init();
+    unsigned long retired = epoch_current(e);
+    // Each call advances the epoch once, as there are no readers
+    fail_unless(!epoch_is_safe(e, retired));
+    fail_unless(epoch_current(e) == retired + 1);
+    fail_unless(epoch_is_safe(e, retired));
+    fail_unless(epoch_current(e) == retired + 2);
+    fail_unless(epoch_is_safe(e, retired));
+    epoch_destroy(e);
+}
+END_TEST
+
+START_TEST(test_epoch_reader_inside) {
+    struct reader_s reader;
+    epoch e = epoch_init();
+    reader_start(&reader, e);
+    unsigned long retired = epoch_current(e);
+    // The reader entered before the retire, and may still use the object
+    for (int i = 0; i < 8; i++) {
+        fail_unless(!epoch_is_safe(e, retired));
+    }
+    fail_unless(epoch_current(e) == retired + 1);
+    reader_stop(&reader);
+    fail_unless(epoch_is_safe(e, retired));
+    epoch_destroy(e);
+}
+END_TEST
+
+START_TEST(test_epoch_reader_after_retire) {
+    struct reader_s reader;
+    epoch e = epoch_init();
+    unsigned long retired = epoch_current(e);
+    fail_unless(!epoch_is_safe(e, retired));
+    // This reader can't find the object, it was already removed
+    reader_start(&reader, e);
+    fail_unless(epoch_is_safe(e, retired));
+    reader_stop(&reader);
+    epoch_destroy(e);
+}
+END_TEST
+
+START_TEST(test_epoch_nested_domains) {
+    epoch e1 = epoch_init(), e2 = epoch_init();
+    epoch_enter(e1);
+    unsigned long retired = epoch_current(e1);
+    // Reading in another domain doesn't end the section of the first one
+    epoch_enter(e2);
+    unsigned long retired2 = epoch_current(e2);
+    epoch_exit(e2);
+    for (int i = 0; i < 8; i++) {
+        fail_unless(!epoch_is_safe(e1, retired));
+    }
+    // And the section of the first one doesn't hold back the other domain
+    fail_unless(!epoch_is_safe(e2, retired2));
+    fail_unless(epoch_is_safe(e2, retired2));
+    epoch_exit(e1);
+    fail_unless(epoch_is_safe(e1, retired));
+    epoch_destroy(e2);
+    epoch_destroy(e1);
+}
+END_TEST
+
+START_TEST(test_slab_epoch_no_reuse) {
+    struct reader_s reader;
+    epoch e = epoch_init();
+    slab s = slab_init(sizeof(long));
+    slab_set_epoch(s, e);
+    void *retired = slab_alloc(s);
+
+    reader_start(&reader, e);
+    slab_free(retired);
+    for (int i = 0; i < 64; i++) {
+        fail_unless(slab_alloc(s) != retired);
+    }
+    reader_stop(&reader);
+    fail_unless(slab_alloc(s) == retired);
+    slab_destroy(s);
+    epoch_destroy(e);
+}
+END_TEST
+
+START_TEST(test_slab_no_epoch_reuse) {
+    slab s = slab_init(sizeof(long));
+    void *obj = slab_alloc(s);
+    slab_free(obj);
+    fail_unless(slab_alloc(s) == obj);
+    slab_destroy(s);
+}
+END_TEST
+
+char *grow_elems[4] = {"n", "o", "p", "z"};
+// Times cmp_and_grow was called
+int cmp_calls = 0;
+
+/* Compares like strcmp. The first time, inserts grow_elems in the tree, like
+ * a writer that grows it while it's searched.
+ */
+static int cmp_and_grow(const char *data, const char *key) {
+    if (cmp_calls++ == 0) {
+        tree = add_elem_list(tree, 4, grow_elems);
+    }
+    return strcmp(data, key);
+}
+
+START_TEST(test_search_concurrent_max_steps) {
+    tree = h_tree_insert(NULL, strdup("m"), NULL, (data_cmp_fn)strcmp,
+                         node_slab);
+    cmp_calls = 0;
+    // The search only takes as many steps as there were nodes, plus one
+    h_tree found =
+        h_tree_search_concurrent(tree, "z", (data_cmp_fn)cmp_and_grow);
+    fail_unless(found == NULL);
+    fail_unless(cmp_calls == 2);
+    fail_unless(h_tree_size(tree) == 5);
+    fail_unless(h_tree_search_concurrent(tree, "z", (data_cmp_fn)strcmp) !=
+                NULL);
+    h_tree_destroy(tree, free);
+}
+END_TEST
+
+Suite *epoch_reclamation_suite(void) {
+    Suite *test_suit = suite_create("epoch_reclamation");
+    TCase *tcase_functionality = tcase_create("Epoch reclamation functions");
+    tcase_add_checked_fixture(tcase_functionality, node_slab_setup,
+                              node_slab_teardown);
+    tcase_add_test(tcase_functionality, test_epoch_safe_after_two_advances);
+    tcase_add_test(tcase_functionality, test_epoch_reader_inside);
+    tcase_add_test(tcase_functionality, test_epoch_reader_after_retire);
+    tcase_add_test(tcase_functionality, test_epoch_nested_domains);
+    tcase_add_test(tcase_functionality, test_slab_epoch_no_reuse);
+    tcase_add_test(tcase_functionality, test_slab_no_epoch_reuse);
+    tcase_add_test(tcase_functionality, test_search_concurrent_max_steps);
     suite_add_tcase(test_suit, tcase_functionality);
 
     return test_suit;
@@ -395,6 +739,7 @@ int main() {
 
     srunner_add_suite(runner, binary_search_tree_suite());
     srunner_add_suite(runner, hierarchy_tree_suite());
+    srunner_add_suite(runner, epoch_reclamation_suite());
 
     srunner_set_log(runner, "test.log");
     srunner_run_all(runner, CK_NORMAL);
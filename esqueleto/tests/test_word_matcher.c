@@ -0,0 +1,437 @@
+/*
+ * Tests for word_matcher, compared with a search of each word with
+ * strncasecmp
+ *
+ */
+
+#include "word_matcher.h"
+#include <check.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define NUM_RANDOM_LISTS 500
+#define BUFFERS_PER_LIST 20
+#define MAX_BUFFER_SIZE 600
+#define MAX_RANDOM_WORD_LEN 6
+
+// Bytes of the random words and buffers, few so that the words are found
+static const char *alphabet = "abcABC xy";
+// Bytes that are not letters but are the same with the 0x20 bit set, like
+// the prefilters compare them
+static const char *aliases = "@`[{\x01!\r-aA";
+
+// Prefilters compared, the first one is the reference
+static const enum word_matcher_prefilter prefilters[] = {
+    WORD_MATCHER_PREFILTER_NONE, WORD_MATCHER_PREFILTER_SCALAR,
+    WORD_MATCHER_PREFILTER_SSE2, WORD_MATCHER_PREFILTER_AVX2};
+#define NUM_PREFILTERS (sizeof(prefilters) / sizeof(prefilters[0]))
+// Positions checked by the prefilters at once, see word_matcher.c
+#define PREFILTER_WINDOW 64
+
+/* Returns the next pseudo random number of @seed (xorshift64*) */
+static u64 test_random(u64 *seed) {
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 0x2545f4914f6cdd1dULL;
+}
+
+/* Returns true if @word is in the @size bytes of @buf, ignoring the case */
+static bool has_word(const char *buf, size_t size, const char *word) {
+    size_t len = strlen(word);
+    for (size_t i = 0; i + len <= size && i < size; i++) {
+        if (strncasecmp(buf + i, word, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the mask of the first @num_words @words found by has_word */
+static u32 reference_scan(char *const *words, size_t num_words,
+                          const char *buf, size_t size) {
+    u32 found = 0;
+    for (size_t i = 0; i < num_words; i++) {
+        if (has_word(buf, size, words[i])) {
+            found |= 1u << i;
+        }
+    }
+    return found;
+}
+
+/* Returns the mask of the first @num_words @words that end in the bytes of
+ * @stream from @start to @end, wherever they start. Empty words end in any
+ * bytes.
+ */
+static u32 reference_scan_stream(char *const *words, size_t num_words,
+                                 const char *stream, size_t start,
+                                 size_t end) {
+    u32 found = 0;
+    for (size_t i = 0; i < num_words; i++) {
+        size_t len = strlen(words[i]);
+        bool ends = len == 0 && end > start;
+        for (size_t e = start + 1; !ends && e <= end; e++) {
+            ends = e >= len &&
+                   strncasecmp(stream + e - len, words[i], len) == 0;
+        }
+        if (ends) {
+            found |= 1u << i;
+        }
+    }
+    return found;
+}
+
+/* Fills the @size bytes of @buf with bytes of @chars */
+static void random_fill(char *buf, size_t size, const char *chars,
+                        u64 *seed) {
+    size_t num_chars = strlen(chars);
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = chars[test_random(seed) % num_chars];
+    }
+}
+
+/* Words of a random list, ended by NULL */
+struct word_list_s {
+    char *words[WORD_MATCHER_MAX_WORDS + 1];
+    char storage[WORD_MATCHER_MAX_WORDS][MAX_RANDOM_WORD_LEN + 1];
+    size_t num_words;
+};
+
+/* Fills @list with up to @max_words random words of bytes of @chars, of
+ * @min_len bytes or more.
+ */
+static void random_words(struct word_list_s *list, size_t max_words,
+                         size_t min_len, const char *chars, u64 *seed) {
+    list->num_words = 1 + test_random(seed) % max_words;
+    for (size_t i = 0; i < list->num_words; i++) {
+        size_t max_extra = MAX_RANDOM_WORD_LEN - min_len;
+        size_t len = min_len + test_random(seed) % (max_extra + 1);
+        random_fill(list->storage[i], len, chars, seed);
+        list->storage[i][len] = '\0';
+        list->words[i] = list->storage[i];
+    }
+    list->words[list->num_words] = NULL;
+}
+
+/* Checks the scan of the @size bytes of @buf with each prefilter that
+ * @matcher can use, the scalar one at least
+ */
+static void check_prefilters(word_matcher matcher, char *const *words,
+                             size_t num_words, const char *buf, size_t size) {
+    u32 expected = reference_scan(words, num_words, buf, size);
+    for (size_t p = 0; p < NUM_PREFILTERS; p++) {
+        if (word_matcher_set_prefilter(matcher, prefilters[p])) {
+            fail_unless(word_matcher_scan(matcher, buf, size) == expected);
+        } else {
+            fail_unless(prefilters[p] != WORD_MATCHER_PREFILTER_SCALAR);
+        }
+    }
+}
+
+/* Checks the prefilters with random lists of words of two bytes or more, that
+ * they can prefilter, and random buffers of @chars
+ */
+static void check_random_prefilters(const char *chars, u64 *seed) {
+    char buf[MAX_BUFFER_SIZE];
+    for (size_t l = 0; l < NUM_RANDOM_LISTS; l++) {
+        struct word_list_s list;
+        random_words(&list, 4, 2, chars, seed);
+        word_matcher matcher = word_matcher_init(list.words);
+        fail_unless(matcher != NULL);
+        for (size_t b = 0; b < BUFFERS_PER_LIST; b++) {
+            size_t size = test_random(seed) % (MAX_BUFFER_SIZE + 1);
+            random_fill(buf, size, chars, seed);
+            check_prefilters(matcher, list.words, list.num_words, buf, size);
+        }
+        word_matcher_destroy(matcher);
+    }
+}
+
+START_TEST(test_random_buffers) {
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    char buf[MAX_BUFFER_SIZE];
+    for (size_t l = 0; l < NUM_RANDOM_LISTS; l++) {
+        struct word_list_s list;
+        // Some words are empty or have a single byte
+        random_words(&list, WORD_MATCHER_MAX_WORDS, 0, alphabet, &seed);
+        word_matcher matcher = word_matcher_init(list.words);
+        fail_unless(matcher != NULL);
+        for (size_t b = 0; b < BUFFERS_PER_LIST; b++) {
+            size_t size = test_random(&seed) % (MAX_BUFFER_SIZE + 1);
+            random_fill(buf, size, alphabet, &seed);
+            fail_unless(word_matcher_scan(matcher, buf, size) ==
+                        reference_scan(list.words, list.num_words, buf, size));
+        }
+        word_matcher_destroy(matcher);
+    }
+}
+END_TEST
+
+START_TEST(test_prefilters_random) {
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    check_random_prefilters(alphabet, &seed);
+}
+END_TEST
+
+START_TEST(test_prefilters_aliases) {
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    check_random_prefilters(aliases, &seed);
+
+    char *words[] = {"`{", "-!", NULL};
+    word_matcher matcher = word_matcher_init(words);
+    fail_unless(matcher != NULL);
+    // Candidates of the prefilters, that the automaton discards
+    const char none[] = "@[ `[ @{ \r\x01 -\x01 \r!";
+    check_prefilters(matcher, words, 2, none, sizeof(none) - 1);
+    const char one[] = "@[ \r\x01 `{";
+    check_prefilters(matcher, words, 2, one, sizeof(one) - 1);
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+/* Checks the prefilters with a word planted at each position of buffers that
+ * end in less than a window, where the scalar tail of next_candidate looks
+ */
+START_TEST(test_prefilters_tail) {
+    char *words[] = {"abc", "xy", NULL};
+    char buf[3 * PREFILTER_WINDOW];
+    word_matcher matcher = word_matcher_init(words);
+    fail_unless(matcher != NULL);
+    for (size_t size = 2; size <= sizeof(buf); size++) {
+        size_t first = size > PREFILTER_WINDOW + 2
+                           ? size - PREFILTER_WINDOW - 2
+                           : 0;
+        for (size_t pos = first; pos + 2 <= size; pos++) {
+            // At the end only the first two bytes of "aBc", a candidate
+            const char *word = pos % 2 ? "Xy" : "aBc";
+            size_t len = strlen(word);
+            memset(buf, ' ', size);
+            memcpy(buf + pos, word, pos + len <= size ? len : size - pos);
+            check_prefilters(matcher, words, 2, buf, size);
+        }
+    }
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+/* Checks the prefilters with a false candidate followed by a word at the
+ * positions around the end of the window that starts at the candidate, and
+ * of the first window of the buffer
+ */
+START_TEST(test_prefilters_window_boundaries) {
+    char *words[] = {"abc", "xyz", NULL};
+    char buf[4 * PREFILTER_WINDOW];
+    word_matcher matcher = word_matcher_init(words);
+    fail_unless(matcher != NULL);
+    for (size_t first = 0; first < 2 * PREFILTER_WINDOW; first++) {
+        for (size_t distance = PREFILTER_WINDOW - 3;
+             distance <= PREFILTER_WINDOW + 3; distance++) {
+            memset(buf, ' ', sizeof(buf));
+            memcpy(buf + first, "abz", 3);
+            memcpy(buf + first + distance, "XYZ", 3);
+            check_prefilters(matcher, words, 2, buf, sizeof(buf));
+        }
+    }
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+/* Scans the @size bytes of @stream with @matcher in random pieces, and checks
+ * what each one finds
+ */
+static void check_stream(word_matcher matcher, char *const *words,
+                         size_t num_words, const char *stream, size_t size,
+                         u64 *seed) {
+    word_matcher_state state = WORD_MATCHER_START;
+    size_t start = 0;
+    while (start < size) {
+        // Some pieces are empty, some are shorter than the words
+        size_t piece = test_random(seed) % 16 == 0
+                           ? test_random(seed) % (size - start + 1)
+                           : test_random(seed) % 12;
+        piece = piece < size - start ? piece : size - start;
+        u32 found =
+            word_matcher_scan_stream(matcher, &state, stream + start, piece);
+        fail_unless(found == reference_scan_stream(words, num_words, stream,
+                                                   start, start + piece));
+        start += piece;
+    }
+}
+
+START_TEST(test_stream_random) {
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    char stream[MAX_BUFFER_SIZE];
+    for (size_t l = 0; l < NUM_RANDOM_LISTS; l++) {
+        struct word_list_s list;
+        // Lists of few words, whose pieces often have all of them and stop
+        // early
+        size_t max_words = l % 2 ? 4 : WORD_MATCHER_MAX_WORDS;
+        random_words(&list, max_words, 0, alphabet, &seed);
+        word_matcher matcher = word_matcher_init(list.words);
+        fail_unless(matcher != NULL);
+        for (size_t b = 0; b < BUFFERS_PER_LIST; b++) {
+            size_t size = test_random(&seed) % (MAX_BUFFER_SIZE + 1);
+            random_fill(stream, size, alphabet, &seed);
+            enum word_matcher_prefilter prefilter =
+                prefilters[test_random(&seed) % NUM_PREFILTERS];
+            if (!word_matcher_set_prefilter(matcher, prefilter)) {
+                word_matcher_set_prefilter(matcher,
+                                           WORD_MATCHER_PREFILTER_NONE);
+            }
+            check_stream(matcher, list.words, list.num_words, stream, size,
+                         &seed);
+        }
+        word_matcher_destroy(matcher);
+    }
+}
+END_TEST
+
+/* A piece with all the words stops early, and the state after it is rebuilt
+ * from its last bytes, as many as the longest word but one
+ */
+START_TEST(test_stream_stop_long_piece) {
+    char *words[] = {"ab", "cd", NULL};
+    word_matcher matcher = word_matcher_init(words);
+    word_matcher_state state = WORD_MATCHER_START;
+    fail_unless(matcher != NULL);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "abcdxa", 6) == 0x3);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "bx", 2) == 0x1);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "c", 1) == 0);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "d", 1) == 0x2);
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+/* Like test_stream_stop_long_piece, with a piece shorter than the longest
+ * word but one, whose state is rebuilt from the state before it
+ */
+START_TEST(test_stream_stop_short_piece) {
+    char *words[] = {"x", "abcdefgh", "fghxab", NULL};
+    word_matcher matcher = word_matcher_init(words);
+    word_matcher_state state = WORD_MATCHER_START;
+    fail_unless(matcher != NULL);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "abcdefg", 7) == 0);
+    // "fghxab" ends in the middle, "ab" goes on
+    fail_unless(word_matcher_scan_stream(matcher, &state, "hxabc", 5) == 0x7);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "defgh", 5) == 0x2);
+    word_matcher_destroy(matcher);
+
+    // The word found in the middle goes on in the next piece
+    char *periodic[] = {"abababab", NULL};
+    matcher = word_matcher_init(periodic);
+    state = WORD_MATCHER_START;
+    fail_unless(matcher != NULL);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "ababab", 6) == 0);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "abab", 4) == 0x1);
+    fail_unless(word_matcher_scan_stream(matcher, &state, "ab", 2) == 0x1);
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+START_TEST(test_empty_words) {
+    char *words[] = {"", "ab", "", NULL};
+    word_matcher matcher = word_matcher_init(words);
+    fail_unless(matcher != NULL);
+    fail_unless(word_matcher_max_len(matcher) == 2);
+    // Found in any buffer but the empty one
+    fail_unless(word_matcher_scan(matcher, "", 0) == 0);
+    fail_unless(word_matcher_scan(matcher, "x", 1) == 0x5);
+    fail_unless(word_matcher_scan(matcher, "xAby", 4) == 0x7);
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+START_TEST(test_no_words) {
+    char *words[] = {NULL};
+    word_matcher matcher = word_matcher_init(words);
+    fail_unless(matcher != NULL);
+    fail_unless(word_matcher_max_len(matcher) == 0);
+    fail_unless(word_matcher_scan(matcher, "abc", 3) == 0);
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+START_TEST(test_all_words) {
+    char storage[WORD_MATCHER_MAX_WORDS + 1][4];
+    char *words[WORD_MATCHER_MAX_WORDS + 2];
+    char buf[sizeof(storage)];
+    size_t size = 0;
+    // Different words, all in buf but the one after the maximum
+    for (size_t i = 0; i <= WORD_MATCHER_MAX_WORDS; i++) {
+        storage[i][0] = 'w';
+        storage[i][1] = 'a' + i % 26;
+        storage[i][2] = 'a' + i / 26;
+        storage[i][3] = '\0';
+        words[i] = storage[i];
+        if (i < WORD_MATCHER_MAX_WORDS) {
+            memcpy(buf + size, storage[i], 3);
+            buf[size + 3] = ' ';
+            size += 4;
+        }
+    }
+    words[WORD_MATCHER_MAX_WORDS + 1] = NULL;
+    word_matcher matcher = word_matcher_init(words);
+    fail_unless(matcher != NULL);
+    fail_unless(word_matcher_scan(matcher, buf, size) == UINT32_MAX);
+    // The last one of buf is the only one found
+    fail_unless(word_matcher_scan(matcher, buf + size - 4, 4) == 1u << 31);
+    // The words after the maximum are ignored
+    fail_unless(word_matcher_scan(matcher, words[WORD_MATCHER_MAX_WORDS],
+                                  3) == 0);
+    word_matcher_destroy(matcher);
+}
+END_TEST
+
+START_TEST(test_too_long) {
+    // Every byte is a class, and the states times the classes don't fit in
+    // the transitions
+    char classes[256];
+    for (unsigned int c = 1; c < 256; c++) {
+        classes[c - 1] = c;
+    }
+    classes[255] = '\0';
+    size_t len = 8 << 20;
+    char *long_word = malloc(len + 1);
+    fail_unless(long_word != NULL);
+    memset(long_word, 'a', len);
+    long_word[len] = '\0';
+    char *words[] = {classes, long_word, NULL};
+    errno = 0;
+    fail_unless(word_matcher_init(words) == NULL);
+    fail_unless(errno == EINVAL);
+    free(long_word);
+}
+END_TEST
+
+Suite *word_matcher_suite(void) {
+    Suite *test_suit = suite_create("word_matcher");
+    TCase *tcase_functionality = tcase_create("Word matcher functions");
+    tcase_add_test(tcase_functionality, test_random_buffers);
+    tcase_add_test(tcase_functionality, test_prefilters_random);
+    tcase_add_test(tcase_functionality, test_prefilters_aliases);
+    tcase_add_test(tcase_functionality, test_prefilters_tail);
+    tcase_add_test(tcase_functionality, test_prefilters_window_boundaries);
+    tcase_add_test(tcase_functionality, test_stream_random);
+    tcase_add_test(tcase_functionality, test_stream_stop_long_piece);
+    tcase_add_test(tcase_functionality, test_stream_stop_short_piece);
+    tcase_add_test(tcase_functionality, test_empty_words);
+    tcase_add_test(tcase_functionality, test_no_words);
+    tcase_add_test(tcase_functionality, test_all_words);
+    tcase_add_test(tcase_functionality, test_too_long);
+    suite_add_tcase(test_suit, tcase_functionality);
+
+    return test_suit;
+}
+
+int main() {
+    SRunner *runner = srunner_create(word_matcher_suite());
+
+    srunner_set_log(runner, "test.log");
+    srunner_run_all(runner, CK_NORMAL);
+    srunner_free(runner);
+    return 0;
+}
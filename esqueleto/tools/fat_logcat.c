@@ -0,0 +1,168 @@
+/*
+ * fat_logcat.c
+ *
+ * Prints a binary fs.log (see fat_log_format.h) in the text format, one line
+ * per operation:
+ *
+ *     date	user	operation	path	[censored words]
+ *
+ * Lines of logs written with an aggregation window end with the number of
+ * operations and their bytes.
+ */
+
+#include "big_brother.h"
+#include "fat_log_format.h"
+#include "log_print.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGCAT_BUFFER_SIZE (1 << 20)
+
+static void usage(FILE *stream) {
+    fputs("Usage: fat-logcat [FILE]\n"
+          "Prints the binary fs.log in FILE, or in the standard input, as "
+          "text.\n",
+          stream);
+}
+
+// Paths defined since the last header, by number
+static char **paths = NULL;
+static size_t paths_size = 0;
+
+/* Remembers @path as the path number @id. Returns false if there is no
+ * memory.
+ */
+static bool path_define(u32 id, char *path) {
+    if (id >= paths_size) {
+        size_t new_size = paths_size == 0 ? 1024 : paths_size;
+        while (new_size <= id) {
+            new_size *= 2;
+        }
+        char **new_paths = reallocarray(paths, new_size, sizeof(char *));
+        if (new_paths == NULL) {
+            return false;
+        }
+        memset(new_paths + paths_size, 0,
+               (new_size - paths_size) * sizeof(char *));
+        paths = new_paths;
+        paths_size = new_size;
+    }
+    free(paths[id]);
+    paths[id] = path;
+    return true;
+}
+
+static const char *path_get(u32 id) {
+    return id < paths_size && paths[id] != NULL ? paths[id] : "?";
+}
+
+static void paths_forget(void) {
+    for (size_t i = 0; i < paths_size; i++) {
+        free(paths[i]);
+        paths[i] = NULL;
+    }
+}
+
+/* Prints the log in @log. Returns 0 on success */
+static int logcat(FILE *log, const char *name) {
+    struct fat_log_entry_s entry;
+    bool first = true;
+
+    while (fread(&entry, sizeof(entry), 1, log) == 1) {
+        if (first && (entry.type != FAT_LOG_ENTRY_HEADER ||
+                      entry.bytes != FAT_LOG_MAGIC)) {
+            fprintf(stderr, "fat-logcat: %s is not a binary fs.log\n", name);
+            return 1;
+        }
+        first = false;
+        switch (entry.type) {
+        case FAT_LOG_ENTRY_HEADER:
+            paths_forget();
+            break;
+        case FAT_LOG_ENTRY_PATH: {
+            size_t padded_len = fat_log_path_padded_len(entry.path_len);
+            char *path = malloc(padded_len + 1);
+            if (path == NULL) {
+                fprintf(stderr, "fat-logcat: %s\n", strerror(ENOMEM));
+                return 1;
+            }
+            if (padded_len != 0 && fread(path, padded_len, 1, log) != 1) {
+                free(path);
+                fprintf(stderr, "fat-logcat: %s is truncated\n", name);
+                return 1;
+            }
+            path[entry.path_len] = '\0';
+            if (!path_define(entry.path_id, path)) {
+                free(path);
+                fprintf(stderr, "fat-logcat: %s\n", strerror(ENOMEM));
+                return 1;
+            }
+            break;
+        }
+        case FAT_LOG_ENTRY_WORD: {
+            char word[CENSORED_WORD_MAX_LEN + FAT_LOG_ENTRY_SIZE];
+            size_t padded_len = fat_log_path_padded_len(entry.path_len);
+            if (padded_len > sizeof(word)) {
+                fprintf(stderr, "fat-logcat: word too long in %s\n", name);
+                return 1;
+            }
+            if (padded_len != 0 && fread(word, padded_len, 1, log) != 1) {
+                fprintf(stderr, "fat-logcat: %s is truncated\n", name);
+                return 1;
+            }
+            if (!log_define_word(entry.path_id, word, entry.path_len)) {
+                fprintf(stderr, "fat-logcat: %s\n", strerror(ENOMEM));
+                return 1;
+            }
+            break;
+        }
+        case FAT_LOG_ENTRY_ACCESS:
+            log_print_access(&entry, path_get(entry.path_id));
+            break;
+        default:
+            fprintf(stderr, "fat-logcat: unknown entry of type %u in %s\n",
+                    entry.type, name);
+            return 1;
+        }
+    }
+    if (ferror(log)) {
+        fprintf(stderr, "fat-logcat: %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    FILE *log = stdin;
+    const char *name = "standard input";
+    int ret;
+
+    if (argc > 2) {
+        usage(stderr);
+        return 2;
+    }
+    if (argc == 2) {
+        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+            usage(stdout);
+            return 0;
+        }
+        name = argv[1];
+        log = fopen(name, "r");
+        if (log == NULL) {
+            fprintf(stderr, "fat-logcat: %s: %s\n", name, strerror(errno));
+            return 1;
+        }
+    }
+    setvbuf(log, NULL, _IOFBF, LOGCAT_BUFFER_SIZE);
+    setvbuf(stdout, NULL, _IOFBF, LOGCAT_BUFFER_SIZE);
+
+    ret = logcat(log, name);
+    paths_forget();
+    free(paths);
+    if (log != stdin) {
+        fclose(log);
+    }
+    return ret;
+}
@@ -0,0 +1,267 @@
+/*
+ * fat_logquery.c
+ *
+ * Prints the records of a file in fs.log, or in one of its older generations,
+ * reading only the batches where its index (fs.idx, see fat_log_format.h) says
+ * there are records of the file in the asked dates. Text and binary logs are
+ * printed the same way:
+ *
+ *     date	user	operation	path	[censored words]
+ */
+
+#include "fat_log_format.h"
+#include "log_print.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static void usage(FILE *stream) {
+    fputs("Usage: fat-logquery [-s START] [-e END] LOG INDEX PATH\n"
+          "Prints the records of the file PATH in LOG, using its index "
+          "INDEX.\n"
+          "START and END limit the dates, as YYYY-MM-DD or "
+          "\"YYYY-MM-DD HH:MM\".\n",
+          stream);
+}
+
+/* Reads the date in @text into @t, local time. With @end, a day or minute
+ * stands for its last second. Returns false if it's not a date.
+ */
+static bool parse_date(const char *text, bool end, time_t *t) {
+    struct tm timeinfo;
+    const char *rest;
+    time_t extra;
+
+    memset(&timeinfo, 0, sizeof(timeinfo));
+    rest = strptime(text, "%Y-%m-%d %H:%M", &timeinfo);
+    extra = 59;
+    if (rest == NULL) {
+        memset(&timeinfo, 0, sizeof(timeinfo));
+        rest = strptime(text, "%Y-%m-%d", &timeinfo);
+        extra = 24 * 60 * 60 - 1;
+    }
+    if (rest == NULL || *rest != '\0') {
+        return false;
+    }
+    timeinfo.tm_isdst = -1;
+    *t = mktime(&timeinfo) + (end ? extra : 0);
+    return true;
+}
+
+struct query_s {
+    const char *path;
+    time_t start;
+    time_t end;
+    bool binary;
+};
+
+/* Prints the lines of the text @batch, of @len bytes, that are of the file
+ * and dates of @query.
+ */
+static void query_text(const struct query_s *query, char *batch, size_t len) {
+    size_t path_len = strlen(query->path);
+    char *line = batch;
+    char *batch_end = batch + len;
+
+    while (line < batch_end) {
+        char *line_end = memchr(line, '\n', batch_end - line);
+        if (line_end == NULL) {
+            line_end = batch_end;
+        }
+        // date, user, operation and path, separated by tabs
+        char *field = line;
+        for (int i = 0; i < 3 && field != NULL; i++) {
+            field = memchr(field, '\t', line_end - field);
+            field = field != NULL ? field + 1 : NULL;
+        }
+        struct tm timeinfo;
+        memset(&timeinfo, 0, sizeof(timeinfo));
+        if (field != NULL && line_end - field > (ptrdiff_t)path_len &&
+            memcmp(field, query->path, path_len) == 0 &&
+            field[path_len] == '\t' &&
+            strptime(line, "%d-%m-%Y %H:%M", &timeinfo) != NULL) {
+            timeinfo.tm_isdst = -1;
+            time_t t = mktime(&timeinfo);
+            // Dates in the text log are of the minute
+            if (t + 59 >= query->start && t <= query->end) {
+                fwrite(line, 1, line_end - line, stdout);
+                putchar('\n');
+            }
+        }
+        line = line_end + 1;
+    }
+}
+
+/* Prints the entries of the binary @batch, of @len bytes, that are accesses
+ * to the path number @path_id in the dates of @query.
+ */
+static void query_binary(const struct query_s *query, const char *batch,
+                         size_t len, u32 path_id) {
+    size_t pos = 0;
+
+    while (pos + FAT_LOG_ENTRY_SIZE <= len) {
+        struct fat_log_entry_s entry;
+        memcpy(&entry, batch + pos, sizeof(entry));
+        pos += FAT_LOG_ENTRY_SIZE;
+        if (entry.type == FAT_LOG_ENTRY_PATH) {
+            pos += fat_log_path_padded_len(entry.path_len);
+        } else if (entry.type == FAT_LOG_ENTRY_WORD) {
+            size_t padded_len = fat_log_path_padded_len(entry.path_len);
+            if (pos + padded_len <= len &&
+                !log_define_word(entry.path_id, batch + pos,
+                                 entry.path_len)) {
+                fprintf(stderr, "fat-logquery: %s\n", strerror(ENOMEM));
+            }
+            pos += padded_len;
+        } else if (entry.type == FAT_LOG_ENTRY_ACCESS &&
+                   entry.path_id == path_id &&
+                   (time_t)entry.time >= query->start &&
+                   (time_t)entry.time <= query->end) {
+            log_print_access(&entry, query->path);
+        }
+    }
+}
+
+/* Reads the whole index in @name. Returns its entries, and sets @count to
+ * their number, or returns NULL and sets errno.
+ */
+static struct fat_log_index_entry_s *index_read(const char *name,
+                                               size_t *count) {
+    FILE *file = fopen(name, "r");
+    struct stat st;
+    struct fat_log_index_entry_s *entries;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fstat(fileno(file), &st) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    // An entry being written when the index was copied is left out
+    *count = st.st_size / FAT_LOG_INDEX_ENTRY_SIZE;
+    entries = calloc(*count + 1, FAT_LOG_INDEX_ENTRY_SIZE);
+    if (entries == NULL) {
+        fclose(file);
+        errno = ENOMEM;
+        return NULL;
+    }
+    *count = fread(entries, FAT_LOG_INDEX_ENTRY_SIZE, *count, file);
+    if (ferror(file)) {
+        free(entries);
+        fclose(file);
+        errno = EIO;
+        return NULL;
+    }
+    fclose(file);
+    return entries;
+}
+
+/* Prints the records of @query in the log @log_name with index
+ * @index_name. Returns 0 on success.
+ */
+static int query(struct query_s *query, const char *log_name,
+                 const char *index_name) {
+    struct fat_log_entry_s header;
+    struct fat_log_index_entry_s *entries;
+    size_t count;
+    int ret = 0;
+
+    FILE *log = fopen(log_name, "r");
+    if (log == NULL) {
+        fprintf(stderr, "fat-logquery: %s: %s\n", log_name, strerror(errno));
+        return 1;
+    }
+    query->binary = fread(&header, sizeof(header), 1, log) == 1 &&
+                    header.type == FAT_LOG_ENTRY_HEADER &&
+                    header.bytes == FAT_LOG_MAGIC;
+    entries = index_read(index_name, &count);
+    if (entries == NULL) {
+        fprintf(stderr, "fat-logquery: %s: %s\n", index_name,
+                strerror(errno));
+        fclose(log);
+        return 1;
+    }
+
+    u64 hash = fat_log_path_hash(query->path);
+    u64 first_bucket = query->start / FAT_LOG_INDEX_BUCKET;
+    u64 last_bucket = query->end / FAT_LOG_INDEX_BUCKET;
+    char *batch = NULL;
+    size_t batch_size = 0;
+    // The entries of a batch are together, and it can have several of the
+    // file, one for each hour
+    u64 last_offset = UINT64_MAX;
+    for (size_t i = 0; i < count && ret == 0; i++) {
+        struct fat_log_index_entry_s *entry = &entries[i];
+        if (entry->path_hash != hash || entry->bucket < first_bucket ||
+            entry->bucket > last_bucket || entry->offset == last_offset) {
+            continue;
+        }
+        last_offset = entry->offset;
+        if (entry->length > batch_size) {
+            char *new_batch = realloc(batch, entry->length);
+            if (new_batch == NULL) {
+                fprintf(stderr, "fat-logquery: %s\n", strerror(ENOMEM));
+                ret = 1;
+                break;
+            }
+            batch = new_batch;
+            batch_size = entry->length;
+        }
+        ssize_t len =
+            pread(fileno(log), batch, entry->length, entry->offset);
+        if (len < 0) {
+            fprintf(stderr, "fat-logquery: %s: %s\n", log_name,
+                    strerror(errno));
+            ret = 1;
+        } else if (query->binary) {
+            query_binary(query, batch, len, entry->path_id);
+        } else {
+            query_text(query, batch, len);
+        }
+    }
+    free(batch);
+    free(entries);
+    fclose(log);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    struct query_s q = {.start = 0, .end = INT64_MAX};
+    const struct option longopts[] = {
+        {"start", required_argument, NULL, 's'},
+        {"end", required_argument, NULL, 'e'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:e:h", longopts, NULL)) != -1) {
+        switch (c) {
+        case 's':
+        case 'e':
+            if (!parse_date(optarg, c == 'e', c == 's' ? &q.start : &q.end)) {
+                fprintf(stderr, "fat-logquery: invalid date: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'h':
+            usage(stdout);
+            return 0;
+        default:
+            usage(stderr);
+            return 2;
+        }
+    }
+    if (argc - optind != 3) {
+        usage(stderr);
+        return 2;
+    }
+    q.path = argv[optind + 2];
+    return query(&q, argv[optind], argv[optind + 1]);
+}
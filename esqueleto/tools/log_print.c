@@ -0,0 +1,89 @@
+/*
+ * log_print.c
+ *
+ * Lines of the text log, for the entries of a binary one.
+ */
+
+#include "log_print.h"
+
+#include "big_brother.h"
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Censored words defined in the log, if any was
+static char *words[CENSORED_WORDS_MAX];
+static bool words_defined = false;
+
+/* Returns the name of the user @uid, or its number if it has no name */
+static const char *user_name(uid_t uid) {
+    static uid_t last_uid;
+    static char last_name[64] = "";
+
+    if (last_name[0] == '\0' || uid != last_uid) {
+        struct passwd *pw = getpwuid(uid);
+        if (pw != NULL) {
+            snprintf(last_name, sizeof(last_name), "%s", pw->pw_name);
+        } else {
+            snprintf(last_name, sizeof(last_name), "%u", uid);
+        }
+        last_uid = uid;
+    }
+    return last_name;
+}
+
+void log_print_access(const struct fat_log_entry_s *entry, const char *path) {
+    static time_t last_time = -1;
+    static char date[30];
+
+    if ((time_t)entry->time != last_time) {
+        struct tm timeinfo;
+        last_time = entry->time;
+        localtime_r(&last_time, &timeinfo);
+        strftime(date, sizeof(date), "%d-%m-%Y %H:%M", &timeinfo);
+    }
+    printf("%s\t%s\t%s\t%s\t", date, user_name(entry->uid),
+           fat_log_op_name(entry->op), path);
+    if (entry->words != 0) {
+        bool first = true;
+        putchar('[');
+        char *const *names = words_defined ? words : censored_words;
+        for (unsigned int i = 0; i < CENSORED_WORDS_MAX && names[i] != NULL;
+             i++) {
+            if (entry->words & (1u << i)) {
+                if (!first) {
+                    fputs(", ", stdout);
+                }
+                fputs(names[i], stdout);
+                first = false;
+            }
+        }
+        putchar(']');
+    }
+    if (entry->flags & FAT_LOG_AGGREGATED) {
+        printf("\t%u\t%llu", entry->count, (unsigned long long)entry->bytes);
+    }
+    putchar('\n');
+}
+
+bool log_define_word(u32 index, const char *word, size_t len) {
+    if (index >= CENSORED_WORDS_MAX) {
+        return true; // Never in a mask
+    }
+    char *copy = strndup(word, len);
+    if (copy == NULL) {
+        return false;
+    }
+    if (index == 0) {
+        for (unsigned int i = 0; i < CENSORED_WORDS_MAX; i++) {
+            free(words[i]);
+            words[i] = NULL;
+        }
+        words_defined = true;
+    }
+    free(words[index]);
+    words[index] = copy;
+    return true;
+}
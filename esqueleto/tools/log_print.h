@@ -0,0 +1,27 @@
+/*
+ * log_print.h
+ *
+ * Lines of the text log, for the entries of a binary one. Shared by the tools
+ * that read fs.log.
+ */
+
+#ifndef _LOG_PRINT_H
+#define _LOG_PRINT_H
+
+#include "fat_log_format.h"
+
+/* Prints to the standard output the line of the access @entry, on the file
+ * @path, as the logger writes it in text:
+ *
+ *     date	user	operation	path	[censored words]	[count	bytes]
+ */
+void log_print_access(const struct fat_log_entry_s *entry, const char *path);
+
+/* Makes the @len bytes of @word the censored word @index of the next
+ * accesses, for an entry FAT_LOG_ENTRY_WORD. Word 0 forgets the ones defined
+ * before. Until a word is defined, the accesses use censored_words.
+ * Returns false if there is no memory.
+ */
+bool log_define_word(u32 index, const char *word, size_t len);
+
+#endif /* _LOG_PRINT_H */
@@ -0,0 +1,493 @@
+/*
+ * word_matcher.c
+ *
+ * Aho-Corasick automaton over classes of bytes.
+ *
+ * Bytes that are the same letter in different case, and all the bytes that
+ * are in no word, have the same class. The transitions of each state are a row
+ * of the table with a column per class, so the table is small enough to stay
+ * in cache. Each transition is already the complete one (the trie edge, or the
+ * one of the longest suffix that has it), so a scan is one lookup per byte.
+ *
+ * Transitions hold the offset of the row of the next state, and have
+ * MATCH_FLAG set if reaching it completes a word, so the words are only
+ * looked up then.
+ *
+ * Most buffers have none of the words, so before running the automaton a
+ * prefilter finds the positions where the first two bytes of some word are,
+ * comparing 16 or 32 bytes at once with SSE2 or AVX2 (whichever the CPU has).
+ * Bytes are compared with the 0x20 bit set, which makes both cases of a letter
+ * equal, and some other bytes too: that only gives more candidates. Whenever
+ * the automaton is at most one byte into a word (SHALLOW_FLAG), no word can
+ * have started before that byte, so it jumps to the next candidate.
+ */
+
+#include "word_matcher.h"
+
+#include "fat_util.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define MATCH_FLAG 0x80000000u
+#define SHALLOW_FLAG 0x40000000u // To a state of depth 0 or 1
+#define ROW_MASK (SHALLOW_FLAG - 1)
+
+// Different first two bytes of the words that the prefilter looks for. With
+// more the automaton is faster alone.
+#define PREFILTER_MAX_PAIRS 8
+
+// Positions checked by the prefilter at once
+#define PREFILTER_WINDOW 64
+
+struct word_matcher_s;
+
+/* Returns a mask with bit i set if a word can start at @bytes[i], for the
+ * PREFILTER_WINDOW positions of @bytes. @bytes must have one byte more.
+ */
+typedef u64 (*prefilter_fn)(const struct word_matcher_s *matcher,
+                            const u8 *bytes);
+
+struct word_matcher_s {
+    u8 classes[256];
+    size_t num_classes;
+    size_t num_states;
+    // num_states rows of num_classes transitions
+    u32 *next;
+    // Words that end in each state, or in one of its suffixes
+    u32 *matches;
+    u32 empty_words;
+    u32 all_words;
+    size_t max_word_len;
+    // NULL if some word is shorter than two bytes, or there are too many
+    // pairs (and then num_pairs is 0)
+    prefilter_fn prefilter;
+    size_t num_pairs;
+    u8 pair_first[PREFILTER_MAX_PAIRS];
+    u8 pair_second[PREFILTER_MAX_PAIRS];
+    // Bit (first << 8 | second) of the first two bytes of the words, in
+    // lower case, for the positions at the end of the buffers
+    u8 pairs[256 * 256 / 8];
+};
+
+// Position of the candidates of a prefilter window
+struct candidates_s {
+    size_t start;
+    u64 mask;
+};
+
+/* Returns @c in lower case, if it's an ASCII letter, like strncasecmp in the
+ * C locale.
+ */
+static inline u8 fold(u8 c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/* Gives a class to each byte that is in @words, the same to both cases of a
+ * letter. Returns the number of classes, with class 0 for the other bytes.
+ */
+static size_t classify(word_matcher matcher, char *const *words,
+                       size_t num_words) {
+    u8 folded_class[256] = {0};
+    size_t num_classes = 1;
+
+    for (size_t i = 0; i < num_words; i++) {
+        for (const char *c = words[i]; *c != '\0'; c++) {
+            u8 folded = fold(*c);
+            if (folded_class[folded] == 0) {
+                folded_class[folded] = num_classes++;
+            }
+        }
+    }
+    for (unsigned int c = 0; c < 256; c++) {
+        matcher->classes[c] = folded_class[fold(c)];
+    }
+    return num_classes;
+}
+
+/* Adds the trie of @words to the table of @matcher, where 0 means that there
+ * is no edge yet (the root is never the target of one).
+ */
+static void build_trie(word_matcher matcher, char *const *words,
+                       size_t num_words, u8 *shallow) {
+    matcher->num_states = 1;
+    shallow[0] = true;
+    for (size_t i = 0; i < num_words; i++) {
+        size_t state = 0;
+        if (words[i][0] == '\0') {
+            matcher->empty_words |= 1u << i;
+            continue;
+        }
+        for (const char *c = words[i]; *c != '\0'; c++) {
+            u32 *edge = &matcher->next[state * matcher->num_classes +
+                                       matcher->classes[(u8)*c]];
+            if (*edge == 0) {
+                *edge = matcher->num_states++;
+                shallow[*edge] = c == words[i];
+            }
+            state = *edge;
+        }
+        matcher->matches[state] |= 1u << i;
+    }
+}
+
+/* Completes the transitions of the trie of @matcher, visiting the states in
+ * order of depth. When a state is visited, the transitions of its suffix
+ * @fail are already complete, so the missing ones are copied from it.
+ * Returns false if there is no memory.
+ */
+static bool build_transitions(word_matcher matcher) {
+    size_t num_classes = matcher->num_classes;
+    u32 *queue = malloc(matcher->num_states * sizeof(u32));
+    u32 *fail = calloc(matcher->num_states, sizeof(u32));
+    size_t first = 0, last = 0;
+
+    if (queue == NULL || fail == NULL) {
+        free(queue);
+        free(fail);
+        return false;
+    }
+    for (size_t c = 0; c < num_classes; c++) {
+        u32 child = matcher->next[c];
+        if (child != 0) {
+            queue[last++] = child; // Fails to the root
+        }
+    }
+    while (first < last) {
+        u32 state = queue[first++];
+        u32 *row = &matcher->next[state * num_classes];
+        const u32 *fail_row = &matcher->next[fail[state] * num_classes];
+        matcher->matches[state] |= matcher->matches[fail[state]];
+        for (size_t c = 0; c < num_classes; c++) {
+            if (row[c] != 0) {
+                fail[row[c]] = fail_row[c];
+                queue[last++] = row[c];
+            } else {
+                row[c] = fail_row[c];
+            }
+        }
+    }
+    free(queue);
+    free(fail);
+    return true;
+}
+
+/* Turns the states in the table of @matcher into offsets of their rows, with
+ * MATCH_FLAG if a word ends there and SHALLOW_FLAG if they are in @shallow.
+ */
+static void encode_transitions(word_matcher matcher, const u8 *shallow) {
+    size_t size = matcher->num_states * matcher->num_classes;
+    for (size_t i = 0; i < size; i++) {
+        u32 state = matcher->next[i];
+        matcher->next[i] = state * matcher->num_classes;
+        if (matcher->matches[state] != 0) {
+            matcher->next[i] |= MATCH_FLAG;
+        }
+        if (shallow[state]) {
+            matcher->next[i] |= SHALLOW_FLAG;
+        }
+    }
+}
+
+static bool is_pair(const struct word_matcher_s *matcher, const u8 *bytes) {
+    unsigned int pair = fold(bytes[0]) << 8 | fold(bytes[1]);
+    return matcher->pairs[pair / 8] & (1u << (pair % 8));
+}
+
+static u64 prefilter_scalar(const struct word_matcher_s *matcher,
+                            const u8 *bytes) {
+    u64 mask = 0;
+    for (unsigned int i = 0; i < PREFILTER_WINDOW; i++) {
+        if (is_pair(matcher, bytes + i)) {
+            mask |= (u64)1 << i;
+        }
+    }
+    return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static u64
+prefilter_sse2(const struct word_matcher_s *matcher, const u8 *bytes) {
+    const __m128i lower = _mm_set1_epi8(0x20);
+    u64 mask = 0;
+    for (unsigned int i = 0; i < PREFILTER_WINDOW; i += 16) {
+        __m128i first = _mm_or_si128(
+            _mm_loadu_si128((const __m128i *)(bytes + i)), lower);
+        __m128i second = _mm_or_si128(
+            _mm_loadu_si128((const __m128i *)(bytes + i + 1)), lower);
+        __m128i hits = _mm_setzero_si128();
+        for (size_t p = 0; p < matcher->num_pairs; p++) {
+            __m128i hit = _mm_and_si128(
+                _mm_cmpeq_epi8(first, _mm_set1_epi8(matcher->pair_first[p])),
+                _mm_cmpeq_epi8(second,
+                               _mm_set1_epi8(matcher->pair_second[p])));
+            hits = _mm_or_si128(hits, hit);
+        }
+        mask |= (u64)(u16)_mm_movemask_epi8(hits) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static u64
+prefilter_avx2(const struct word_matcher_s *matcher, const u8 *bytes) {
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    u64 mask = 0;
+    for (unsigned int i = 0; i < PREFILTER_WINDOW; i += 32) {
+        __m256i first = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i *)(bytes + i)), lower);
+        __m256i second = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i *)(bytes + i + 1)), lower);
+        __m256i hits = _mm256_setzero_si256();
+        for (size_t p = 0; p < matcher->num_pairs; p++) {
+            __m256i hit = _mm256_and_si256(
+                _mm256_cmpeq_epi8(first,
+                                  _mm256_set1_epi8(matcher->pair_first[p])),
+                _mm256_cmpeq_epi8(second,
+                                  _mm256_set1_epi8(matcher->pair_second[p])));
+            hits = _mm256_or_si256(hits, hit);
+        }
+        mask |= (u64)(u32)_mm256_movemask_epi8(hits) << i;
+    }
+    return mask;
+}
+#endif
+
+/* Returns the fastest prefilter for this CPU */
+static prefilter_fn prefilter_select(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return prefilter_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return prefilter_sse2;
+    }
+#endif
+    return prefilter_scalar;
+}
+
+/* Sets up the prefilter of @matcher for the first two bytes of @words, if
+ * it can be used with them.
+ */
+static void build_prefilter(word_matcher matcher, char *const *words,
+                            size_t num_words) {
+    for (size_t i = 0; i < num_words; i++) {
+        const u8 *word = (const u8 *)words[i];
+        if (word[0] == '\0') {
+            continue; // Found without looking
+        }
+        if (word[1] == '\0') {
+            matcher->num_pairs = 0;
+            return; // A single byte, no pair to look for
+        }
+        unsigned int pair = fold(word[0]) << 8 | fold(word[1]);
+        if (matcher->pairs[pair / 8] & (1u << (pair % 8))) {
+            continue;
+        }
+        if (matcher->num_pairs == PREFILTER_MAX_PAIRS) {
+            matcher->num_pairs = 0;
+            return;
+        }
+        matcher->pairs[pair / 8] |= 1u << (pair % 8);
+        matcher->pair_first[matcher->num_pairs] = word[0] | 0x20;
+        matcher->pair_second[matcher->num_pairs] = word[1] | 0x20;
+        matcher->num_pairs++;
+    }
+    if (matcher->num_pairs != 0) {
+        matcher->prefilter = prefilter_select();
+    }
+}
+
+word_matcher word_matcher_init(char *const *words) {
+    size_t num_words = 0, max_states = 1;
+    word_matcher matcher = calloc(1, sizeof(struct word_matcher_s));
+
+    if (matcher == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    while (words[num_words] != NULL && num_words < WORD_MATCHER_MAX_WORDS) {
+        size_t len = strlen(words[num_words]);
+        max_states += len;
+        matcher->max_word_len = max(matcher->max_word_len, len);
+        num_words++;
+    }
+    matcher->all_words = num_words == WORD_MATCHER_MAX_WORDS
+                             ? UINT32_MAX
+                             : (1u << num_words) - 1;
+    matcher->num_classes = classify(matcher, words, num_words);
+    if (max_states * matcher->num_classes > ROW_MASK) {
+        free(matcher);
+        errno = EINVAL;
+        return NULL;
+    }
+    matcher->next = calloc(max_states * matcher->num_classes, sizeof(u32));
+    matcher->matches = calloc(max_states, sizeof(u32));
+    u8 *shallow = calloc(max_states, sizeof(u8));
+    if (matcher->next == NULL || matcher->matches == NULL ||
+        shallow == NULL) {
+        free(shallow);
+        word_matcher_destroy(matcher);
+        errno = ENOMEM;
+        return NULL;
+    }
+    build_trie(matcher, words, num_words, shallow);
+    if (!build_transitions(matcher)) {
+        free(shallow);
+        word_matcher_destroy(matcher);
+        errno = ENOMEM;
+        return NULL;
+    }
+    encode_transitions(matcher, shallow);
+    free(shallow);
+    build_prefilter(matcher, words, num_words);
+    return matcher;
+}
+
+bool word_matcher_set_prefilter(word_matcher matcher,
+                                enum word_matcher_prefilter prefilter) {
+    prefilter_fn fn = NULL;
+    switch (prefilter) {
+    case WORD_MATCHER_PREFILTER_NONE:
+        matcher->prefilter = NULL;
+        return true;
+    case WORD_MATCHER_PREFILTER_SCALAR:
+        fn = prefilter_scalar;
+        break;
+#if defined(__x86_64__) || defined(__i386__)
+    case WORD_MATCHER_PREFILTER_SSE2:
+        __builtin_cpu_init();
+        fn = __builtin_cpu_supports("sse2") ? prefilter_sse2 : NULL;
+        break;
+    case WORD_MATCHER_PREFILTER_AVX2:
+        __builtin_cpu_init();
+        fn = __builtin_cpu_supports("avx2") ? prefilter_avx2 : NULL;
+        break;
+#endif
+    default:
+        break;
+    }
+    if (fn == NULL || matcher->num_pairs == 0) {
+        return false;
+    }
+    matcher->prefilter = fn;
+    return true;
+}
+
+void word_matcher_destroy(word_matcher matcher) {
+    free(matcher->next);
+    free(matcher->matches);
+    free(matcher);
+}
+
+size_t word_matcher_max_len(const word_matcher matcher) {
+    return matcher->max_word_len;
+}
+
+/* Returns the first position from @from where a word of @matcher can start
+ * in the @size @bytes, the last one if there is none before (or @size if
+ * @from is past it). @candidates keeps the last window of the prefilter, that
+ * starts at @size if there is none yet.
+ */
+static size_t next_candidate(const word_matcher matcher, const u8 *bytes,
+                             size_t size, struct candidates_s *candidates,
+                             size_t from) {
+    while (true) {
+        if (from >= candidates->start &&
+            from - candidates->start < PREFILTER_WINDOW) {
+            u64 mask = candidates->mask >> (from - candidates->start);
+            if (mask != 0) {
+                return from + __builtin_ctzll(mask);
+            }
+            from = candidates->start + PREFILTER_WINDOW;
+        }
+        if (from >= size || size - from <= PREFILTER_WINDOW) {
+            break; // The window would read past the end
+        }
+        candidates->start = from;
+        candidates->mask = matcher->prefilter(matcher, bytes + from);
+    }
+    for (; from + 1 < size; from++) {
+        if (is_pair(matcher, bytes + from)) {
+            return from;
+        }
+    }
+    // A word can start at the last byte and go on in the next buffer
+    return min(from, size);
+}
+
+/* Runs the automaton of @matcher over the @size @bytes, from the state in
+ * @state. Returns the words found, and sets @state to the one after the last
+ * byte scanned and @scanned to their number: all of them, unless the words
+ * in @stop (not 0) were found before.
+ */
+static u32 scan(const word_matcher matcher, word_matcher_state *state,
+                const u8 *bytes, size_t size, u32 stop, size_t *scanned) {
+    const u32 *next = matcher->next;
+    u32 found = size != 0 ? matcher->empty_words : 0;
+    u32 row = *state;
+    size_t i = 0;
+    struct candidates_s candidates = {.start = size, .mask = 0};
+
+    // Otherwise a word started in the previous buffer
+    if (row == 0 && matcher->prefilter != NULL) {
+        i = next_candidate(matcher, bytes, size, &candidates, 0);
+    }
+    while (i < size) {
+        u32 transition = next[row + matcher->classes[bytes[i++]]];
+        row = transition & ROW_MASK;
+        if (transition & MATCH_FLAG) {
+            found |= matcher->matches[row / matcher->num_classes];
+            if (found == stop) {
+                break; // Nothing else to find
+            }
+        }
+        if ((transition & SHALLOW_FLAG) && matcher->prefilter != NULL) {
+            // A word can only start at the last byte if it's its first one
+            size_t from = row == 0 ? i : i - 1;
+            size_t candidate =
+                next_candidate(matcher, bytes, size, &candidates, from);
+            if (candidate != from) {
+                i = candidate;
+                row = 0;
+            }
+        }
+    }
+    *state = row;
+    *scanned = i;
+    return found;
+}
+
+u32 word_matcher_scan(const word_matcher matcher, const char *buf,
+                      size_t size) {
+    word_matcher_state state = WORD_MATCHER_START;
+    size_t scanned;
+    return scan(matcher, &state, (const u8 *)buf, size, matcher->all_words,
+                &scanned);
+}
+
+u32 word_matcher_scan_stream(const word_matcher matcher,
+                             word_matcher_state *state, const char *buf,
+                             size_t size) {
+    const u8 *bytes = (const u8 *)buf;
+    word_matcher_state start = *state;
+    size_t scanned;
+    u32 found =
+        scan(matcher, state, bytes, size, matcher->all_words, &scanned);
+    if (scanned < size) {
+        // Stopped early. The state after the buffer only depends on its
+        // last bytes, as many as the longest word but one.
+        size_t tail = matcher->max_word_len - 1;
+        if (size > tail) {
+            *state = WORD_MATCHER_START;
+            scan(matcher, state, bytes + size - tail, tail, 0, &scanned);
+        } else {
+            *state = start;
+            scan(matcher, state, bytes, size, 0, &scanned);
+        }
+    }
+    return found;
+}
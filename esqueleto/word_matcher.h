@@ -0,0 +1,77 @@
+/*
+ * word_matcher.h
+ *
+ * Finds which of a list of words appear in a buffer, ignoring the case of
+ * ASCII letters, in a single pass over it.
+ *
+ * The words are compiled into an Aho-Corasick automaton: a trie of the words
+ * where each state also knows where to continue when the next byte doesn't
+ * extend it, so every byte of the buffer is looked at once, whatever the
+ * number and length of the words. With few words, a vectorized prefilter
+ * skips the parts of the buffer where none of them can start.
+ */
+
+#ifndef _WORD_MATCHER_H
+#define _WORD_MATCHER_H
+
+#include "fat_types.h"
+#include <stdbool.h>
+
+// Words of a matcher, the bits of the result of word_matcher_scan
+#define WORD_MATCHER_MAX_WORDS 32
+
+typedef struct word_matcher_s *word_matcher;
+
+// Where the scan of a stream of bytes is, between two of its buffers
+typedef u32 word_matcher_state;
+#define WORD_MATCHER_START 0
+
+/* Compiles the @words, ended by NULL. Words after the first
+ * WORD_MATCHER_MAX_WORDS are ignored.
+ * Returns NULL and sets errno to ENOMEM if there is no memory, or to EINVAL if
+ * the words are too long.
+ */
+word_matcher word_matcher_init(char *const *words);
+
+// Prefilters that a matcher can use, see word_matcher_set_prefilter
+enum word_matcher_prefilter {
+    WORD_MATCHER_PREFILTER_NONE,
+    WORD_MATCHER_PREFILTER_SCALAR,
+    WORD_MATCHER_PREFILTER_SSE2,
+    WORD_MATCHER_PREFILTER_AVX2,
+};
+
+/* Makes @matcher use @prefilter, instead of the fastest one for this CPU.
+ * It's meant for the tests, that compare them.
+ * Returns false if this CPU doesn't have it, or the words of @matcher can't
+ * be prefiltered (some word has a single byte, or there are too many
+ * different first two bytes). WORD_MATCHER_PREFILTER_NONE can always be set.
+ */
+bool word_matcher_set_prefilter(word_matcher matcher,
+                                enum word_matcher_prefilter prefilter);
+
+/* Frees @matcher */
+void word_matcher_destroy(word_matcher matcher);
+
+/* Returns the length of the longest word of @matcher. What a stream finds
+ * next only depends on its last word_matcher_max_len() - 1 bytes.
+ */
+size_t word_matcher_max_len(const word_matcher matcher);
+
+/* Returns the words of @matcher found in the @size bytes of @buf, as a mask
+ * with the bit i set if word i was found. An empty word is found in any
+ * buffer that is not empty.
+ */
+u32 word_matcher_scan(const word_matcher matcher, const char *buf,
+                      size_t size);
+
+/* Like word_matcher_scan, for the next @size bytes of a stream whose scan is
+ * in @state (WORD_MATCHER_START for the first ones). Leaves in @state where the
+ * scan is after them, so a word split between two buffers is found with the
+ * second one, and each byte is only scanned once.
+ */
+u32 word_matcher_scan_stream(const word_matcher matcher,
+                             word_matcher_state *state, const char *buf,
+                             size_t size);
+
+#endif /* _WORD_MATCHER_H */